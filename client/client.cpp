@@ -23,6 +23,7 @@
 #include "client.h"
 #include "helpers.h"
 
+#include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -43,6 +44,62 @@
 #include <sstream>
 #include <string>
 
+/*****************
+ * Request Batch *
+ *****************/
+RequestBatch::RequestBatch() {
+    const char* opt = getenv("SHINJUKU_BATCH");
+    int room = sizeof(buf) / (sizeof(CoalescedRecord) + sizeof(Request));
+
+    // the server takes at most 64 requests per datagram (BATCH_MAX_REQS)
+    room = std::min(room, 64);
+
+    len = nr = 0;
+    fd = -1;
+    firstNs = 0;
+    max = opt ? std::min(std::max(atoi(opt), 0), room) : 0;
+    opt = getenv("SHINJUKU_BATCH_US");
+    timeoutNs = (opt ? strtoull(opt, nullptr, 0) : 100) * 1000;
+}
+
+bool RequestBatch::flush(std::string& error) {
+    int sent;
+    bool ok;
+
+    sent = ::send(fd, buf, len, 0);
+    if (sent != len) {
+        error = strerror(errno);
+    }
+    ok = (sent == len);
+    len = nr = 0;
+    return ok;
+}
+
+// Adds a request to the batch and sends the batch once it is full.
+bool RequestBatch::send(int fd, const Request* req, std::string& error) {
+    CoalescedRecord rec;
+
+    if (nr == 0) {
+        this->fd = fd;
+        firstNs = getCurNs();
+    }
+    rec.len = htons(sizeof(Request));
+    memcpy(buf + len, &rec, sizeof(rec));
+    memcpy(buf + len + sizeof(rec), req, sizeof(Request));
+    len += sizeof(rec) + sizeof(Request);
+    if (++nr < max)
+        return true;
+    return flush(error);
+}
+
+// Sends a partial batch that waited too long, so that low rates and the
+// end of a run do not hold requests back.
+bool RequestBatch::poll(uint64_t curNs, std::string& error) {
+    if (nr == 0 || curNs - firstNs < timeoutNs)
+        return true;
+    return flush(error);
+}
+
 /*******************
  * Networked Client*
  *******************/
@@ -81,11 +138,63 @@ Client::Client(std::string serverip, int serverport) {
         exit(-1);
     }
     fcntl(serverFd, F_SETFL, fcntl(serverFd, F_GETFL) | O_NONBLOCK);
+
+    coalesced = getenv("SHINJUKU_COALESCED") != nullptr;
+}
+
+/*
+ * Reads the next response from fd, like recv(). Coalesced datagrams are
+ * kept in the buffer of fd and handed out one record at a time.
+ */
+int Client::readResp(int fd, Response* resp) {
+    CoalescedRecord rec;
+    int len;
+
+    if (!coalesced)
+        return ::recv(fd, reinterpret_cast<void*>(resp), sizeof(Response), 0);
+
+    RxBuf& rx = rxbufs[fd];
+    if (rx.off == rx.len) {
+        rx.off = 0;
+        rx.len = ::recv(fd, rx.buf, sizeof(rx.buf), 0);
+        if (rx.len <= 0) {
+            len = rx.len;
+            rx.len = 0;
+            return len;
+        }
+    }
+
+    if (rx.len - rx.off < (int) sizeof(rec)) {
+        rx.off = rx.len;
+        return 0;
+    }
+    memcpy(&rec, rx.buf + rx.off, sizeof(rec));
+    rx.off += sizeof(rec);
+    len = std::min((int) ntohs(rec.len), rx.len - rx.off);
+    memcpy(resp, rx.buf + rx.off, std::min(len, (int) sizeof(Response)));
+    rx.off += len;
+    return len;
+}
+
+// Waits for the next arrival, flushing a partial batch meanwhile.
+void Client::waitUntil(uint64_t ns) {
+    uint64_t curNs;
+
+    while ((curNs = getCurNs()) < ns) {
+        if (!batch.poll(curNs, error))
+            std::cerr << "[CLIENT] send() failed : " << error << std::endl;
+    }
 }
 
 bool Client::send(Request* req) {
     int len = sizeof(Request);
 
+    if (batch.enabled()) {
+        bool ok = batch.send(serverFd, req, error);
+        delete req;
+        return ok;
+    }
+
     int sent = ::send(serverFd, reinterpret_cast<const void*>(req), len, 0);
     if (sent != len) {
         error = strerror(errno);
@@ -99,7 +208,7 @@ bool Client::recv(Response* resp) {
     int len = sizeof(Response);
     int recvd = 0;
     do {
-        recvd = ::recv(serverFd, reinterpret_cast<void*>(resp), len, 0);
+        recvd = readResp(serverFd, resp);
     } while (recvd == -1);
     return (recvd == len);
 }
@@ -149,9 +258,32 @@ MultiClient::MultiClient(std::string serverip, int serverport) {
     }
 }
 
+// Waits for the next arrival, flushing a partial batch meanwhile.
+void MultiClient::waitUntil(uint64_t ns) {
+    uint64_t curNs;
+
+    while ((curNs = getCurNs()) < ns) {
+        if (batch.empty())
+            continue;
+        if (!batch.poll(curNs, error))
+            std::cerr << "[CLIENT] send() failed : " << error << std::endl;
+        if (batch.empty())
+            index = (index + 1) % NUM_SOCKETS;
+    }
+}
+
 bool MultiClient::send(Request* req) {
     int len = sizeof(Request);
 
+    if (batch.enabled()) {
+        bool ok = batch.send(serverFd[index], req, error);
+        // a new socket once the batch went out
+        if (batch.empty())
+            index = (index + 1) % NUM_SOCKETS;
+        delete req;
+        return ok;
+    }
+
     int sent = ::send(serverFd[index], reinterpret_cast<const void*>(req), len, 0);
     if (sent != len) {
         error = strerror(errno);
@@ -190,7 +322,7 @@ Request* BatchClient::startReq() {
 	uint64_t curNs = getCurNs();
 	uint64_t genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < genNs);
+	waitUntil(genNs);
 
 	return req;
 }
@@ -221,7 +353,7 @@ Request* BimodalBatchClient::startReq() {
 	uint64_t curNs = getCurNs();
 	uint64_t genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < genNs);
+	waitUntil(genNs);
 
 	return req;
 }
@@ -253,7 +385,7 @@ Request* TrimodalBatchClient::startReq() {
 	uint64_t curNs = getCurNs();
 	uint64_t genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < genNs);
+	waitUntil(genNs);
 
 	return req;
 }
@@ -348,7 +480,7 @@ Request* PortTrimodalBatchClient::startReq() {
 	uint64_t curNs = getCurNs();
 	uint64_t genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < genNs);
+	waitUntil(genNs);
 
 	return req;
 }
@@ -443,7 +575,7 @@ Request* PortBimodalBatchClient::startReq() {
 	uint64_t curNs = getCurNs();
 	uint64_t genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < genNs);
+	waitUntil(genNs);
 
 	return req;
 }
@@ -494,7 +626,7 @@ Request* ExponentialBatchClient::startReq() {
 	uint64_t curNs = getCurNs();
 	uint64_t genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < genNs);
+	waitUntil(genNs);
 
 	return req;
 }
@@ -525,7 +657,7 @@ Request* LognormalBatchClient::startReq() {
 	uint64_t curNs = getCurNs();
 	uint64_t genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < genNs);
+	waitUntil(genNs);
 
 	return req;
 }
@@ -555,7 +687,7 @@ Request* SiloBatchClient::startReq() {
 	uint64_t curNs = getCurNs();
 	uint64_t genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < genNs);
+	waitUntil(genNs);
 
 	return req;
 }
@@ -583,7 +715,7 @@ Request* LatencyClient::startReq() {
 	req->runNs = work;
 	req->genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < req->genNs);
+	waitUntil(req->genNs);
 
 	return req;
 }
@@ -674,7 +806,7 @@ Request* BimodalDoubleLatencyClient::startReq() {
 	req->runNs = work_dist->workNs();
 	req->genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < req->genNs);
+	waitUntil(req->genNs);
 
 	return req;
 }
@@ -735,10 +867,10 @@ bool BimodalDoubleLatencyClient::recv(Response* resp) {
     int len = sizeof(Response);
     int recvd = 0;
     do {
-        recvd = ::recv(serverFd, reinterpret_cast<void*>(resp), len, 0);
+        recvd = readResp(serverFd, resp);
 	if (recvd != -1)
 	    break;
-        recvd = ::recv(serverFd2, reinterpret_cast<void*>(resp), len, 0);
+        recvd = readResp(serverFd2, resp);
     } while (recvd == -1);
     return (recvd == len);
 }
@@ -823,7 +955,7 @@ Request* PortTrimodalLatencyClient::startReq() {
 	req->runNs = work_dist->workNs();
 	req->genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < req->genNs);
+	waitUntil(req->genNs);
 
 	return req;
 }
@@ -889,13 +1021,13 @@ bool PortTrimodalLatencyClient::recv(Response* resp) {
     int len = sizeof(Response);
     int recvd = 0;
     do {
-        recvd = ::recv(serverFd, reinterpret_cast<void*>(resp), len, 0);
+        recvd = readResp(serverFd, resp);
 	if (recvd != -1)
 	    break;
-        recvd = ::recv(serverFd2, reinterpret_cast<void*>(resp), len, 0);
+        recvd = readResp(serverFd2, resp);
 	if (recvd != -1)
 	    break;
-        recvd = ::recv(serverFd3, reinterpret_cast<void*>(resp), len, 0);
+        recvd = readResp(serverFd3, resp);
     } while (recvd == -1);
     return (recvd == len);
 }
@@ -956,7 +1088,7 @@ Request* PortBimodalLatencyClient::startReq() {
 	req->runNs = work_dist->workNs();
 	req->genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < req->genNs);
+	waitUntil(req->genNs);
 
 	return req;
 }
@@ -1017,10 +1149,10 @@ bool PortBimodalLatencyClient::recv(Response* resp) {
     int len = sizeof(Response);
     int recvd = 0;
     do {
-        recvd = ::recv(serverFd, reinterpret_cast<void*>(resp), len, 0);
+        recvd = readResp(serverFd, resp);
 	if (recvd != -1)
 	    break;
-        recvd = ::recv(serverFd2, reinterpret_cast<void*>(resp), len, 0);
+        recvd = readResp(serverFd2, resp);
     } while (recvd == -1);
     return (recvd == len);
 }
@@ -1045,7 +1177,7 @@ Request* BimodalLatencyClient::startReq() {
 	req->runNs = work_dist->workNs();
 	req->genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < req->genNs);
+	waitUntil(req->genNs);
 
 	return req;
 }
@@ -1071,7 +1203,7 @@ Request* TrimodalLatencyClient::startReq() {
 	req->runNs = work_dist->workNs();
 	req->genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < req->genNs);
+	waitUntil(req->genNs);
 
 	return req;
 }
@@ -1096,7 +1228,7 @@ Request* ExponentialLatencyClient::startReq() {
 	req->runNs = work_dist->workNs();
 	req->genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < req->genNs);
+	waitUntil(req->genNs);
 
 	return req;
 }
@@ -1120,7 +1252,7 @@ Request* LognormalLatencyClient::startReq() {
 	req->runNs = work_dist->workNs();
 	req->genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < req->genNs);
+	waitUntil(req->genNs);
 
 	return req;
 }
@@ -1143,7 +1275,7 @@ Request* SiloLatencyClient::startReq() {
 	req->runNs = type;
 	req->genNs = dist->nextArrivalNs();
 
-	while (getCurNs() < req->genNs);
+	waitUntil(req->genNs);
 
 	return req;
 }
@@ -35,11 +35,51 @@
 
 #define NUM_SOCKETS 20
 
+// Packs several requests into one datagram when SHINJUKU_BATCH is set to the
+// number of requests per datagram (for servers with batch_requests). A
+// partial batch goes out once its oldest request waited SHINJUKU_BATCH_US
+// (100 by default).
+class RequestBatch {
+	private:
+		char buf[1472];
+		int len;
+		int nr;
+		int max;
+		int fd;
+		uint64_t firstNs;
+		uint64_t timeoutNs;
+
+		bool flush(std::string& error);
+
+	public:
+		RequestBatch();
+		bool enabled() const { return max > 0; }
+		bool empty() const { return nr == 0; }
+		bool send(int fd, const Request* req, std::string& error);
+		bool poll(uint64_t curNs, std::string& error);
+};
+
 class Client {
 	protected:
 		int serverFd;
 		std::string error;
 
+		// set SHINJUKU_COALESCED when the server coalesces responses
+		bool coalesced;
+		// the coalesced datagram being handed out, one per socket
+		struct RxBuf {
+			char buf[2048];
+			int len;
+			int off;
+		};
+		std::unordered_map<int, RxBuf> rxbufs;
+
+		int readResp(int fd, Response* resp);
+
+		RequestBatch batch;
+
+		void waitUntil(uint64_t ns);
+
 	public:
 		Client(std::string serverip, int serverport);
 		bool send(Request* req);
@@ -52,6 +92,9 @@ class MultiClient {
 		int serverFd[NUM_SOCKETS];
 		std::string error;
 		int index;
+		RequestBatch batch;
+
+		void waitUntil(uint64_t ns);
 
 	public:
 		MultiClient(std::string serverip, int serverport);
@@ -35,4 +35,13 @@ struct Response {
     uint64_t genNs;
 };
 
+/*
+ * When the server coalesces responses (coalesce_ns), each datagram holds one
+ * or more responses, each preceded by this record header. Requests are
+ * framed the same way when the server expects batches (batch_requests).
+ */
+struct CoalescedRecord {
+    uint16_t len; // network byte order
+} __attribute__((packed));
+
 #endif
@@ -0,0 +1,312 @@
+/*
+ * Copyright 2019 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * shm_peer - a load generator for a dataplane running on a shared memory
+ * device ("shm:<path>", see inc/ix/shmdev.h). It plays the part of the
+ * network and of a client host at PEER_IP: it answers the ARP requests of
+ * the dataplane, sends it requests for PORT with exponential gaps at RPS,
+ * and prints the latency percentiles of the responses after SECONDS. A
+ * static ARP entry for PEER_IP in the configuration has to use the MAC
+ * address 02:00:00:00:00:fe.
+ *
+ * Usage: shm_peer <PATH> <DP_IP> <PEER_IP> <PORT> <RPS> <SPIN_NS> [SECONDS]
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <ix/shmdev.h>
+
+#include "helpers.h"
+#include "msgs.h"
+
+#define ETHTYPE_IP	0x0800
+#define ETHTYPE_ARP	0x0806
+#define ARP_REQUEST	1
+#define ARP_REPLY	2
+#define IPPROTO_UDP_	17
+/* source ports of the requests, so that they look like many flows */
+#define NR_SRC_PORTS	4096
+
+struct EthHdr {
+	uint8_t dst[6];
+	uint8_t src[6];
+	uint16_t type;
+} __attribute__((packed));
+
+struct ArpHdr {
+	uint16_t htype;
+	uint16_t ptype;
+	uint8_t hlen;
+	uint8_t plen;
+	uint16_t op;
+	uint8_t sha[6];
+	uint32_t spa;
+	uint8_t tha[6];
+	uint32_t tpa;
+} __attribute__((packed));
+
+struct IpHdr {
+	uint8_t vhl;
+	uint8_t tos;
+	uint16_t len;
+	uint16_t id;
+	uint16_t off;
+	uint8_t ttl;
+	uint8_t proto;
+	uint16_t chksum;
+	uint32_t src;
+	uint32_t dst;
+} __attribute__((packed));
+
+struct UdpHdr {
+	uint16_t src;
+	uint16_t dst;
+	uint16_t len;
+	uint16_t chksum;
+} __attribute__((packed));
+
+struct ReqFrame {
+	EthHdr eth;
+	IpHdr ip;
+	UdpHdr udp;
+	Request req;
+} __attribute__((packed));
+
+static const uint8_t peerMac[6] = { 0x02, 0, 0, 0, 0, 0xfe };
+
+static uint16_t ipChksum(const void* hdr, size_t len) {
+	const uint16_t* p = (const uint16_t*) hdr;
+	uint32_t sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *p++;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static bool ringPut(shmdev_ring* r, const void* frame, uint32_t len) {
+	uint32_t head = r->head;
+
+	if (head - r->tail == SHMDEV_RING_SIZE)
+		return false;
+	shmdev_slot* slot = &r->slots[head & (SHMDEV_RING_SIZE - 1)];
+	memcpy(slot->data, frame, len);
+	slot->len = len;
+	/* the slot must be written before it is published */
+	asm volatile("" ::: "memory");
+	r->head = head + 1;
+	return true;
+}
+
+static void answerArp(shmdev_region* region, const uint8_t* frame,
+		      uint32_t len, uint32_t peerIp) {
+	const EthHdr* eth = (const EthHdr*) frame;
+	const ArpHdr* arp = (const ArpHdr*) (eth + 1);
+	uint8_t buf[sizeof(EthHdr) + sizeof(ArpHdr)];
+	EthHdr* reth = (EthHdr*) buf;
+	ArpHdr* rarp = (ArpHdr*) (reth + 1);
+
+	if (len < sizeof(buf) || arp->op != htons(ARP_REQUEST) ||
+	    arp->tpa != peerIp)
+		return;
+
+	memcpy(reth->dst, eth->src, 6);
+	memcpy(reth->src, peerMac, 6);
+	reth->type = htons(ETHTYPE_ARP);
+	*rarp = *arp;
+	rarp->op = htons(ARP_REPLY);
+	memcpy(rarp->sha, peerMac, 6);
+	rarp->spa = peerIp;
+	memcpy(rarp->tha, arp->sha, 6);
+	rarp->tpa = arp->spa;
+	if (!ringPut(&region->rx, buf, sizeof(buf)))
+		std::cerr << "rx ring full, ARP reply dropped" << std::endl;
+}
+
+static void recordResponses(const uint8_t* frame, uint32_t len,
+			    std::vector<uint64_t>& lats) {
+	const EthHdr* eth = (const EthHdr*) frame;
+	const IpHdr* ip = (const IpHdr*) (eth + 1);
+	const UdpHdr* udp;
+	const uint8_t* data;
+	uint64_t now = getCurNs();
+	Response resp;
+	CoalescedRecord rec;
+	uint32_t ipLen, dataLen, off;
+
+	if (len < sizeof(EthHdr) + sizeof(IpHdr) || ip->proto != IPPROTO_UDP_)
+		return;
+	ipLen = (ip->vhl & 0xf) * 4;
+	udp = (const UdpHdr*) ((const uint8_t*) ip + ipLen);
+	data = (const uint8_t*) (udp + 1);
+	if ((const uint8_t*) data > frame + len ||
+	    ntohs(udp->len) < sizeof(UdpHdr) ||
+	    data + ntohs(udp->len) - sizeof(UdpHdr) > frame + len)
+		return;
+	dataLen = ntohs(udp->len) - sizeof(UdpHdr);
+
+	if (dataLen == sizeof(Response)) {
+		memcpy(&resp, data, sizeof(resp));
+		lats.push_back(now - resp.genNs);
+		return;
+	}
+	/* coalesced responses */
+	for (off = 0; off + sizeof(rec) <= dataLen;
+	     off += sizeof(rec) + ntohs(rec.len)) {
+		memcpy(&rec, data + off, sizeof(rec));
+		if (ntohs(rec.len) < sizeof(Response) ||
+		    off + sizeof(rec) + ntohs(rec.len) > dataLen)
+			break;
+		memcpy(&resp, data + off + sizeof(rec), sizeof(resp));
+		lats.push_back(now - resp.genNs);
+	}
+}
+
+static void pollTx(shmdev_region* region, uint32_t peerIp,
+		   std::vector<uint64_t>& lats) {
+	for (uint32_t i = 0; i < region->nr_tx_rings; i++) {
+		shmdev_ring* r = &region->tx[i];
+		uint32_t tail = r->tail, head = r->head;
+
+		/* the slots must not be read before head */
+		asm volatile("" ::: "memory");
+		for (; tail != head; tail++) {
+			shmdev_slot* slot = &r->slots[tail & (SHMDEV_RING_SIZE - 1)];
+			uint32_t len = slot->len;
+			const EthHdr* eth = (const EthHdr*) slot->data;
+
+			if (len > SHMDEV_FRAME_MAX || len < sizeof(EthHdr))
+				continue;
+			if (eth->type == htons(ETHTYPE_ARP))
+				answerArp(region, slot->data, len, peerIp);
+			else if (eth->type == htons(ETHTYPE_IP))
+				recordResponses(slot->data, len, lats);
+		}
+		/* the slots must be read before they are handed back */
+		asm volatile("" ::: "memory");
+		r->tail = tail;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	shmdev_region* region;
+	ReqFrame f;
+	struct in_addr dpIp, peerIp;
+	uint64_t now, next, end, sent = 0, full = 0;
+	double rps, seconds = 10;
+	int fd, port;
+	std::vector<uint64_t> lats;
+
+	if (argc < 7) {
+		std::cerr << "Usage: " << argv[0] << " <PATH> <DP_IP> <PEER_IP>" \
+			  << " <PORT> <RPS> <SPIN_NS> [SECONDS]" << std::endl;
+		return -1;
+	}
+	if (!inet_aton(argv[2], &dpIp) || !inet_aton(argv[3], &peerIp)) {
+		std::cerr << "Invalid IP address" << std::endl;
+		return -1;
+	}
+	port = atoi(argv[4]);
+	rps = atof(argv[5]);
+	if (argc == 8)
+		seconds = atof(argv[7]);
+
+	fd = open(argv[1], O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+	region = (shmdev_region*) mmap(NULL, sizeof(shmdev_region),
+				       PROT_READ | PROT_WRITE, MAP_SHARED,
+				       fd, 0);
+	close(fd);
+	if (region == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	while (region->magic != SHMDEV_MAGIC)
+		usleep(1000);
+	/* the header must not be read before the magic */
+	asm volatile("" ::: "memory");
+
+	memset(&f, 0, sizeof(f));
+	memcpy(f.eth.dst, region->mac, 6);
+	memcpy(f.eth.src, peerMac, 6);
+	f.eth.type = htons(ETHTYPE_IP);
+	f.ip.vhl = 0x45;
+	f.ip.len = htons(sizeof(f) - sizeof(f.eth));
+	f.ip.ttl = 64;
+	f.ip.proto = IPPROTO_UDP_;
+	f.ip.src = peerIp.s_addr;
+	f.ip.dst = dpIp.s_addr;
+	f.ip.chksum = ipChksum(&f.ip, sizeof(f.ip));
+	f.udp.dst = htons(port);
+	f.udp.len = htons(sizeof(f.udp) + sizeof(f.req));
+	f.req.runNs = strtoull(argv[6], NULL, 0);
+
+	std::mt19937_64 gen(std::random_device{}());
+	std::exponential_distribution<double> gap(rps / 1e9);
+
+	now = getCurNs();
+	next = now;
+	end = now + seconds * 1e9;
+	while ((now = getCurNs()) < end) {
+		pollTx(region, peerIp.s_addr, lats);
+		if (now < next)
+			continue;
+		f.udp.src = htons(1024 + sent % NR_SRC_PORTS);
+		f.req.genNs = next;
+		if (ringPut(&region->rx, &f, sizeof(f)))
+			sent++;
+		else
+			full++;
+		next += gap(gen);
+	}
+	/* collect the stragglers */
+	end = getCurNs() + 100 * 1000 * 1000;
+	while (getCurNs() < end)
+		pollTx(region, peerIp.s_addr, lats);
+
+	std::sort(lats.begin(), lats.end());
+	printf("sent %lu received %zu ring full %lu\n", sent, lats.size(), full);
+	if (!lats.empty())
+		printf("p50 %.1f p99 %.1f p99.9 %.1f us\n",
+		       lats[lats.size() / 2] / 1e3,
+		       lats[lats.size() * 99 / 100] / 1e3,
+		       lats[lats.size() * 999 / 1000] / 1e3);
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2019 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * udp_echo - a stand-in backend for handlers issuing outbound calls with
+ * shinjuku_call(). Every datagram is sent back unchanged to its source port,
+ * optionally after a fixed delay that emulates the backend's service time.
+ *
+ * Usage: udp_echo <PORT> [DELAY_US]
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <iostream>
+
+int main(int argc, char* argv[]) {
+	struct sockaddr_in addr, peer;
+	socklen_t peer_len;
+	char buf[2048];
+	ssize_t len;
+	int fd, port, delay_us = 0;
+
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <PORT> [DELAY_US]" \
+			  << std::endl;
+		return -1;
+	}
+	port = atoi(argv[1]);
+	if (argc == 3)
+		delay_us = atoi(argv[2]);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return -1;
+	}
+
+	while (true) {
+		peer_len = sizeof(peer);
+		len = recvfrom(fd, buf, sizeof(buf), 0,
+			       (struct sockaddr *) &peer, &peer_len);
+		if (len < 0) {
+			perror("recvfrom");
+			continue;
+		}
+		if (delay_us)
+			usleep(delay_us);
+		if (sendto(fd, buf, len, 0, (struct sockaddr *) &peer,
+			   peer_len) < 0)
+			perror("sendto");
+	}
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * arena.c - per-request bump allocator for handler scratch memory
+ */
+
+#include <ix/arena.h>
+#include <ix/cpu.h>
+#include <ix/mempool.h>
+
+static struct mempool_numa_datastore arena_datastore;
+
+DEFINE_PERCPU(struct mempool, arena_pool __attribute__((aligned(64))));
+
+/**
+ * arena_alloc - allocates memory from an arena
+ * @arena: the newest block of the arena, or NULL if it is still empty
+ * @size: the number of bytes
+ *
+ * The caller must not migrate to another core during the call.
+ *
+ * Returns a 16-byte aligned pointer, or NULL if @size does not fit in a
+ * block or the pool is exhausted.
+ */
+void * arena_alloc(struct arena_block ** arena, size_t size)
+{
+        struct arena_block * blk = *arena;
+        void * ptr;
+
+        size = align_up(size, 16);
+        if (unlikely(size > ARENA_DATA_LEN))
+                return NULL;
+
+        if (!blk || blk->used + size > ARENA_DATA_LEN) {
+                blk = mempool_alloc(&percpu_get(arena_pool));
+                if (unlikely(!blk))
+                        return NULL;
+                blk->next = *arena;
+                blk->used = 0;
+                *arena = blk;
+        }
+
+        ptr = (char *) (blk + 1) + blk->used;
+        blk->used += size;
+        return ptr;
+}
+
+/**
+ * arena_init - allocates the global arena datastore
+ */
+int arena_init(void)
+{
+        return mempool_create_numa_datastore(&arena_datastore, ARENA_CAPACITY,
+                                             ARENA_BLOCK_SIZE, 1,
+                                             MEMPOOL_DEFAULT_CHUNKSIZE,
+                                             "arena");
+}
+
+/**
+ * arena_init_cpu - allocates the per-cpu arena mempools
+ */
+int arena_init_cpu(void)
+{
+        struct mempool *m = &percpu_get(arena_pool);
+        return mempool_create_numa(m, &arena_datastore, MEMPOOL_SANITY_PERCPU,
+                                   percpu_get(cpu_id),
+                                   percpu_get(cpu_numa_node));
+}
@@ -66,6 +66,19 @@ static int parse_arp(void);
 static int parse_devices(void);
 static int parse_cpu(void);
 static int parse_loader_path(void);
+static int parse_handler_path(void);
+static int parse_call_port(void);
+static int parse_inplace_reply(void);
+static int parse_page_1gb(void);
+static int parse_tx_batch_us(void);
+static int parse_msg_layer(void);
+static int parse_tcp(void);
+static int parse_tcp_window(void);
+static int parse_coalesce_ns(void);
+static int parse_batch_requests(void);
+static int parse_rx_steering(void);
+static int parse_idle_us(void);
+static int parse_stack_kb(void);
 
 struct config_vector_t {
 	const char *name;
@@ -81,6 +94,19 @@ static struct config_vector_t config_tbl[] = {
 	{ "devices",      parse_devices},
 	{ "cpu",          parse_cpu},
 	{ "loader_path",  parse_loader_path},
+	{ "handler_path", parse_handler_path},
+	{ "call_port",    parse_call_port},
+	{ "inplace_reply", parse_inplace_reply},
+	{ "page_1gb",     parse_page_1gb},
+	{ "tx_batch_us",  parse_tx_batch_us},
+	{ "msg_layer",    parse_msg_layer},
+	{ "tcp",          parse_tcp},
+	{ "tcp_window",   parse_tcp_window},
+	{ "coalesce_ns",  parse_coalesce_ns},
+	{ "batch_requests", parse_batch_requests},
+	{ "rx_steering",  parse_rx_steering},
+	{ "idle_us",      parse_idle_us},
+	{ "stack_kb",     parse_stack_kb},
 	{ NULL,           NULL}
 };
 
@@ -248,18 +274,41 @@ static int parse_host_addr(void)
 	return 0;
 }
 
+static int add_shm_dev(const char *path)
+{
+	int i;
+
+	if (!*path || strlen(path) >= sizeof(CFG.ethdev_shm[0])) {
+		log_err("cfg: invalid shared memory device %s\n", path);
+		return -EINVAL;
+	}
+	for (i = 0; i < CFG.num_ethdev; ++i) {
+		if (!strcmp(CFG.ethdev_shm[i], path))
+			return 0;
+	}
+	if (CFG.num_ethdev >= CFG_MAX_ETHDEV)
+		return -E2BIG;
+	memset(&CFG.ethdev[CFG.num_ethdev], 0, sizeof(struct pci_addr));
+	strcpy(CFG.ethdev_shm[CFG.num_ethdev++], path);
+	return 0;
+}
+
 static int add_dev(const char *dev)
 {
 	int ret, i;
 	struct pci_addr addr;
 
+	if (!strncmp(dev, "shm:", 4))
+		return add_shm_dev(dev + 4);
+
 	ret = pci_str_to_addr(dev, &addr);
 	if (ret) {
 		log_err("cfg: invalid device name %s\n", dev);
 		return ret;
 	}
 	for (i = 0; i < CFG.num_ethdev; ++i) {
-		if (!memcmp(&CFG.ethdev[i], &addr, sizeof(struct pci_addr)))
+		if (!CFG.ethdev_shm[i][0] &&
+		    !memcmp(&CFG.ethdev[i], &addr, sizeof(struct pci_addr)))
 			return 0;
 	}
 	if (CFG.num_ethdev >= CFG_MAX_ETHDEV)
@@ -344,6 +393,162 @@ static int parse_loader_path(void)
 	return 0;
 }
 
+static int parse_handler_path(void)
+{
+	char *parsed = NULL;
+
+	/* optional: the built-in handler serves every type by default */
+	CFG.handler_path[0] = '\0';
+	config_lookup_string(&cfg, "handler_path", (const char **)&parsed);
+	if (!parsed)
+		return 0;
+	strncpy(CFG.handler_path, parsed, sizeof(CFG.handler_path));
+	CFG.handler_path[sizeof(CFG.handler_path) - 1] = '\0';
+	return 0;
+}
+
+static int parse_call_port(void)
+{
+	int port;
+
+	/* optional: outbound calls are disabled when unset */
+	CFG.call_port = 0;
+	if (!config_lookup_int(&cfg, "call_port", &port))
+		return 0;
+	if (port <= 0 || port + CFG_MAX_CALLS > 65536)
+		return -EINVAL;
+	CFG.call_port = port;
+	return 0;
+}
+
+static int parse_inplace_reply(void)
+{
+	int enabled = 0;
+
+	config_lookup_bool(&cfg, "inplace_reply", &enabled);
+	CFG.inplace_reply = enabled;
+	return 0;
+}
+
+static int parse_page_1gb(void)
+{
+	int enabled = 0;
+
+	config_lookup_bool(&cfg, "page_1gb", &enabled);
+	CFG.page_1gb = enabled;
+	return 0;
+}
+
+static int parse_tx_batch_us(void)
+{
+	int us;
+
+	/* optional: every response rings the doorbell when unset */
+	CFG.tx_batch_us = 0;
+	if (!config_lookup_int(&cfg, "tx_batch_us", &us))
+		return 0;
+	if (us < 0 || us > CFG_MAX_TX_BATCH_US)
+		return -EINVAL;
+	CFG.tx_batch_us = us;
+	return 0;
+}
+
+static int parse_msg_layer(void)
+{
+	int enabled = 0;
+
+	config_lookup_bool(&cfg, "msg_layer", &enabled);
+	CFG.msg_layer = enabled;
+	return 0;
+}
+
+static int parse_tcp(void)
+{
+	int enabled = 0;
+
+	config_lookup_bool(&cfg, "tcp", &enabled);
+	CFG.tcp = enabled;
+	return 0;
+}
+
+static int parse_tcp_window(void)
+{
+	int window;
+
+	/* optional: one request of a connection at a time when unset */
+	CFG.tcp_window = 1;
+	if (!config_lookup_int(&cfg, "tcp_window", &window))
+		return 0;
+	if (window < 1 || window > CFG_MAX_TCP_WINDOW)
+		return -EINVAL;
+	CFG.tcp_window = window;
+	return 0;
+}
+
+static int parse_coalesce_ns(void)
+{
+	int ns;
+
+	/* optional: every response is its own datagram when unset */
+	CFG.coalesce_ns = 0;
+	if (!config_lookup_int(&cfg, "coalesce_ns", &ns))
+		return 0;
+	if (ns < 0 || ns > CFG_MAX_COALESCE_NS)
+		return -EINVAL;
+	CFG.coalesce_ns = ns;
+	return 0;
+}
+
+static int parse_batch_requests(void)
+{
+	int enabled = 0;
+
+	config_lookup_bool(&cfg, "batch_requests", &enabled);
+	/* both would claim the start of the payload */
+	if (enabled && CFG.msg_layer) {
+		log_err("cfg: 'batch_requests' cannot be used with 'msg_layer'\n");
+		return -EINVAL;
+	}
+	CFG.batch_requests = enabled;
+	return 0;
+}
+
+static int parse_rx_steering(void)
+{
+	int enabled = 0;
+
+	config_lookup_bool(&cfg, "rx_steering", &enabled);
+	CFG.rx_steering = enabled;
+	return 0;
+}
+
+static int parse_idle_us(void)
+{
+	int us;
+
+	/* optional: cores always spin when unset */
+	CFG.idle_us = 0;
+	if (!config_lookup_int(&cfg, "idle_us", &us))
+		return 0;
+	if (us < 0 || us > CFG_MAX_IDLE_US)
+		return -EINVAL;
+	CFG.idle_us = us;
+	return 0;
+}
+
+static int parse_stack_kb(void)
+{
+	int kb;
+
+	CFG.stack_size = CFG_DEFAULT_STACK_KB * 1024;
+	if (!config_lookup_int(&cfg, "stack_kb", &kb))
+		return 0;
+	if (kb < CFG_MIN_STACK_KB || kb > CFG_MAX_STACK_KB || kb % 4)
+		return -EINVAL;
+	CFG.stack_size = kb * 1024;
+	return 0;
+}
+
 static int parse_conf_file(const char *path)
 {
 	int ret, i;
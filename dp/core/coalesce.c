@@ -0,0 +1,188 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * coalesce.c - packing responses to the same client into one datagram
+ *
+ * Each worker has a few open datagrams, one per slot of a table indexed by
+ * the flow hash of the destination. Slots are only touched with preemption
+ * disabled, so they stay with the core even when a request migrates.
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include <ix/cfg.h>
+#include <ix/cpu.h>
+#include <ix/coalesce.h>
+#include <ix/errno.h>
+#include <ix/log.h>
+#include <ix/mbuf.h>
+#include <ix/timer.h>
+#include <ix/transmit.h>
+
+#include <asm/cpu.h>
+
+#define COALESCE_SLOTS  16
+
+struct coalesce_slot {
+        struct mbuf * pkt;      /* the open datagram, or NULL */
+        struct ip_tuple id;
+        size_t len;             /* of the payload so far */
+        unsigned long deadline;
+};
+
+struct coalescer {
+        unsigned int nr_open;
+        unsigned long next_deadline;    /* at most the earliest deadline */
+        struct coalesce_slot slots[COALESCE_SLOTS];
+};
+
+static DEFINE_PERCPU(struct coalescer, coalescer);
+
+/* how long a datagram stays open, in cycles */
+static unsigned long coalesce_delay;
+
+static inline bool coalesce_same_flow(struct ip_tuple * a, struct ip_tuple * b)
+{
+        return a->dst_ip == b->dst_ip && a->src_port == b->src_port &&
+               a->dst_port == b->dst_port;
+}
+
+static void coalesce_flush(struct coalescer * c, struct coalesce_slot * s)
+{
+        int ret;
+
+        ret = udp_send_pkt(s->pkt, s->len, &s->id);
+        if (unlikely(ret)) {
+                log_warn("coalesce: send failed with error %d\n", ret);
+                mbuf_free(s->pkt);
+        }
+        s->pkt = NULL;
+        c->nr_open--;
+}
+
+/**
+ * coalesce_reserve - makes room for a response in the datagram to a client
+ * @id: the 4-tuple of the response
+ * @len: the length of the response, at most COALESCE_MAX_LEN
+ *
+ * Must be called with preemption disabled, and the response written before
+ * enabling it again.
+ *
+ * Returns where to write the response, or NULL if out of buffers.
+ */
+void * coalesce_reserve(struct ip_tuple * id, size_t len)
+{
+        struct coalescer * c = &percpu_get(coalescer);
+        struct coalesce_slot * s;
+        struct coalesce_rec * rec;
+
+        s = &c->slots[udp_flow_hash(id) & (COALESCE_SLOTS - 1)];
+        if (s->pkt && (!coalesce_same_flow(&s->id, id) ||
+                       s->len + COALESCE_REC_LEN + len > UDP_MAX_LEN))
+                coalesce_flush(c, s);
+
+        if (!s->pkt) {
+                s->pkt = mbuf_alloc_local();
+                if (unlikely(!s->pkt))
+                        return NULL;
+                s->id = *id;
+                s->len = 0;
+                s->deadline = rdtsc() + coalesce_delay;
+                /* deadlines only grow, so an open one is at least as early */
+                if (!c->nr_open++)
+                        c->next_deadline = s->deadline;
+        }
+
+        rec = mbuf_mtod_off(s->pkt, struct coalesce_rec *,
+                            UDP_PKT_SIZE + s->len);
+        rec->len = hton16(len);
+        s->len += COALESCE_REC_LEN + len;
+        return rec + 1;
+}
+
+/**
+ * coalesce_send - copies a response into the datagram to a client
+ * @id: the 4-tuple of the response
+ * @data: the response
+ * @len: the length of the response
+ *
+ * Must be called with preemption disabled.
+ *
+ * Returns 0 if successful, otherwise a negative error code.
+ */
+int coalesce_send(struct ip_tuple * id, const void * data, size_t len)
+{
+        void * dst;
+
+        if (unlikely(len > COALESCE_MAX_LEN))
+                return -EINVAL;
+
+        dst = coalesce_reserve(id, len);
+        if (unlikely(!dst))
+                return -ENOMEM;
+
+        memcpy(dst, data, len);
+        return 0;
+}
+
+/**
+ * coalesce_flush_expired - sends the datagrams whose time is up
+ *
+ * Called by the worker between requests, with preemption disabled.
+ */
+void coalesce_flush_expired(void)
+{
+        struct coalescer * c = &percpu_get(coalescer);
+        struct coalesce_slot * s;
+        unsigned long now;
+
+        if (likely(!c->nr_open))
+                return;
+
+        now = rdtsc();
+        if (now < c->next_deadline)
+                return;
+
+        c->next_deadline = ULONG_MAX;
+        for (s = c->slots; s < c->slots + COALESCE_SLOTS; s++) {
+                if (!s->pkt)
+                        continue;
+                if (s->deadline <= now)
+                        coalesce_flush(c, s);
+                else if (s->deadline < c->next_deadline)
+                        c->next_deadline = s->deadline;
+        }
+}
+
+/**
+ * coalesce_init - converts the coalescing delay to cycles
+ */
+int coalesce_init(void)
+{
+        coalesce_delay = (unsigned long) CFG.coalesce_ns * cycles_per_us /
+                         1000;
+        return 0;
+}
@@ -29,21 +29,31 @@
 #include <ix/stddef.h>
 #include <ix/context.h>
 #include <ix/mempool.h>
+#include <ix/cfg.h>
 
 #define CONTEXT_CAPACITY    768*1024
 #define STACK_CAPACITY      768*1024
-#define STACK_SIZE          2048
 
-static int context_init_mempool(void)
-{
-        struct mempool *m = &context_pool;
-        return mempool_create(m, &context_datastore, MEMPOOL_SANITY_GLOBAL, 0);
-}
+#ifdef MEMPOOL_BENCH
+static void context_bench(void);
+#endif
 
-static int stack_init_mempool(void)
+static int context_init_mempool(struct mempool *pools,
+                                struct mempool_numa_datastore *nds)
 {
-        struct mempool *m = &stack_pool;
-        return mempool_create(m, &stack_datastore, MEMPOOL_SANITY_GLOBAL, 0);
+        int node, ret;
+
+        /* the dispatcher allocates for every node, so it gets one per node */
+        for (node = 0; node < MEMPOOL_MAX_NODES; node++) {
+                if (nds->node[node].magic != MEMPOOL_MAGIC)
+                        continue;
+                ret = mempool_create(&pools[node], &nds->node[node],
+                                     MEMPOOL_SANITY_GLOBAL, 0);
+                if (ret)
+                        return ret;
+        }
+
+        return 0;
 }
 
 /**
@@ -52,23 +62,136 @@ static int stack_init_mempool(void)
 int context_init(void)
 {
         int ret;
-        ret = mempool_create_datastore(&context_datastore, CONTEXT_CAPACITY,
-                                       sizeof(ucontext_t), 1,
-                                       MEMPOOL_DEFAULT_CHUNKSIZE,
-                                       "context");
+        ret = mempool_create_numa_datastore(&context_datastore,
+                                            CONTEXT_CAPACITY,
+                                            CONTEXT_ELEM_LEN, 1,
+                                            MEMPOOL_DEFAULT_CHUNKSIZE,
+                                            "context");
         if (ret)
                 return ret;
 
-        ret = context_init_mempool();
+        ret = context_init_mempool(context_pool, &context_datastore);
         if (ret)
                 return ret;
 
-        ret = mempool_create_datastore(&stack_datastore, STACK_CAPACITY,
-                                       STACK_SIZE, 1, MEMPOOL_DEFAULT_CHUNKSIZE,
-                                       "stack");
+        /* a stack overflow faults on a guard page instead of silently
+         * overwriting the neighbouring stack */
+        ret = mempool_create_guarded_numa_datastore(&stack_datastore,
+                                                    STACK_CAPACITY,
+                                                    CFG.stack_size,
+                                                    MEMPOOL_DEFAULT_CHUNKSIZE,
+                                                    "stack");
         if (ret)
                 return ret;
 
-        ret = stack_init_mempool();
+        ret = context_init_mempool(stack_pool, &stack_datastore);
+#ifdef MEMPOOL_BENCH
+        if (!ret)
+                context_bench();
+#endif
         return ret;
 }
+
+#ifdef MEMPOOL_BENCH
+
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include <asm/cpu.h>
+#include <ix/log.h>
+
+#define CONTEXT_BENCH_NR        (128 * 1024)
+#define CONTEXT_BENCH_ROUNDS    8
+/* odd, so that it permutes the contexts; large, to defeat locality */
+#define CONTEXT_BENCH_STRIDE    40503
+
+extern int swapcontext_fast(ucontext_t *ouctx, ucontext_t *uctx);
+
+static ucontext_t * bench_conts[CONTEXT_BENCH_NR];
+static ucontext_t bench_main;
+static ucontext_t * bench_cur;
+
+static void context_bench_fn(void)
+{
+        while (1)
+                swapcontext_fast(bench_cur, &bench_main);
+}
+
+static long long context_bench_dtlb(int fd)
+{
+        long long value;
+
+        if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value))
+                return -1;
+        return value;
+}
+
+/**
+ * context_bench - measures context switches across many live contexts
+ *
+ * Resumes CONTEXT_BENCH_NR contexts in a scattered order, the way a
+ * dispatcher with many requests in flight does. Each switch touches the
+ * ucontext_t and the top of a stack, so this is dominated by dTLB reach.
+ * Compare runs with and without page_1gb.
+ */
+static void context_bench(void)
+{
+        struct perf_event_attr attr = {
+                .type = PERF_TYPE_HW_CACHE,
+                .size = sizeof(struct perf_event_attr),
+                .config = PERF_COUNT_HW_CACHE_DTLB |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        };
+        unsigned long start, cycles;
+        long long misses;
+        int node, i, j, nr, fd;
+
+        for (node = 0; node < MEMPOOL_MAX_NODES; node++)
+                if (context_pool[node].magic == MEMPOOL_MAGIC)
+                        break;
+
+        for (nr = 0; nr < CONTEXT_BENCH_NR; nr++) {
+                ucontext_t * c;
+                if (context_alloc(&c, node))
+                        break;
+                getcontext_fast(c);
+                makecontext(c, context_bench_fn, 0);
+                bench_conts[nr] = c;
+        }
+
+        /* the first switch enters context_bench_fn() */
+        for (i = 0; i < nr; i++) {
+                bench_cur = bench_conts[i];
+                swapcontext_fast(&bench_main, bench_cur);
+        }
+
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        misses = context_bench_dtlb(fd);
+        start = rdtsc();
+        for (i = 0; i < CONTEXT_BENCH_ROUNDS; i++) {
+                for (j = 0; j < nr; j++) {
+                        bench_cur = bench_conts[((unsigned long) j * CONTEXT_BENCH_STRIDE) % nr];
+                        swapcontext_fast(&bench_main, bench_cur);
+                }
+        }
+        cycles = rdtsc() - start;
+        if (misses >= 0)
+                misses = context_bench_dtlb(fd) - misses;
+        if (fd >= 0)
+                close(fd);
+
+        if (nr)
+                log_info("context: bench %d contexts on %s pages: %lu cycles, "
+                         "%lld/1000 dTLB load misses per round trip\n",
+                         nr, CFG.page_1gb ? "1GB" : "2MB",
+                         cycles / ((unsigned long) nr * CONTEXT_BENCH_ROUNDS),
+                         misses < 0 ? -1 : misses * 1000 /
+                         ((long long) nr * CONTEXT_BENCH_ROUNDS));
+
+        for (i = 0; i < nr; i++)
+                context_free(bench_conts[i]);
+}
+
+#endif /* MEMPOOL_BENCH */
@@ -27,14 +27,30 @@
  * core and dispatching these packets or contexts to the worker cores.
  */
 
+#include <ix/batch.h>
 #include <ix/cfg.h>
 #include <ix/context.h>
 #include <ix/dispatch.h>
+#include <ix/tcp_conn.h>
+
+#include <net/ip.h>
+#include <net/udp.h>
+#include <net/ethernet.h>
 
 extern void dune_apic_send_posted_ipi(uint8_t vector, uint32_t dest_core);
 
 #define PREEMPT_VECTOR 0xf2
+
+/* overridable by builds outside the dataplane, such as the harness in sim/ */
+#ifndef PREEMPTION_DELAY
 #define PREEMPTION_DELAY 5000
+#endif
+/* TSC ticks per ns, likewise */
+#ifndef PREEMPT_TICKS_PER_NS
+#define PREEMPT_TICKS_PER_NS 2.5
+#endif
+
+static int worker_node[CFG_MAX_CPU];
 
 static void timestamp_init(int num_workers)
 {
@@ -43,6 +59,15 @@ static void timestamp_init(int num_workers)
                 timestamps[i] = MAX_UINT64;
 }
 
+static void worker_node_init(int num_workers)
+{
+        int i, node;
+        for (i = 0; i < num_workers; i++) {
+                node = numa_node_of_cpu(CFG.cpu[i + 2]);
+                worker_node[i] = node < 0 ? 0 : node;
+        }
+}
+
 static void preempt_check_init(int num_workers)
 {
         int i;
@@ -50,16 +75,73 @@ static void preempt_check_init(int num_workers)
                 preempt_check[i] = false;
 }
 
+/**
+ * drop_request - hands back the mbuf of a request that will not run
+ * @pkt: the mbuf
+ *
+ * A batched datagram goes back only once all its records are dropped or
+ * finished.
+ */
+static inline void drop_request(struct mbuf * pkt)
+{
+        if (tcp_frame_is_req(pkt))
+                tcp_conn_done(DISPATCHER_TCP_RING, pkt);
+        else if (!batch_is_req(pkt) || batch_release(pkt))
+                mbuf_ring_put(DISPATCHER_MBUF_RING, pkt);
+}
+
 static inline void handle_finished(int i)
 {
-        if (worker_responses[i].mbuf == NULL)
-                log_warn("No mbuf was returned from worker\n");
+        /* the worker already returned the mbufs to the networker */
         context_free(worker_responses[i].rnbl);
-        mbuf_enqueue(&mqueue, (struct mbuf *) worker_responses[i].mbuf);
         preempt_check[i] = false;
         worker_responses[i].flag = PROCESSED;
 }
 
+static inline void handle_parked(int i)
+{
+        struct call_slot * slot = &call_slots[worker_responses[i].call];
+
+        slot->rnbl = worker_responses[i].rnbl;
+        slot->mbuf = worker_responses[i].mbuf;
+        slot->type = worker_responses[i].type;
+        slot->timestamp = worker_responses[i].timestamp;
+        if (slot->reply) {
+                slot->state = CALL_DONE;
+                tskq_enqueue_tail(&tskq[slot->type], slot->rnbl, slot->mbuf,
+                                  slot->type, CONTEXT, slot->timestamp);
+        } else
+                slot->state = CALL_PARKED;
+        preempt_check[i] = false;
+        worker_responses[i].flag = PROCESSED;
+}
+
+static inline void handle_call_reply(struct mbuf * pkt)
+{
+        struct eth_hdr * ethhdr = mbuf_mtod(pkt, struct eth_hdr *);
+        struct ip_hdr * iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
+        struct udp_hdr * udphdr;
+        struct call_slot * slot;
+
+        udphdr = mbuf_nextd_off(iphdr, struct udp_hdr *,
+                                iphdr->header_len * sizeof(uint32_t));
+        slot = &call_slots[ntoh16(udphdr->dst_port) - CFG.call_port];
+
+        /* drop late or duplicate replies */
+        if (slot->state == CALL_FREE || slot->state == CALL_DONE ||
+            slot->reply) {
+                mbuf_ring_put(DISPATCHER_MBUF_RING, pkt);
+                return;
+        }
+
+        slot->reply = pkt;
+        if (slot->state == CALL_PARKED) {
+                slot->state = CALL_DONE;
+                tskq_enqueue_tail(&tskq[slot->type], slot->rnbl, slot->mbuf,
+                                  slot->type, CONTEXT, slot->timestamp);
+        }
+}
+
 static inline void handle_preempted(int i)
 {
         void * rnbl, * mbuf;
@@ -85,6 +167,15 @@ static inline void dispatch_request(int i, uint64_t cur_time)
         if(smart_tskq_dequeue(tskq, &rnbl, &mbuf, &type,
                               &category, &timestamp, cur_time))
                 return;
+        /* new requests get their context on the node of the worker */
+        if (category == PACKET && !rnbl) {
+                if (unlikely(context_alloc((ucontext_t **) &rnbl,
+                                           worker_node[i]))) {
+                        log_warn("Cannot allocate context\n");
+                        drop_request((struct mbuf *) mbuf);
+                        return;
+                }
+        }
         worker_responses[i].flag = RUNNING;
         dispatcher_requests[i].rnbl = rnbl;
         dispatcher_requests[i].mbuf = mbuf;
@@ -98,7 +189,7 @@ static inline void dispatch_request(int i, uint64_t cur_time)
 
 static inline void preempt_worker(int i, uint64_t cur_time)
 {
-        if (preempt_check[i] && (((cur_time - timestamps[i]) / 2.5) > PREEMPTION_DELAY)) {
+        if (preempt_check[i] && (((cur_time - timestamps[i]) / PREEMPT_TICKS_PER_NS) > PREEMPTION_DELAY)) {
                 // Avoid preempting more times.
                 preempt_check[i] = false;
                 dune_apic_send_posted_ipi(PREEMPT_VECTOR, CFG.cpu[i + 2]);
@@ -111,7 +202,10 @@ static inline void handle_worker(int i, uint64_t cur_time)
                 if (worker_responses[i].flag == FINISHED) {
                         handle_finished(i);
                 } else if (worker_responses[i].flag == PREEMPTED) {
-                        handle_preempted(i);
+                        if (worker_responses[i].category == PARKED)
+                                handle_parked(i);
+                        else
+                                handle_preempted(i);
                 }
                 dispatch_request(i, cur_time);
         } else
@@ -120,30 +214,33 @@ static inline void handle_worker(int i, uint64_t cur_time)
 
 static inline void handle_networker(uint64_t cur_time)
 {
-        int i, ret;
+        int i, j, nr;
         uint8_t type;
-        ucontext_t * cont;
+        struct mbuf * pkt;
 
         if (networker_pointers.cnt != 0) {
                 for (i = 0; i < networker_pointers.cnt; i++) {
-                        ret = context_alloc(&cont);
-                        if (unlikely(ret)) {
-                                log_warn("Cannot allocate context\n");
-                                mbuf_enqueue(&mqueue, (struct mbuf *) networker_pointers.pkts[i]);
+                        type = networker_pointers.types[i];
+                        if (unlikely(type == CALL_TYPE)) {
+                                handle_call_reply((struct mbuf *) networker_pointers.pkts[i]);
                                 continue;
                         }
-                        type = networker_pointers.types[i];
-                        tskq_enqueue_tail(&tskq[type], cont,
-                                          (void *)networker_pointers.pkts[i],
-                                          type, PACKET, cur_time);
-                }
-
-                for (i = 0; i < ETH_RX_MAX_BATCH; i++) {
-                        struct mbuf * buf = mbuf_dequeue(&mqueue);
-                        if (!buf)
-                                break;
-                        networker_pointers.pkts[i] = buf;
-                        networker_pointers.free_cnt++;
+                        /*
+                         * One task per request of a batched datagram. The
+                         * SLO clock starts at reception, or at the first
+                         * segment of a message.
+                         */
+                        pkt = networker_pointers.pkts[i];
+                        nr = batch_is_req(pkt) ? batch_desc(pkt)->nr : 1;
+                        for (j = 0; j < nr; j++) {
+                                if (likely(!tskq_enqueue_tail(&tskq[type], NULL,
+                                                              (void *) pkt, type,
+                                                              PACKET,
+                                                              pkt->timestamp)))
+                                        continue;
+                                log_warn("Cannot allocate task\n");
+                                drop_request(pkt);
+                        }
                 }
                 networker_pointers.cnt = 0;
         }
@@ -159,6 +256,7 @@ void do_dispatching(int num_cpus)
 
         preempt_check_init(num_cpus - 2);
         timestamp_init(num_cpus - 2);
+        worker_node_init(num_cpus - 2);
 
         while(1) {
                 cur_time = rdtsc();
@@ -43,25 +43,89 @@
 #define EMA_SMOOTH_FACTOR EMA_SMOOTH_FACTOR_0
 
 DEFINE_PERCPU(int, eth_num_queues);
+DEFINE_PERCPU(int, eth_rx_next);
 DEFINE_PERCPU(struct eth_tx_queue *, eth_txqs[NETHDEV]);
 
+/**
+ * eth_tx_flush - hands the queued buffers of a TX queue to the device
+ * @txq: the TX queue
+ *
+ * This rings the doorbell of the device once for all the buffers.
+ */
+void eth_tx_flush(struct eth_tx_queue *txq)
+{
+	int nr;
+
+	if (!txq->len)
+		return;
+
+	nr = eth_tx_xmit(txq, txq->len, txq->bufs);
+	if (unlikely(nr != txq->len))
+		panic("transmit buffer size mismatch\n");
+
+	txq->sent += nr;
+	txq->len = 0;
+}
+
+/**
+ * eth_tx_refill - makes room on a TX queue that ran out of space
+ * @txq: the TX queue
+ *
+ * Space is only reclaimed lazily, so a queue can look full while the device
+ * is long done with its buffers. The queued buffers are flushed first, so
+ * that the reclaimed count is exact.
+ *
+ * Returns the available descriptor count.
+ */
+int eth_tx_refill(struct eth_tx_queue *txq)
+{
+	eth_tx_flush(txq);
+	txq->cap = eth_tx_reclaim(txq);
+	txq->sent = 0;
+	return txq->cap;
+}
+
 /**
  * eth_process_send - processes packets pending to be sent
  */
 void eth_process_send(void)
 {
-	int i, nr;
+	int i;
+
+	for (i = 0; i < percpu_get(eth_num_queues); i++)
+		eth_tx_flush(percpu_get(eth_txqs[i]));
+}
+
+/**
+ * eth_process_send_batched - processes pending packets, coalescing doorbells
+ * @max_delay: how long (in cycles) the oldest packet of a queue may wait
+ *
+ * A queue is flushed once its oldest packet is @max_delay old or it holds
+ * ETH_TX_MAX_BATCH packets. With @max_delay 0 this is eth_process_send().
+ *
+ * Returns the number of queues that still hold packets.
+ */
+int eth_process_send_batched(unsigned long max_delay)
+{
+	int i, pending = 0;
+	unsigned long now = 0;
 	struct eth_tx_queue *txq;
 
 	for (i = 0; i < percpu_get(eth_num_queues); i++) {
 		txq = percpu_get(eth_txqs[i]);
+		if (!txq->len)
+			continue;
 
-		nr = eth_tx_xmit(txq, txq->len, txq->bufs);
-		if (unlikely(nr != txq->len))
-			panic("transmit buffer size mismatch\n");
-
-		txq->len = 0;
+		if (!now)
+			now = rdtsc();
+		if (txq->len >= ETH_TX_MAX_BATCH ||
+		    now - txq->first_ts >= max_delay)
+			eth_tx_flush(txq);
+		else
+			pending++;
 	}
+
+	return pending;
 }
 
 /**
@@ -75,6 +139,32 @@ void eth_process_reclaim(void)
 	for (i = 0; i < percpu_get(eth_num_queues); i++) {
 		txq = percpu_get(eth_txqs[i]);
 		txq->cap = eth_tx_reclaim(txq);
+		txq->sent = 0;
+	}
+}
+
+/**
+ * eth_process_reclaim_lazy - reclaims only the queues that need it
+ *
+ * Scanning the descriptors is skipped until ETH_TX_RECLAIM_BATCH buffers
+ * were sent or fewer than ETH_TX_RECLAIM_LOW descriptors are left. Queues
+ * with unsent buffers are skipped as well, since their space is already
+ * accounted for.
+ */
+void eth_process_reclaim_lazy(void)
+{
+	int i;
+	struct eth_tx_queue *txq;
+
+	for (i = 0; i < percpu_get(eth_num_queues); i++) {
+		txq = percpu_get(eth_txqs[i]);
+		if (txq->len)
+			continue;
+		if (txq->sent < ETH_TX_RECLAIM_BATCH &&
+		    txq->cap >= ETH_TX_RECLAIM_LOW)
+			continue;
+		txq->cap = eth_tx_reclaim(txq);
+		txq->sent = 0;
 	}
 }
 
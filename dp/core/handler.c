@@ -0,0 +1,222 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * handler.c - application handler registry and reply builder
+ */
+
+#include <dlfcn.h>
+#include <string.h>
+
+#include <ix/arena.h>
+#include <ix/cfg.h>
+#include <ix/coalesce.h>
+#include <ix/context.h>
+#include <ix/dispatch.h>
+#include <ix/errno.h>
+#include <ix/handler.h>
+#include <ix/log.h>
+#include <ix/mbuf.h>
+#include <ix/preempt.h>
+#include <ix/tcp_conn.h>
+#include <ix/transmit.h>
+
+#include <net/udp.h>
+
+shinjuku_handler_t handlers[CFG_MAX_PORTS];
+
+extern __thread ucontext_t * cont;
+extern __thread int cpu_nr_;
+
+/**
+ * shinjuku_register_handler - installs the handler of a request type
+ * @type: the request type (index of the port in the 'port' setting)
+ * @handler: the handler function
+ *
+ * Returns 0 if successful, otherwise -EINVAL.
+ */
+int shinjuku_register_handler(uint8_t type, shinjuku_handler_t handler)
+{
+        if (type >= CFG_MAX_PORTS || !handler)
+                return -EINVAL;
+
+        if (type >= CFG.num_ports)
+                log_warn("handler: type %d has no configured port\n", type);
+
+        handlers[type] = handler;
+        return 0;
+}
+
+/**
+ * shinjuku_alloc - allocates scratch memory for the running request
+ * @size: the number of bytes, at most ARENA_DATA_LEN
+ *
+ * The memory is released when the request finishes; there is no free.
+ *
+ * Returns a 16-byte aligned pointer, or NULL if out of memory.
+ */
+void * shinjuku_alloc(size_t size)
+{
+        void * ptr;
+
+        preempt_disable();
+        ptr = arena_alloc(&context_data(cont)->arena, size);
+        preempt_enable();
+        return ptr;
+}
+
+/**
+ * shinjuku_resp_init - starts building a reply
+ * @resp: the reply
+ *
+ * Returns 0 if successful, otherwise -ENOMEM.
+ */
+int shinjuku_resp_init(struct shinjuku_resp *resp)
+{
+        /* the mbuf pool is per-cpu, so we must not migrate while using it */
+        preempt_disable();
+        resp->pkt = mbuf_alloc_local();
+        preempt_enable();
+        if (unlikely(!resp->pkt))
+                return -ENOMEM;
+
+        resp->data = mbuf_mtod_off(resp->pkt, void *, UDP_PKT_SIZE);
+        resp->len = 0;
+        return 0;
+}
+
+/**
+ * shinjuku_resp_space - the number of payload bytes left in a reply
+ * @resp: the reply
+ */
+size_t shinjuku_resp_space(struct shinjuku_resp *resp)
+{
+        size_t max = CFG.coalesce_ns ? COALESCE_MAX_LEN : UDP_MAX_LEN;
+
+        return max - resp->len;
+}
+
+/**
+ * shinjuku_resp_append - copies data at the end of a reply
+ * @resp: the reply
+ * @buf: the data
+ * @len: the length of the data
+ *
+ * Handlers that build the payload directly in @resp->data should just
+ * update @resp->len instead.
+ *
+ * Returns 0 if successful, otherwise -ENOSPC.
+ */
+int shinjuku_resp_append(struct shinjuku_resp *resp, const void *buf,
+                         size_t len)
+{
+        if (unlikely(len > shinjuku_resp_space(resp)))
+                return -ENOSPC;
+
+        memcpy((char *) resp->data + resp->len, buf, len);
+        resp->len += len;
+        return 0;
+}
+
+/**
+ * shinjuku_resp_send - transmits a reply to the sender of a request
+ * @req: the request being answered
+ * @resp: the reply
+ *
+ * The reply is consumed whether or not the transmission succeeds. With
+ * 'coalesce_ns' set, it is copied into the open datagram to the client.
+ *
+ * Returns 0 if successful, otherwise a negative error code.
+ */
+int shinjuku_resp_send(struct shinjuku_req *req, struct shinjuku_resp *resp)
+{
+        int ret;
+        struct ip_tuple id = {
+                .src_ip = req->id->dst_ip,
+                .dst_ip = req->id->src_ip,
+                .src_port = req->id->dst_port,
+                .dst_port = req->id->src_port
+        };
+
+        preempt_disable();
+        if (req->tcp) {
+                ret = tcp_conn_send(&tcp_rings[cpu_nr_],
+                                    dispatcher_requests[cpu_nr_].mbuf,
+                                    resp->pkt, resp->data, resp->len, NULL);
+        } else if (CFG.coalesce_ns) {
+                ret = coalesce_send(&id, resp->data, resp->len);
+                mbuf_free(resp->pkt);
+        } else {
+                ret = udp_send_pkt(resp->pkt, resp->len, &id);
+                if (ret)
+                        mbuf_free(resp->pkt);
+        }
+        preempt_enable();
+
+        resp->pkt = NULL;
+        return ret;
+}
+
+/**
+ * shinjuku_resp_discard - drops a reply without sending it
+ * @resp: the reply
+ */
+void shinjuku_resp_discard(struct shinjuku_resp *resp)
+{
+        preempt_disable();
+        mbuf_free(resp->pkt);
+        preempt_enable();
+        resp->pkt = NULL;
+}
+
+/**
+ * handler_init - loads the application handlers named in the configuration
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int handler_init(void)
+{
+        void *lib;
+        int (*init)(void);
+
+        if (!CFG.handler_path[0])
+                return 0;
+
+        lib = dlopen(CFG.handler_path, RTLD_NOW | RTLD_GLOBAL);
+        if (!lib) {
+                log_err("handler: cannot load '%s': %s\n",
+                        CFG.handler_path, dlerror());
+                return -EINVAL;
+        }
+
+        init = (int (*)(void)) dlsym(lib, SHINJUKU_HANDLER_INIT);
+        if (!init) {
+                log_err("handler: '%s' does not export %s\n",
+                        CFG.handler_path, SHINJUKU_HANDLER_INIT);
+                dlclose(lib);
+                return -EINVAL;
+        }
+
+        log_info("handler: loaded '%s'\n", CFG.handler_path);
+        return init();
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * idle.c - parking idle cores
+ */
+
+#include <ix/cfg.h>
+#include <ix/idle.h>
+#include <ix/log.h>
+#include <ix/timer.h>
+
+#include <asm/cpu.h>
+
+#include <dune.h>
+
+/* #UD */
+#define IDLE_T_ILLOP    6
+/* length of the TPAUSE encoding in cpu_tpause() */
+#define IDLE_TPAUSE_LEN 4
+
+unsigned long idle_cycles;
+unsigned long idle_backoff_min;
+bool idle_waitpkg;
+
+static volatile bool idle_faulted;
+
+static void idle_illop_handler(struct dune_tf *tf)
+{
+        idle_faulted = true;
+        tf->rip += IDLE_TPAUSE_LEN;
+}
+
+/**
+ * idle_probe_waitpkg - checks that Dune lets the guest use WAITPKG
+ *
+ * Returns true if a TPAUSE ran without faulting. Called on a core that
+ * already entered Dune; the VMCS controls are the same on every core.
+ */
+static bool idle_probe_waitpkg(void)
+{
+        if (dune_register_intr_handler(IDLE_T_ILLOP, idle_illop_handler))
+                return false;
+        idle_faulted = false;
+        /* a deadline in the past returns at once */
+        cpu_tpause(IDLE_C0_1, 0);
+        dune_register_intr_handler(IDLE_T_ILLOP, NULL);
+        return !idle_faulted;
+}
+
+/**
+ * idle_init - checks for the wait instructions and converts 'idle_us'
+ *
+ * Returns 0.
+ */
+int idle_init(void)
+{
+        unsigned int a, b, c, d;
+
+        if (!CFG.idle_us)
+                return 0;
+
+        idle_cycles = (unsigned long) CFG.idle_us * cycles_per_us;
+        idle_backoff_min = cycles_per_us;
+
+        cpuid(7, 0, &a, &b, &c, &d);
+        if (!(c & CPUID_7_ECX_WAITPKG))
+                log_warn("idle: no UMWAIT on this CPU, idle cores wait with PAUSE\n");
+        else if (!idle_probe_waitpkg())
+                log_warn("idle: Dune does not enable UMWAIT, idle cores wait with PAUSE\n");
+        else
+                idle_waitpkg = true;
+        return 0;
+}
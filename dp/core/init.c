@@ -27,6 +27,7 @@
 
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <ix/stddef.h>
@@ -88,12 +89,20 @@ extern int taskqueue_init(void);
 extern int response_init(void);
 extern int response_init_cpu(void);
 extern int context_init(void);
+extern int handler_init(void);
+extern int arena_init(void);
+extern int arena_init_cpu(void);
+extern int msg_init(void);
+extern int msg_init_cpu(void);
+extern int tcp_conn_init(void);
+extern int tcp_conn_init_cpu(void);
+extern int coalesce_init(void);
+extern int idle_init(void);
+extern int tcp_conn_start(void);
 extern void do_work(void);
 extern void do_networking(void);
 extern void do_dispatching(int num_cpus);
 
-extern struct mempool context_pool;
-extern struct mempool stack_pool;
 
 struct init_vector_t {
 	const char *name;
@@ -109,12 +118,18 @@ static struct init_vector_t init_tbl[] = {
 	{ "timer",   timer_init,   timer_init_cpu, NULL},
 	{ "net",     net_init,     NULL, NULL},
 	{ "cfg",     init_cfg,     NULL, NULL},              // after net
+	{ "handler", handler_init, NULL, NULL},              // after cfg
 	{ "dpdk",    dpdk_init,    NULL, NULL},
 	{ "firstcpu", init_firstcpu, NULL, NULL},             // after cfg
 	{ "mbuf",    mbuf_init,    mbuf_init_cpu, NULL},      // after firstcpu
 	{ "taskqueue", taskqueue_init, NULL, NULL},      // after firstcpu
 	{ "response", response_init, response_init_cpu, NULL},
 	{ "context", context_init, NULL},
+	{ "arena",   arena_init,   arena_init_cpu, NULL},
+	{ "msg",     msg_init,     msg_init_cpu, NULL},       // after cfg
+	{ "tcp",     tcp_conn_init, tcp_conn_init_cpu, NULL},  // after cfg
+	{ "coalesce", coalesce_init, NULL, NULL},             // after cfg, timer
+	{ "idle",    idle_init,    NULL, NULL},               // after cfg, timer
         { "ethdev", init_ethdev, NULL, NULL},
         { "tx_queue", NULL, init_tx_queues, NULL},
 	{ "hw",      init_hw,      NULL, NULL},               // spaws per-cpu init sequence
@@ -145,6 +160,9 @@ pgflt_handler(uintptr_t addr, uint64_t fec, struct dune_tf *tf)
 		dune_dump_trap_frame(tf);
 		dune_ret_from_user(-EFAULT);
 	} else {
+		/* a context ran off its stack */
+		if (mempool_guard_fault(addr))
+			panic("stack overflow at %lx, raise stack_kb\n", addr);
 		ret = dune_vm_lookup(pgroot, (void *) addr,
 				     CREATE_NORMAL, &pte);
 		assert(!ret);
@@ -153,46 +171,69 @@ pgflt_handler(uintptr_t addr, uint64_t fec, struct dune_tf *tf)
 }
 
 /**
- * init_ethdev - initializes an ethernet device
- * @pci_addr: the PCI address of the device
+ * init_pci_ethdev - initializes the driver of a PCI ethernet device
+ * @addr: the PCI address of the device
+ * @eth: pointer to store the device
  *
  * FIXME: For now this is IXGBE-specific.
  *
  * Returns 0 if successful, otherwise fail.
  */
+static int init_pci_ethdev(const struct pci_addr *addr,
+			   struct ix_rte_eth_dev **eth)
+{
+	int ret;
+	struct pci_dev *dev;
+
+	dev = pci_alloc_dev(addr);
+	if (!dev)
+		return -ENOMEM;
+
+	ret = pci_enable_device(dev);
+	if (ret) {
+		log_err("init: failed to enable PCI device\n");
+		free(dev);
+		return ret;
+	}
+
+	ret = pci_set_master(dev);
+	if (ret) {
+		log_err("init: failed to set master\n");
+		free(dev);
+		return ret;
+	}
+
+	ret = driver_init(dev, eth);
+	if (ret) {
+		log_err("init: failed to start driver\n");
+		free(dev);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * init_ethdev - initializes the ethernet devices
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
 static int init_ethdev(void)
 {
 	int ret;
 	int i;
 	for (i = 0; i < CFG.num_ethdev; i++) {
-		const struct pci_addr *addr = &CFG.ethdev[i];
-		struct pci_dev *dev;
 		struct ix_rte_eth_dev *eth;
 
-		dev = pci_alloc_dev(addr);
-		if (!dev)
-			return -ENOMEM;
-
-		ret = pci_enable_device(dev);
-		if (ret) {
-			log_err("init: failed to enable PCI device\n");
-			free(dev);
-			goto err;
-		}
-
-		ret = pci_set_master(dev);
-		if (ret) {
-			log_err("init: failed to set master\n");
-			free(dev);
-			goto err;
+		if (CFG.ethdev_shm[i][0]) {
+			ret = shmdev_init(CFG.ethdev_shm[i], &eth);
+			if (ret)
+				log_err("init: failed to create shared memory device\n");
+		} else {
+			ret = init_pci_ethdev(&CFG.ethdev[i], &eth);
 		}
-
-		ret = driver_init(dev, &eth);
-		if (ret) {
-			log_err("init: failed to start driver\n");
-			free(dev);
+		if (ret)
 			goto err;
-		}
 
 		ret = eth_dev_add(eth);
 		if (ret) {
@@ -225,9 +266,32 @@ static int init_tx_queues(void)
         return 0;
 }
 
+/**
+ * init_type_order - sorts the request types by SLO, tightest first
+ *
+ * Types without an SLO come last, in port order.
+ */
+static void init_type_order(void)
+{
+	int i, j, t;
+
+	for (i = 0; i < CFG.num_ports; i++) {
+		t = i;
+		for (j = i; j > 0; j--) {
+			int prev = eth_type_order[j - 1];
+
+			if (t >= CFG.num_slos ||
+			    (prev < CFG.num_slos && CFG.slos[prev] <= CFG.slos[t]))
+				break;
+			eth_type_order[j] = prev;
+		}
+		eth_type_order[j] = t;
+	}
+}
+
 static int init_rx_queue(void)
 {
-	int ret, i;
+	int ret, i, t;
 	ret = 0;
 	for (i = 0; i < eth_dev_count; i++) {
 		struct ix_rte_eth_dev *eth = eth_dev[i];
@@ -235,11 +299,74 @@ static int init_rx_queue(void)
 		if (ret) {
 			return ret;
 		}
+
+		if (!CFG.rx_steering)
+			continue;
+
+		if (1 + CFG.num_ports > eth->data->max_rx_queues) {
+			log_err("init: eth%d has too few RX queues for rx_steering\n", i);
+			return -EMFILE;
+		}
+
+		for (t = 0; t < CFG.num_ports; t++) {
+			ret = eth_dev_get_rx_queue(eth, &eth_type_rxqs[t][i]);
+			if (ret)
+				return ret;
+		}
+	}
+
+	if (CFG.rx_steering) {
+		init_type_order();
+		eth_num_types = CFG.num_ports;
 	}
 
         return 0;
 }
 
+/**
+ * init_rx_steering - steers each request type to its own RX queue
+ * @eth: the ethernet device
+ * @dev_idx: the index of the device
+ *
+ * Requests are told apart by their UDP destination port, so one perfect
+ * filter per port is enough. Everything else, including TCP and the
+ * replies to calls, keeps going to the default queue; RSS is pointed
+ * there entirely so that it does not spread packets over the type queues.
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+static int init_rx_steering(struct ix_rte_eth_dev *eth, int dev_idx)
+{
+	int ret, i, t;
+	struct rte_fdir_filter ftr;
+	struct rte_eth_rss_reta rss_reta;
+
+	bitmap_init(rss_reta.mask, ETH_MAX_NUM_FG, false);
+	for (i = 0; i < eth->data->nb_rx_fgs; i++) {
+		bitmap_set(rss_reta.mask, i);
+		rss_reta.reta[i] = eth_rxqs[dev_idx]->queue_idx;
+	}
+
+	ret = eth->dev_ops->reta_update(eth, &rss_reta);
+	if (ret)
+		return ret;
+
+	for (t = 0; t < CFG.num_ports; t++) {
+		memset(&ftr, 0, sizeof(ftr));
+		ftr.iptype = RTE_FDIR_IPTYPE_IPV4;
+		ftr.l4type = RTE_FDIR_L4TYPE_UDP;
+		ftr.ip_dst.ipv4_addr = CFG.host_addr.addr;
+		ftr.port_dst = CFG.ports[t];
+
+		ret = eth->dev_ops->fdir_add_perfect_filter(eth, &ftr, t + 1,
+				eth_type_rxqs[t][dev_idx]->queue_idx, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
 static int init_network_cpu(void)
 {
 	int ret, i;
@@ -255,6 +382,21 @@ static int init_network_cpu(void)
 			log_err("init: failed to start eth%d\n", i);
 			return ret;
 		}
+
+		if (!CFG.rx_steering)
+			continue;
+
+		ret = init_rx_steering(eth, i);
+		if (ret) {
+			log_err("init: failed to set up rx_steering on eth%d\n", i);
+			return ret;
+		}
+        }
+
+        ret = tcp_conn_start();
+        if (ret) {
+                log_err("init: failed to set up TCP\n");
+                return ret;
         }
 
         networker_pointers.cnt = 0;
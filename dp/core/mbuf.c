@@ -54,7 +54,14 @@ void mbuf_default_done(struct mbuf *m)
 int mbuf_init_cpu(void)
 {
 	struct mempool *m = &percpu_get(mbuf_mempool);
-	return mempool_create(m, &mbuf_datastore, MEMPOOL_SANITY_PERCPU, percpu_get(cpu_id));
+	int ret;
+
+	ret = mempool_create(m, &mbuf_datastore, MEMPOOL_SANITY_PERCPU, percpu_get(cpu_id));
+#ifdef MEMPOOL_BENCH
+	if (!ret)
+		mempool_bench(m);
+#endif
+	return ret;
 }
 
 /**
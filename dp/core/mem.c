@@ -68,7 +68,7 @@ void *__mem_alloc_pages(void *base, int nr, int size,
 {
 	void *vaddr;
 	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
-	size_t len = nr * size;
+	size_t len = (size_t) nr * size;
 
 	switch (size) {
 	case PGSIZE_4KB:
@@ -136,19 +136,22 @@ void *__mem_alloc_pages_onnode(void *base, int nr, int size, int node)
  */
 void *mem_alloc_pages(int nr, int size, struct bitmask *mask, int numa_policy)
 {
-	void *base;
+	void *base, *vaddr;
+	uintptr_t prev;
 
 	switch (size) {
 	case PGSIZE_4KB:
 		base = NULL;
 	case PGSIZE_2MB:
 		spin_lock(&mem_lock);
+		prev = mem_pos;
 		mem_pos -= PGSIZE_2MB * nr;
 		base = (void *) mem_pos;
 		spin_unlock(&mem_lock);
 		break;
 	case PGSIZE_1GB:
 		spin_lock(&mem_lock);
+		prev = mem_pos;
 		mem_pos = align_down(mem_pos - PGSIZE_1GB * nr, PGSIZE_1GB);
 		base = (void *) mem_pos;
 		spin_unlock(&mem_lock);
@@ -157,7 +160,15 @@ void *mem_alloc_pages(int nr, int size, struct bitmask *mask, int numa_policy)
 		return MAP_FAILED;
 	}
 
-	return __mem_alloc_pages(base, nr, size, mask, numa_policy);
+	vaddr = __mem_alloc_pages(base, nr, size, mask, numa_policy);
+	if (vaddr == MAP_FAILED) {
+		/* return the range, unless a later allocation sits below it */
+		spin_lock(&mem_lock);
+		if (mem_pos == (uintptr_t) base)
+			mem_pos = prev;
+		spin_unlock(&mem_lock);
+	}
+	return vaddr;
 }
 
 /**
@@ -190,7 +201,7 @@ void *mem_alloc_pages_onnode(int nr, int size, int node, int numa_policy)
 void mem_free_pages(void *addr, int nr, int size)
 {
 	vm_unmap(addr, nr, size);
-	munmap(addr, nr * size);
+	munmap(addr, (size_t) nr * size);
 }
 
 #define PAGEMAP_PGN_MASK	0x7fffffffffffffULL
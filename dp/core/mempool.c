@@ -57,42 +57,126 @@
 #include <stdio.h>
 #include <ix/log.h>
 #include <ix/timer.h>
+#include <ix/cfg.h>
+#include <asm/cpu.h>
 
 static struct mempool_datastore *mempool_all_datastores;
 #ifdef ENABLE_KSTATS
 static struct timer mempool_timer;
 #endif
+/*
+ * The depot statistics are shared by all cores, so they are only kept when
+ * somebody is going to look at them.
+ */
+#ifdef ENABLE_KSTATS
+static inline void mempool_depot_stats(struct mempool_datastore *mds,
+				       int delta, int retries)
+{
+	__sync_fetch_and_add(&mds->free_chunks, delta);
+	__sync_fetch_and_add(&mds->num_ops, 1);
+	if (retries)
+		__sync_fetch_and_add(&mds->num_retries, retries);
+}
+#else
+static inline void mempool_depot_stats(struct mempool_datastore *mds,
+				       int delta, int retries) { }
+#endif
+
+static inline struct mempool_hdr *mempool_depot_ptr(uint64_t head)
+{
+	return (struct mempool_hdr *) (head & MEMPOOL_DEPOT_PTR_MASK);
+}
+
+static inline uint64_t mempool_depot_pack(struct mempool_hdr *h, uint64_t old)
+{
+	uint64_t tag = (old & ~MEMPOOL_DEPOT_PTR_MASK) +
+		       (1UL << MEMPOOL_DEPOT_PTR_BITS);
+
+	return tag | (uintptr_t) h;
+}
+
 /**
- * mempool_alloc_2  -- second stage allocator; may spinlock
- * @m: mempool
+ * mempool_chunk_get - takes a chunk from the datastore
+ * @mds: datastore
+ *
+ * NOTE: h->next_chunk may be read after another core already took @h; the
+ * memory is never unmapped and the tag makes the compare-and-swap fail.
+ *
+ * Returns the first element of the chunk, or NULL if the datastore is empty.
  */
+static struct mempool_hdr *mempool_chunk_get(struct mempool_datastore *mds)
+{
+	uint64_t old, new;
+	struct mempool_hdr *h;
+	int retries = -1;
+
+	do {
+		retries++;
+		old = mds->depot_head;
+		h = mempool_depot_ptr(old);
+		if (unlikely(!h))
+			return NULL;
+		new = mempool_depot_pack(h->next_chunk, old);
+	} while (!__sync_bool_compare_and_swap(&mds->depot_head, old, new));
+
+	mempool_depot_stats(mds, -1, retries);
+	return h;
+}
 
-void *mempool_alloc_2(struct mempool *m)
+/**
+ * mempool_chunk_put - gives a chunk back to the datastore
+ * @mds: datastore
+ * @h: the first element of the chunk
+ */
+static void mempool_chunk_put(struct mempool_datastore *mds,
+			      struct mempool_hdr *h)
 {
+	uint64_t old, new;
+	int retries = -1;
+
+	do {
+		retries++;
+		old = mds->depot_head;
+		h->next_chunk = mempool_depot_ptr(old);
+		new = mempool_depot_pack(h, old);
+	} while (!__sync_bool_compare_and_swap(&mds->depot_head, old, new));
 
+	mempool_depot_stats(mds, 1, retries);
+}
+
+/**
+ * mempool_refill - makes a whole chunk the core-local free list
+ * @m: mempool, whose free list must be empty
+ *
+ * Returns the new list head, or NULL if no chunk is left.
+ */
+struct mempool_hdr *mempool_refill(struct mempool *m)
+{
 	struct mempool_hdr *h;
 	assert(m->magic == MEMPOOL_MAGIC);
 	assert(m->head == NULL);
 
+	/* other cores may be short of what we gathered for their node */
+	if (m->numa)
+		mempool_flush_remote(m);
+
 	if (m->private_chunk) {
 		h = m->private_chunk;
-		m->head = h->next;
 		m->private_chunk = NULL;
-		return h;
+	} else {
+		assert(m->datastore);
+		h = mempool_chunk_get(m->datastore);
 	}
 
-	struct mempool_datastore *mds = m->datastore;
-
-	assert(mds);
-	spin_lock(&mds->lock);
-	h = mds->chunk_head;
-	if (likely(h)) {
-		mds->chunk_head = h->next_chunk;
-		m->head = h->next;
-		mds->free_chunks--;
-		mds->num_locks++;
+	/* rather take remote memory than fail */
+	if (unlikely(!h) && m->numa) {
+		int i;
+		for (i = 0; i < MEMPOOL_MAX_NODES && !h; i++) {
+			if (m->numa->node[i].magic == MEMPOOL_MAGIC)
+				h = mempool_chunk_get(&m->numa->node[i]);
+		}
 	}
-	spin_unlock(&mds->lock);
+
 #ifdef DEBUG_MEMPOOL
 	struct mempool_hdr *cur = h;
 	for (; cur; cur = cur->next) {
@@ -100,8 +184,120 @@ void *mempool_alloc_2(struct mempool *m)
 		hidden[-1] = m;
 	}
 #endif
+	m->head = h;
 	return h;
+}
+
+/**
+ * mempool_alloc_2  -- second stage allocator; may spinlock
+ * @m: mempool
+ */
+
+void *mempool_alloc_2(struct mempool *m)
+{
+	struct mempool_hdr *h = mempool_refill(m);
+
+	if (likely(h))
+		m->head = h->next;
+	return h;
+}
 
+/**
+ * mempool_free_bulk_2 -- second stage bulk free; may spinlock
+ * @m: mempool
+ * @first: the first element of the freed list
+ * @last: the last element of the freed list
+ * @n: the number of elements in the list
+ *
+ * The current free list becomes the private chunk and the freed list
+ * becomes the free list, so only whole lists are moved around.
+ */
+void mempool_free_bulk_2(struct mempool *m, struct mempool_hdr *first,
+			 struct mempool_hdr *last, int n)
+{
+	last->next = NULL;
+
+	if (m->head) {
+		if (m->private_chunk != NULL)
+			mempool_chunk_put(m->datastore, m->private_chunk);
+		m->private_chunk = m->head;
+	}
+	m->head = first;
+	m->num_free = n;
+}
+
+/**
+ * mempool_free_remote -- frees an element owned by another NUMA node
+ * @m: mempool
+ * @ptr: ptr
+ *
+ * Elements are gathered per owning node and go back to that node's depot
+ * a whole chunk at a time. Partial gathers are returned by
+ * mempool_flush_remote().
+ */
+void mempool_free_remote(struct mempool *m, void *ptr)
+{
+	struct mempool_hdr *elem = (struct mempool_hdr *) ptr;
+	int node;
+
+	if (unlikely(!m->numa))
+		panic("mempool: %p freed to the wrong datastore (%s)\n", ptr,
+		      m->datastore->prettyname);
+
+	node = mempool_numa_node(m->numa, ptr);
+	assert(node >= 0);
+
+	elem->next = m->remote_head[node];
+	m->remote_head[node] = elem;
+	if (++m->remote_cnt[node] == m->chunk_size) {
+		mempool_chunk_put(&m->numa->node[node], m->remote_head[node]);
+		m->remote_head[node] = NULL;
+		m->remote_cnt[node] = 0;
+	}
+}
+
+/**
+ * mempool_flush_remote -- returns the partial remote gathers of a pool
+ * @m: mempool
+ *
+ * Each gather goes back to its node's depot as a short chunk. Chunks are
+ * NULL-terminated lists, so consumers need no count.
+ */
+void mempool_flush_remote(struct mempool *m)
+{
+	int node;
+
+	for (node = 0; node < MEMPOOL_MAX_NODES; node++) {
+		if (!m->remote_cnt[node])
+			continue;
+		mempool_chunk_put(&m->numa->node[node], m->remote_head[node]);
+		m->remote_head[node] = NULL;
+		m->remote_cnt[node] = 0;
+	}
+}
+
+/*
+ * The NUMA pools of each core, so that idle cores can return their partial
+ * remote gathers; see mempool_flush_remote_percpu().
+ */
+#define MEMPOOL_MAX_NUMA_POOLS	8
+
+static DEFINE_PERCPU(struct mempool *, numa_pools[MEMPOOL_MAX_NUMA_POOLS]);
+static DEFINE_PERCPU(int, nr_numa_pools);
+
+/**
+ * mempool_flush_remote_percpu -- returns the partial remote gathers of all
+ * NUMA pools of this core
+ *
+ * Called by the worker and the networker when they go idle, as a core that
+ * only frees elements of another node never refills.
+ */
+void mempool_flush_remote_percpu(void)
+{
+	int i;
+
+	for (i = 0; i < percpu_get(nr_numa_pools); i++)
+		mempool_flush_remote(percpu_get(numa_pools[i]));
 }
 
 /**
@@ -113,22 +309,9 @@ void *mempool_alloc_2(struct mempool *m)
 void mempool_free_2(struct mempool *m, void *ptr)
 {
 	struct mempool_hdr *elem = (struct mempool_hdr *) ptr;
-	assert(m->num_free == m->chunk_size);
-
-	elem->next = NULL;
-
-	if (m->private_chunk != NULL) {
-		struct mempool_datastore *mds = m->datastore;
-		spin_lock(&mds->lock);
-		m->private_chunk->next_chunk = mds->chunk_head;
-		mds->chunk_head = m->private_chunk;
-		mds->free_chunks++;
-		mds->num_locks++;
-		spin_unlock(&mds->lock);
-	}
-	m->private_chunk = m->head;
-	m->head = elem;
-	m->num_free = 1;
+	assert(m->num_free >= m->chunk_size);
+
+	mempool_free_bulk_2(m, elem, elem, 1);
 }
 
 
@@ -154,12 +337,8 @@ int mempool_init_buf_with_pages(struct mempool_datastore *mds, int elems_per_pag
 
 			chunk_count++;
 			if (chunk_count == mds->chunk_size) {
-				if (mds->chunk_head == NULL) {
-					mds->chunk_head = head;
-				} else {
-					head->next_chunk = mds->chunk_head;
-					mds->chunk_head = head;
-				}
+				head->next_chunk = mempool_depot_ptr(mds->depot_head);
+				mds->depot_head = (uintptr_t) head;
 				head = NULL;
 				prev = NULL;
 				chunk_count = 0;
@@ -177,6 +356,26 @@ int mempool_init_buf_with_pages(struct mempool_datastore *mds, int elems_per_pag
 }
 
 
+/*
+ * 1GB pages are only worth it when the datastore covers a good part of one;
+ * smaller ones would mostly waste the page. 256MB lets in the per-node
+ * partitions of the context and stack datastores (about 360MB on two nodes);
+ * the rest of their last page becomes extra elements.
+ */
+#define MEMPOOL_1GB_MIN_PAGES	(PGSIZE_1GB / PGSIZE_2MB / 4)
+
+static bool mempool_use_1gb(int nr_pages)
+{
+	return CFG.page_1gb && nr_pages >= MEMPOOL_1GB_MIN_PAGES;
+}
+
+static void *mempool_alloc_pages(int nr, int size, int numa_node)
+{
+	if (numa_node >= 0)
+		return mem_alloc_pages_onnode(nr, size, numa_node, MPOL_BIND);
+	return mem_alloc_pages(nr, size, NULL, MPOL_PREFERRED);
+}
+
 /**
  * mempool_create_datastore - initializes a memory pool datastore
  * @nr_elems: the minimum number of elements in the total pool
@@ -194,8 +393,22 @@ int mempool_init_buf_with_pages(struct mempool_datastore *mds, int elems_per_pag
  */
 
 int mempool_create_datastore(struct mempool_datastore *mds, int nr_elems, size_t elem_len, int nostraddle, int chunk_size, const char *name)
+{
+	return mempool_create_datastore_on_node(mds, nr_elems, elem_len, nostraddle, chunk_size, name, -1);
+}
+
+/**
+ * mempool_create_datastore_on_node - initializes a datastore on a NUMA node
+ * @numa_node: the node to allocate the memory on, or -1 for the local node
+ *
+ * See mempool_create_datastore() for the other parameters.
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int mempool_create_datastore_on_node(struct mempool_datastore *mds, int nr_elems, size_t elem_len, int nostraddle, int chunk_size, const char *name, int numa_node)
 {
 	int nr_pages;
+	int node = numa_node >= 0 ? numa_node : (int) percpu_get(cpu_numa_node);
 
 	assert(mds->magic == 0);
 	assert((chunk_size & (chunk_size - 1)) == 0);
@@ -209,15 +422,39 @@ int mempool_create_datastore(struct mempool_datastore *mds, int nr_elems, size_t
 	mds->prettyname = name;
 	elem_len = align_up(elem_len, sizeof(long)) + MEMPOOL_INITIAL_OFFSET;
 
+	mds->page_size = PGSIZE_2MB;
 	if (nostraddle) {
 		int elems_per_page = PGSIZE_2MB / elem_len;
 		nr_pages = div_up(nr_elems, elems_per_page);
-		mds->buf = page_alloc_contig(nr_pages);
+		mds->buf = NULL;
+		if (mempool_use_1gb(nr_pages)) {
+			/* the rest of the last 1GB page becomes extra elements */
+			mds->buf = page_alloc_contig_1gb_on_node(nr_pages, node);
+			if (mds->buf) {
+				nr_pages = align_up(nr_pages, PGSIZE_1GB / PGSIZE_2MB);
+				mds->page_size = PGSIZE_1GB;
+			} else
+				log_warn("mempool: no 1GB pages for %s, using 2MB pages\n", name);
+		}
+		if (!mds->buf)
+			mds->buf = page_alloc_contig_on_node(nr_pages, node);
 		assert(mds->buf);
+		nr_elems = nr_pages * elems_per_page;
 	} else {
 		nr_pages = PGN_2MB(nr_elems * elem_len + PGMASK_2MB);
+		mds->buf = MAP_FAILED;
+		if (mempool_use_1gb(nr_pages)) {
+			int nr_1gb = div_up(nr_pages, PGSIZE_1GB / PGSIZE_2MB);
+			mds->buf = mempool_alloc_pages(nr_1gb, PGSIZE_1GB, numa_node);
+			if (mds->buf != MAP_FAILED) {
+				nr_pages = nr_1gb * (PGSIZE_1GB / PGSIZE_2MB);
+				mds->page_size = PGSIZE_1GB;
+			} else
+				log_warn("mempool: no 1GB pages for %s, using 2MB pages\n", name);
+		}
+		if (mds->buf == MAP_FAILED)
+			mds->buf = mempool_alloc_pages(nr_pages, PGSIZE_2MB, numa_node);
 		nr_elems = nr_pages * PGSIZE_2MB / elem_len;
-		mds->buf = mem_alloc_pages(nr_pages, PGSIZE_2MB, NULL, MPOL_PREFERRED);
 	}
 
 	mds->nr_pages = nr_pages;
@@ -225,8 +462,9 @@ int mempool_create_datastore(struct mempool_datastore *mds, int nr_elems, size_t
 	mds->elem_len = elem_len;
 	mds->chunk_size = chunk_size;
 	mds->nostraddle = nostraddle;
+	mds->numa_node = numa_node;
 
-	spin_lock_init(&mds->lock);
+	mds->depot_head = 0;
 
 	if (mds->buf == MAP_FAILED || mds->buf == 0) {
 		log_err("mempool alloc failed\n");
@@ -236,6 +474,10 @@ int mempool_create_datastore(struct mempool_datastore *mds, int nr_elems, size_t
 		return -ENOMEM;
 	}
 
+	/* the depot tag lives in the upper pointer bits */
+	assert(!(((uintptr_t) mds->buf + (size_t) nr_pages * PGSIZE_2MB) &
+		 ~MEMPOOL_DEPOT_PTR_MASK));
+
 	if (nostraddle) {
 		int elems_per_page = PGSIZE_2MB / elem_len;
 		mempool_init_buf_with_pages(mds, elems_per_page, nr_pages, elem_len);
@@ -245,14 +487,109 @@ int mempool_create_datastore(struct mempool_datastore *mds, int nr_elems, size_t
 	mds->next_ds = mempool_all_datastores;
 	mempool_all_datastores = mds;
 
-	printf("mempool_datastore: %-15s pages:%4u elem_len:%4lu nostraddle:%d chunk_size:%d num_chunks:4%d\n",
+	printf("mempool_datastore: %-15s pages:%4u elem_len:%4lu nostraddle:%d chunk_size:%d num_chunks:4%d node:%d page:%dMB\n",
 	       name,
 	       nr_pages,
-	       mds->elem_len, mds->nostraddle, mds->chunk_size, mds->num_chunks);
+	       mds->elem_len, mds->nostraddle, mds->chunk_size, mds->num_chunks,
+	       numa_node, mds->page_size >> 20);
+
+	return 0;
+}
+
+
+/**
+ * mempool_create_guarded_datastore_on_node - initializes a datastore of stacks
+ * @nr_elems: the minimum number of elements
+ * @elem_len: the usable length of each element
+ * @numa_node: the node to allocate the memory on
+ *
+ * Elements are made of 4KB pages and each one is followed by a guard page
+ * that is left unmapped, as is the page before the first element, so that a
+ * stack growing down out of its element faults (see mempool_guard_fault())
+ * instead of overwriting its neighbour. Only the pages a stack uses are
+ * backed by memory.
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+static int mempool_create_guarded_datastore_on_node(struct mempool_datastore *mds, int nr_elems, size_t elem_len, int chunk_size, const char *name, int numa_node)
+{
+	size_t stride = align_up(elem_len, PGSIZE_4KB) + PGSIZE_4KB;
+	void *region;
+	int i, nr_pages;
+
+	assert(mds->magic == 0);
+	assert((chunk_size & (chunk_size - 1)) == 0);
+
+	if (!elem_len || !nr_elems)
+		return -EINVAL;
+
+	/* in 2MB units, like the other datastores, for the range checks */
+	nr_pages = div_up((size_t) nr_elems * stride, PGSIZE_2MB);
+	region = __mem_alloc_pages_onnode(NULL,
+					  nr_pages * (PGSIZE_2MB / PGSIZE_4KB) + 1,
+					  PGSIZE_4KB, numa_node);
+	if (region == MAP_FAILED) {
+		log_err("mempool: unable to allocate %s\n", name);
+		return -ENOMEM;
+	}
+
+	mds->magic = MEMPOOL_MAGIC;
+	mds->prettyname = name;
+	mds->buf = (char *) region + PGSIZE_4KB;
+	mds->page_size = PGSIZE_4KB;
+	mds->nr_pages = nr_pages;
+	mds->nr_elems = (size_t) nr_pages * PGSIZE_2MB / stride;
+	mds->elem_len = stride;
+	mds->chunk_size = chunk_size;
+	mds->nostraddle = 0;
+	mds->numa_node = numa_node;
+	mds->depot_head = 0;
+
+	assert(!(((uintptr_t) mds->buf + (size_t) nr_pages * PGSIZE_2MB) &
+		 ~MEMPOOL_DEPOT_PTR_MASK));
+
+	vm_unmap(region, 1, PGSIZE_4KB);
+	for (i = 0; i < mds->nr_elems; i++)
+		vm_unmap((char *) mds->buf + (i + 1) * stride - PGSIZE_4KB, 1,
+			 PGSIZE_4KB);
+
+	mempool_init_buf_with_pages(mds, mds->nr_elems, 1, stride);
+
+	mds->next_ds = mempool_all_datastores;
+	mempool_all_datastores = mds;
+
+	printf("mempool_datastore: %-15s pages:%4u elem_len:%4lu guarded chunk_size:%d num_chunks:4%d node:%d page:4KB\n",
+	       name, nr_pages, mds->elem_len, mds->chunk_size,
+	       mds->num_chunks, numa_node);
 
 	return 0;
 }
 
+/**
+ * mempool_guard_fault - checks whether a fault hit a guard page
+ * @addr: the faulting address
+ *
+ * Returns true if @addr is in a guard page of a guarded datastore.
+ */
+bool mempool_guard_fault(uintptr_t addr)
+{
+	struct mempool_datastore *mds;
+	uintptr_t off;
+
+	for (mds = mempool_all_datastores; mds; mds = mds->next_ds) {
+		if (mds->page_size != PGSIZE_4KB)
+			continue;
+		off = addr - ((uintptr_t) mds->buf - PGSIZE_4KB);
+		if (off >= (size_t) mds->nr_pages * PGSIZE_2MB + PGSIZE_4KB)
+			continue;
+		if (off < PGSIZE_4KB)
+			return true;
+		off -= PGSIZE_4KB;
+		return off % mds->elem_len >= mds->elem_len - PGSIZE_4KB;
+	}
+
+	return false;
+}
 
 /**
  * mempool_create - initializes a memory pool
@@ -278,6 +615,7 @@ int mempool_create(struct mempool *m, struct mempool_datastore *mds, int16_t san
 	assert(m->magic == 0);
 	m->magic = MEMPOOL_MAGIC;
 	m->buf = mds->buf;
+	m->buf_len = (size_t) mds->nr_pages * PGSIZE_2MB;
 	m->datastore = mds;
 	m->head = NULL;
 	m->sanity = (sanity_type << 16) | sanity_id;
@@ -290,15 +628,126 @@ int mempool_create(struct mempool *m, struct mempool_datastore *mds, int16_t san
 	return 0;
 }
 
+/**
+ * mempool_create_numa_datastore - initializes a datastore for each NUMA node
+ * @nds: the NUMA datastore
+ *
+ * A partition is created on every node that runs one of the configured
+ * cores, and the @nr_elems elements are split evenly among them.
+ * See mempool_create_datastore() for the other parameters.
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+static int __mempool_create_numa_datastore(struct mempool_numa_datastore *nds, int nr_elems, size_t elem_len, int nostraddle, bool guarded, int chunk_size, const char *name)
+{
+	bool used[MEMPOOL_MAX_NODES] = { false };
+	int i, node, nr_nodes = 0, ret;
+
+	for (i = 0; i < CFG.num_cpus; i++) {
+		node = numa_node_of_cpu(CFG.cpu[i]);
+		if (node < 0 || node >= MEMPOOL_MAX_NODES) {
+			log_err("mempool: cpu %u has unsupported numa node %d\n",
+				CFG.cpu[i], node);
+			return -EINVAL;
+		}
+		if (!used[node])
+			nr_nodes++;
+		used[node] = true;
+	}
+
+	if (!nr_nodes)
+		return -EINVAL;
+
+	nr_elems = align_up(div_up(nr_elems, nr_nodes), chunk_size);
+	for (node = 0; node < MEMPOOL_MAX_NODES; node++) {
+		if (!used[node])
+			continue;
+		if (guarded)
+			ret = mempool_create_guarded_datastore_on_node(&nds->node[node],
+								       nr_elems, elem_len,
+								       chunk_size, name,
+								       node);
+		else
+			ret = mempool_create_datastore_on_node(&nds->node[node],
+							       nr_elems, elem_len,
+							       nostraddle, chunk_size,
+							       name, node);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+int mempool_create_numa_datastore(struct mempool_numa_datastore *nds, int nr_elems, size_t elem_len, int nostraddle, int chunk_size, const char *name)
+{
+	return __mempool_create_numa_datastore(nds, nr_elems, elem_len,
+					       nostraddle, false, chunk_size,
+					       name);
+}
+
+/**
+ * mempool_create_guarded_numa_datastore - a NUMA datastore of guarded stacks
+ *
+ * Like mempool_create_numa_datastore(), with the partitions created by
+ * mempool_create_guarded_datastore_on_node().
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int mempool_create_guarded_numa_datastore(struct mempool_numa_datastore *nds, int nr_elems, size_t elem_len, int chunk_size, const char *name)
+{
+	return __mempool_create_numa_datastore(nds, nr_elems, elem_len, 0,
+					       true, chunk_size, name);
+}
+
+/**
+ * mempool_create_numa - initializes a memory pool on a NUMA datastore
+ * @m: the memory pool
+ * @nds: the NUMA datastore
+ * @numa_node: the node of the core that will use @m
+ *
+ * The pool allocates from the partition of @numa_node. Elements of other
+ * nodes freed to it are returned to their own partition in chunks.
+ * Must be called on the core that will use @m.
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int mempool_create_numa(struct mempool *m, struct mempool_numa_datastore *nds, int16_t sanity_type, int16_t sanity_id, int numa_node)
+{
+	int ret;
+
+	if (numa_node < 0 || numa_node >= MEMPOOL_MAX_NODES ||
+	    nds->node[numa_node].magic != MEMPOOL_MAGIC)
+		return -EINVAL;
+
+	if (percpu_get(nr_numa_pools) == MEMPOOL_MAX_NUMA_POOLS)
+		return -ENOSPC;
+
+	ret = mempool_create(m, &nds->node[numa_node], sanity_type, sanity_id);
+	if (ret)
+		return ret;
+
+	m->numa = nds;
+	percpu_get(numa_pools[percpu_get(nr_numa_pools)++]) = m;
+	return 0;
+}
+
 /**
  * mempool_destroy - cleans up a memory pool and frees memory
  * @m: the memory pool
  */
 void mempool_destroy_datastore(struct mempool_datastore *mds)
 {
-	mem_free_pages(mds->buf, mds->nr_pages, PGSIZE_2MB);
+	if (mds->page_size == PGSIZE_4KB)
+		/* guarded: the leading guard page too */
+		mem_free_pages((char *) mds->buf - PGSIZE_4KB,
+			       mds->nr_pages * (PGSIZE_2MB / PGSIZE_4KB) + 1,
+			       PGSIZE_4KB);
+	else
+		mem_free_pages(mds->buf, mds->nr_pages / (mds->page_size / PGSIZE_2MB),
+			       mds->page_size);
 	mds->buf = NULL;
-	mds->chunk_head = NULL;
+	mds->depot_head = 0;
 	mds->magic = 0;
 }
 
@@ -379,7 +828,7 @@ void mempool_pagemem_destroy(struct mempool_datastore *m)
 
 	page_free_contig(m->buf, m->nr_pages);
 	m->buf = NULL;
-	m->chunk_head = NULL;
+	m->depot_head = 0;
 }
 
 
@@ -389,14 +838,16 @@ void mempool_pagemem_destroy(struct mempool_datastore *m)
 static void mempool_printstats(struct timer *t, struct eth_fg *cur_fg)
 {
 	struct mempool_datastore *mds = mempool_all_datastores;
-	printf("DATASTORE name             free%% lock/s\n");
+	printf("DATASTORE name             free%%  ops/s retry/s\n");
 
 	for (; mds; mds = mds->next_ds)  {
-		printf("DATASTORE %-15s  %4ld  %5ld\n",
+		printf("DATASTORE %-15s  %4ld  %5ld  %6ld\n",
 		       mds->prettyname,
 		       100L * mds->free_chunks / mds->num_chunks,
-		       mds->num_locks / 5);
-		mds->num_locks = 0;
+		       mds->num_ops / 5,
+		       mds->num_retries / 5);
+		mds->num_ops = 0;
+		mds->num_retries = 0;
 	}
 	timer_add(t, NULL, PRINT_INTERVAL);
 }
@@ -411,3 +862,56 @@ int mempool_init(void)
 	return 0;
 }
 
+#ifdef MEMPOOL_BENCH
+
+#define MEMPOOL_BENCH_BATCH	32
+#define MEMPOOL_BENCH_ROUNDS	4096
+
+/**
+ * mempool_bench - measures the per-object cost of single and bulk operations
+ * @m: the (core-local) mempool to exercise
+ *
+ * Each round allocates and then frees MEMPOOL_BENCH_BATCH objects, once with
+ * mempool_alloc()/mempool_free() and once with the bulk calls. The results
+ * are logged in cycles per object (one allocation plus one free).
+ */
+void mempool_bench(struct mempool *m)
+{
+	void *objs[MEMPOOL_BENCH_BATCH];
+	unsigned long start, single, bulk;
+	int i, j;
+
+	start = rdtsc();
+	for (i = 0; i < MEMPOOL_BENCH_ROUNDS; i++) {
+		for (j = 0; j < MEMPOOL_BENCH_BATCH; j++) {
+			objs[j] = mempool_alloc(m);
+			if (unlikely(!objs[j]))
+				goto fail;
+		}
+		for (j = 0; j < MEMPOOL_BENCH_BATCH; j++)
+			mempool_free(m, objs[j]);
+	}
+	single = rdtsc() - start;
+
+	start = rdtsc();
+	for (i = 0; i < MEMPOOL_BENCH_ROUNDS; i++) {
+		if (unlikely(mempool_alloc_bulk(m, objs, MEMPOOL_BENCH_BATCH)))
+			goto fail_bulk;
+		mempool_free_bulk(m, objs, MEMPOOL_BENCH_BATCH);
+	}
+	bulk = rdtsc() - start;
+
+	log_info("mempool: bench %d objs x %d rounds: single %lu, bulk %lu cycles/obj\n",
+		 MEMPOOL_BENCH_BATCH, MEMPOOL_BENCH_ROUNDS,
+		 single / (MEMPOOL_BENCH_ROUNDS * MEMPOOL_BENCH_BATCH),
+		 bulk / (MEMPOOL_BENCH_ROUNDS * MEMPOOL_BENCH_BATCH));
+	return;
+
+fail:
+	while (j--)
+		mempool_free(m, objs[j]);
+fail_bulk:
+	log_warn("mempool: bench ran out of memory\n");
+}
+
+#endif /* MEMPOOL_BENCH */
@@ -0,0 +1,362 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * message.c - reassembly and segmentation of multi-packet messages
+ */
+
+#include <string.h>
+
+#include <ix/cfg.h>
+#include <ix/coalesce.h>
+#include <ix/cpu.h>
+#include <ix/dispatch.h>
+#include <ix/errno.h>
+#include <ix/handler.h>
+#include <ix/log.h>
+#include <ix/mbuf.h>
+#include <ix/mempool.h>
+#include <ix/message.h>
+#include <ix/preempt.h>
+#include <ix/tcp_conn.h>
+#include <ix/timer.h>
+#include <ix/transmit.h>
+
+#include <net/ip.h>
+#include <net/udp.h>
+#include <net/ethernet.h>
+
+#define MSG_CAPACITY            512
+#define MSG_REASM_SLOTS         256
+#define MSG_REASM_TIMEOUT_US    (10 * 1000)
+#define MSG_HASH_SEED           0x5bd1e995
+
+/* a message being reassembled by the networker */
+struct msg_reasm {
+        struct msg_buf * buf;
+        uint32_t src_ip;
+        uint16_t src_port;
+        uint16_t nr_segs;
+        uint32_t msg_id;
+        uint32_t msg_len;
+        uint64_t got;           /* a bit per received segment */
+        unsigned long timestamp;
+};
+
+static struct mempool_numa_datastore msg_datastore;
+
+DEFINE_PERCPU(struct mempool, msg_pool __attribute__((aligned(64))));
+
+/* only used by the networker */
+static struct msg_reasm reasm[MSG_REASM_SLOTS];
+
+extern __thread int cpu_nr_;
+
+/**
+ * msg_input - runs a received request through the message layer
+ * @pkt: the request
+ *
+ * Single-segment messages are passed through. Segments of longer messages
+ * are copied into a message buffer and freed; the mbuf of the segment that
+ * completes the message is returned with the buffer in done_data and the
+ * arrival time of the first segment. Must only be called by the networker.
+ *
+ * Returns the mbuf to dispatch, or NULL if there is none yet.
+ */
+struct mbuf * msg_input(struct mbuf * pkt)
+{
+        struct eth_hdr * ethhdr = mbuf_mtod(pkt, struct eth_hdr *);
+        struct ip_hdr * iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
+        struct udp_hdr * udphdr = mbuf_nextd_off(iphdr, struct udp_hdr *,
+                                        iphdr->header_len * sizeof(uint32_t));
+        struct msg_hdr * hdr = mbuf_nextd(udphdr, struct msg_hdr *);
+        uint16_t udp_len = ntoh16(udphdr->len);
+        uint32_t len = udp_len - sizeof(struct udp_hdr);
+        uint32_t msg_id, msg_len, seg_len, src_ip, off;
+        uint16_t seg, nr_segs, src_port;
+        struct msg_reasm * r;
+        uint64_t key, all;
+
+        pkt->done_data = 0;
+        /* the UDP length must fit in the frame before the header is read */
+        if (unlikely(udp_len < sizeof(struct udp_hdr) ||
+                     (char *) udphdr + udp_len >
+                     mbuf_mtod(pkt, char *) + pkt->len))
+                goto drop;
+        if (unlikely(len < sizeof(struct msg_hdr)))
+                goto drop;
+
+        nr_segs = ntoh16(hdr->nr_segs);
+        if (likely(nr_segs <= 1))
+                return pkt;
+
+        msg_id = ntoh32(hdr->msg_id);
+        msg_len = ntoh32(hdr->msg_len);
+        seg = ntoh16(hdr->seg);
+        off = seg * MSG_SEG_LEN;
+        seg_len = len - sizeof(struct msg_hdr);
+        if (unlikely(nr_segs > MSG_MAX_SEGS || seg >= nr_segs ||
+                     msg_len > MSG_MAX_LEN ||
+                     (msg_len + MSG_SEG_LEN - 1) / MSG_SEG_LEN != nr_segs ||
+                     seg_len != min(MSG_SEG_LEN, msg_len - off)))
+                goto drop;
+
+        src_ip = ntoh32(iphdr->src_addr.addr);
+        src_port = ntoh16(udphdr->src_port);
+        key = ((uint64_t) src_ip << 32 | src_port) ^ (uint64_t) msg_id << 16;
+        r = &reasm[hash_crc32c_one(MSG_HASH_SEED, key) &
+                   (MSG_REASM_SLOTS - 1)];
+
+        if (r->buf && (r->msg_id != msg_id || r->src_ip != src_ip ||
+                       r->src_port != src_port || r->nr_segs != nr_segs ||
+                       r->msg_len != msg_len)) {
+                if (rdtsc() - r->timestamp <
+                    (unsigned long) MSG_REASM_TIMEOUT_US * cycles_per_us)
+                        goto drop;
+                /* the slot holds an abandoned message */
+                mempool_free(&percpu_get(msg_pool), r->buf);
+                r->buf = NULL;
+        }
+
+        if (!r->buf) {
+                r->buf = mempool_alloc(&percpu_get(msg_pool));
+                if (unlikely(!r->buf))
+                        goto drop;
+                r->src_ip = src_ip;
+                r->src_port = src_port;
+                r->msg_id = msg_id;
+                r->msg_len = msg_len;
+                r->nr_segs = nr_segs;
+                r->got = 0;
+                r->timestamp = pkt->timestamp;
+        }
+
+        if (unlikely(r->got & (1ULL << seg)))
+                goto drop;
+
+        memcpy(r->buf->data + off, hdr + 1, seg_len);
+        r->got |= 1ULL << seg;
+
+        all = nr_segs == 64 ? ~0ULL : (1ULL << nr_segs) - 1;
+        if (r->got != all)
+                goto drop;
+
+        pkt->done_data = (unsigned long) r->buf;
+        pkt->timestamp = r->timestamp;
+        r->buf = NULL;
+        return pkt;
+
+drop:
+        mbuf_free(pkt);
+        return NULL;
+}
+
+static void msg_seg_done(struct mbuf * pkt)
+{
+        struct msg_buf * buf = (struct msg_buf *) pkt->done_data;
+        unsigned int i;
+
+        for (i = 0; i < pkt->nr_iov; i++)
+                mbuf_iov_free(&pkt->iovs[i]);
+
+        if (--buf->refs == 0)
+                mempool_free(&percpu_get(msg_pool), buf);
+        mbuf_free(pkt);
+}
+
+/**
+ * shinjuku_msg_alloc - allocates a buffer for a response message
+ *
+ * Returns a buffer of MSG_MAX_LEN bytes, to be passed to shinjuku_msg_send(),
+ * or NULL if out of memory or both the message layer and TCP are disabled.
+ */
+void * shinjuku_msg_alloc(void)
+{
+        struct msg_buf * buf;
+
+        if (!CFG.msg_layer && !CFG.tcp)
+                return NULL;
+
+        preempt_disable();
+        buf = mempool_alloc(&percpu_get(msg_pool));
+        preempt_enable();
+        return buf ? buf->data : NULL;
+}
+
+/**
+ * shinjuku_msg_send - sends a response message to the sender of a request
+ * @req: the request being answered
+ * @data: a buffer from shinjuku_msg_alloc(), holding the response
+ * @len: the length of the response, at most MSG_MAX_LEN
+ *
+ * The response is split into MSG_SEG_LEN-byte segments. Each one goes out as
+ * a packet whose payload points into @data, so nothing is copied; the
+ * buffer is freed once the last segment has been transmitted. The buffer is
+ * consumed whether or not the transmission succeeds, and a failure may
+ * leave the client with part of the segments. Requests received over TCP
+ * are answered on their connection, in one piece.
+ *
+ * With 'coalesce_ns' set, a response that fits in one segment is copied
+ * into the open datagram to the client. Longer ones still go out one
+ * segment per datagram, each segment a single record, and so carry
+ * COALESCE_REC_LEN bytes less than MSG_SEG_LEN.
+ *
+ * Returns 0 if successful, otherwise a negative error code.
+ */
+int shinjuku_msg_send(struct shinjuku_req *req, void *data, size_t len)
+{
+        struct msg_buf * buf = container_of(data, struct msg_buf, data);
+        struct ip_tuple id = {
+                .src_ip = req->id->dst_ip,
+                .dst_ip = req->id->src_ip,
+                .src_port = req->id->dst_port,
+                .dst_port = req->id->src_port
+        };
+        size_t rec_len = CFG.coalesce_ns ? COALESCE_REC_LEN : 0;
+        size_t off, seg_len, seg_max = MSG_SEG_LEN - rec_len;
+        unsigned int i, nr_segs = len ? div_up(len, seg_max) : 1;
+        struct coalesce_rec * rec;
+        struct msg_hdr * hdr;
+        struct mbuf_iov * iovs;
+        struct sg_entry ent;
+        struct mbuf * pkt;
+        int ret = 0;
+
+        if (req->tcp) {
+                preempt_disable();
+                pkt = mbuf_alloc_local();
+                if (likely(pkt)) {
+                        ret = tcp_conn_send(&tcp_rings[cpu_nr_],
+                                            dispatcher_requests[cpu_nr_].mbuf,
+                                            pkt, data, len, buf);
+                } else {
+                        mempool_free(&percpu_get(msg_pool), buf);
+                        ret = -ENOMEM;
+                }
+                preempt_enable();
+                return ret;
+        }
+
+        if (unlikely(len > MSG_MAX_LEN))
+                ret = -EINVAL;
+
+        /* all segments leave from, and complete on, this core */
+        preempt_disable();
+        if (!ret && rec_len && nr_segs == 1) {
+                hdr = coalesce_reserve(&id, sizeof(*hdr) + len);
+                if (likely(hdr)) {
+                        hdr->msg_id = hton32(req->msg_id);
+                        hdr->msg_len = hton32(len);
+                        hdr->seg = 0;
+                        hdr->nr_segs = hton16(1);
+                        memcpy(hdr + 1, data, len);
+                } else {
+                        ret = -ENOMEM;
+                }
+                mempool_free(&percpu_get(msg_pool), buf);
+                preempt_enable();
+                return ret;
+        }
+
+        buf->refs = 1;
+        for (i = 0; !ret && i < nr_segs; i++) {
+                off = i * seg_max;
+                seg_len = min(seg_max, len - off);
+
+                pkt = mbuf_alloc_local();
+                if (unlikely(!pkt)) {
+                        ret = -ENOMEM;
+                        break;
+                }
+
+                if (rec_len) {
+                        rec = mbuf_mtod_off(pkt, struct coalesce_rec *,
+                                            UDP_PKT_SIZE);
+                        rec->len = hton16(sizeof(*hdr) + seg_len);
+                }
+                hdr = mbuf_mtod_off(pkt, struct msg_hdr *,
+                                    UDP_PKT_SIZE + rec_len);
+                hdr->msg_id = hton32(req->msg_id);
+                hdr->msg_len = hton32(len);
+                hdr->seg = hton16(i);
+                hdr->nr_segs = hton16(nr_segs);
+
+                iovs = mbuf_mtod_off(pkt, struct mbuf_iov *,
+                                     align_up(UDP_PKT_SIZE + rec_len +
+                                              sizeof(*hdr), sizeof(uint64_t)));
+                pkt->iovs = iovs;
+                pkt->nr_iov = 0;
+                if (seg_len) {
+                        /* message buffers never straddle a 2MB page */
+                        ent.base = buf->data + off;
+                        ent.len = seg_len;
+                        mbuf_iov_create(&iovs[0], &ent);
+                        pkt->nr_iov = 1;
+                }
+
+                pkt->len = UDP_PKT_SIZE + rec_len + sizeof(*hdr);
+                pkt->done = &msg_seg_done;
+                pkt->done_data = (unsigned long) buf;
+                buf->refs++;
+
+                ret = udp_xmit(pkt, &id,
+                               udp_setup_headers(pkt, rec_len + sizeof(*hdr) +
+                                                 seg_len, &id));
+                if (unlikely(ret))
+                        msg_seg_done(pkt);
+        }
+
+        if (--buf->refs == 0)
+                mempool_free(&percpu_get(msg_pool), buf);
+        preempt_enable();
+        return ret;
+}
+
+/**
+ * msg_init - allocates the global message buffer datastore
+ */
+int msg_init(void)
+{
+        /* TCP requests and responses also use message buffers */
+        if (!CFG.msg_layer && !CFG.tcp)
+                return 0;
+
+        return mempool_create_numa_datastore(&msg_datastore, MSG_CAPACITY,
+                                             sizeof(struct msg_buf), 1, 4,
+                                             "msg");
+}
+
+/**
+ * msg_init_cpu - allocates the per-cpu message buffer mempools
+ */
+int msg_init_cpu(void)
+{
+        struct mempool *m = &percpu_get(msg_pool);
+
+        if (!CFG.msg_layer && !CFG.tcp)
+                return 0;
+
+        return mempool_create_numa(m, &msg_datastore, MEMPOOL_SANITY_PERCPU,
+                                   percpu_get(cpu_id),
+                                   percpu_get(cpu_numa_node));
+}
@@ -29,35 +29,189 @@
 #include <stdio.h>
 
 #include <ix/vm.h>
+#include <ix/batch.h>
 #include <ix/cfg.h>
 #include <ix/log.h>
 #include <ix/mbuf.h>
 #include <ix/dispatch.h>
+#include <ix/idle.h>
 #include <ix/ethqueue.h>
+#include <ix/message.h>
+#include <ix/tcp_conn.h>
+#include <ix/timer.h>
 #include <ix/transmit.h>
 
 #include <asm/chksum.h>
 
+#include <net/arp.h>
 #include <net/ip.h>
 #include <net/udp.h>
 #include <net/ethernet.h>
 
+/**
+ * return_mbufs - frees the mbufs the other cores are done with
+ * @num_workers: the number of worker cores
+ *
+ * Returns the number of mbufs freed.
+ */
+static inline int return_mbufs(int num_workers)
+{
+        int i, n = 0;
+
+        for (i = 0; i < num_workers; i++)
+                n += mbuf_ring_drain(&mbuf_rings[i]);
+        n += mbuf_ring_drain(DISPATCHER_MBUF_RING);
+        return n;
+}
+
+/**
+ * reassemble - runs received requests through the message layer
+ * @num_recv: the number of received packets
+ *
+ * Returns the number of packets left to dispatch.
+ */
+static inline int reassemble(int num_recv)
+{
+        int i, n = 0;
+        struct mbuf * pkt;
+
+        for (i = 0; i < num_recv; i++) {
+                pkt = recv_mbufs[i];
+                if (recv_type[i] != CALL_TYPE) {
+                        pkt = msg_input(pkt);
+                        if (!pkt)
+                                continue;
+                }
+                recv_mbufs[n] = pkt;
+                recv_type[n] = recv_type[i];
+                n++;
+        }
+
+        return n;
+}
+
+/**
+ * batch_input - locates the requests of a batched request datagram
+ * @pkt: the request
+ *
+ * Returns 0 if successful, otherwise -EINVAL; @pkt is then left to the
+ * caller.
+ */
+static int batch_input(struct mbuf * pkt)
+{
+        struct eth_hdr * ethhdr = mbuf_mtod(pkt, struct eth_hdr *);
+        struct ip_hdr * iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
+        struct udp_hdr * udphdr = mbuf_nextd_off(iphdr, struct udp_hdr *,
+                                        iphdr->header_len * sizeof(uint32_t));
+        struct batch_desc * b = batch_desc(pkt);
+        char * start = mbuf_mtod(pkt, char *);
+        char * pos = mbuf_nextd(udphdr, char *);
+        char * end = pos + ntoh16(udphdr->len) - sizeof(struct udp_hdr);
+        struct coalesce_rec * rec;
+        uint16_t len;
+
+        if (unlikely(end < pos || end > (char *) b))
+                return -EINVAL;
+
+        b->nr = 0;
+        while (pos < end) {
+                if (unlikely(end - pos < COALESCE_REC_LEN ||
+                             b->nr == BATCH_MAX_REQS))
+                        return -EINVAL;
+                rec = (struct coalesce_rec *) pos;
+                len = ntoh16(rec->len);
+                pos += COALESCE_REC_LEN;
+                if (unlikely(len > end - pos))
+                        return -EINVAL;
+                b->off[b->nr] = pos - start;
+                b->len[b->nr] = len;
+                b->nr++;
+                pos += len;
+        }
+        if (unlikely(!b->nr))
+                return -EINVAL;
+
+        b->next = 0;
+        b->refs = b->nr;
+        b->id.src_ip = ntoh32(iphdr->src_addr.addr);
+        b->id.dst_ip = ntoh32(iphdr->dst_addr.addr);
+        b->id.src_port = ntoh16(udphdr->src_port);
+        b->id.dst_port = ntoh16(udphdr->dst_port);
+        return 0;
+}
+
+/**
+ * unbatch - locates the requests of the received request datagrams
+ * @num_recv: the number of received packets
+ *
+ * Malformed datagrams are dropped; the dispatcher fans out the others.
+ *
+ * Returns the number of packets left to dispatch.
+ */
+static inline int unbatch(int num_recv)
+{
+        int i, n = 0;
+        struct mbuf * pkt;
+
+        for (i = 0; i < num_recv; i++) {
+                pkt = recv_mbufs[i];
+                if (recv_type[i] != CALL_TYPE && batch_input(pkt)) {
+                        mbuf_free(pkt);
+                        continue;
+                }
+                recv_mbufs[n] = pkt;
+                recv_type[n] = recv_type[i];
+                n++;
+        }
+
+        return n;
+}
+
 /**
  * do_networking - implements networking core's functionality
  */
 void do_networking(void)
 {
-        int i, num_recv;
+        int i, num_recv, busy;
+        int num_workers = CFG.num_cpus - 2;
+        unsigned long last_recv = rdtsc(), backoff = 0;
+        bool flushed = false;
+
         while(1) {
-                eth_process_poll();
+                busy = return_mbufs(num_workers);
+                if (CFG.tcp)
+                        busy += tcp_conn_poll(num_workers);
+                /* all ARP requests and timers, TCP ones included, run here */
+                timer_run();
+                arp_process_requests();
+                /* includes the TCP segments that ip_input() consumes */
+                busy += eth_process_poll();
                 num_recv = eth_process_recv();
-                if (num_recv == 0)
+                if (CFG.msg_layer)
+                        num_recv = reassemble(num_recv);
+                else if (CFG.batch_requests)
+                        num_recv = unbatch(num_recv);
+                if (CFG.tcp)
+                        num_recv = tcp_conn_ready(num_recv);
+                /* ARP replies and TCP segments */
+                eth_process_send();
+                if (busy || num_recv) {
+                        last_recv = rdtsc();
+                        backoff = 0;
+                        flushed = false;
+                } else if (!flushed) {
+                        /* idle: return what was gathered for other nodes */
+                        mempool_flush_remote_percpu();
+                        flushed = true;
+                }
+                if (num_recv == 0) {
+                        /* idle for a while: stop hammering the devices */
+                        if (idle_cycles && rdtsc() - last_recv > idle_cycles)
+                                idle_backoff(&backoff);
                         continue;
-                while (networker_pointers.cnt != 0);
-                for (i = 0; i < networker_pointers.free_cnt; i++) {
-                        mbuf_free(networker_pointers.pkts[i]);
                 }
-                networker_pointers.free_cnt = 0;
+                while (networker_pointers.cnt != 0)
+                        return_mbufs(num_workers);
                 for (i = 0; i < num_recv; i++) {
                         networker_pointers.pkts[i] = recv_mbufs[i];
                         networker_pointers.types[i] = (uint8_t) recv_type[i];
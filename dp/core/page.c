@@ -28,8 +28,9 @@
  * improved by maintaining free-lists of previously allocated
  * pages.
  *
- * FIXME: Need to add support for 1GB pages. May also consider
- * 4KB pages.
+ * Pages are tracked at 2MB granularity, but contiguous groups can be
+ * backed by 1GB pages (see page_alloc_contig_1gb_on_node()). May also
+ * consider 4KB pages.
  */
 
 #include <ix/stddef.h>
@@ -70,26 +71,31 @@ void __page_put_slow(void *addr)
 	mem_free_page((void *) PGADDR_2MB(addr), PGSIZE_2MB);
 }
 
-/**
- * page_alloc_contig_on_node - allocates a guest-physically contiguous set of 2MB pages
- * @nr: the number of pages
- * @numa_node: the numa node
- *
- * Returns an address, or NULL if fail.
+/*
+ * __page_alloc_contig - backs @nr 2MB pages with pages of @size bytes
  */
-void *page_alloc_contig_on_node(unsigned int nr, int numa_node)
+static void *__page_alloc_contig(unsigned int nr, int numa_node, int size)
 {
 	int ret, i;
+	unsigned int nr_big = div_up(nr * PGSIZE_2MB, size);
+	long cur, len = (long) nr_big * size;
+	void *base, *addr;
 
-	void *base = (void *) atomic64_fetch_and_add(&page_pos, nr * PGSIZE_2MB);
+	/* larger pages must be naturally aligned */
+	do {
+		cur = atomic64_read(&page_pos);
+		base = (void *) align_up(cur, size);
+	} while (!atomic64_cmpxchg(&page_pos, cur, (long) base + len));
 
-	if ((uintptr_t) base >= MEM_USER_START)
-		return NULL;
+	if ((uintptr_t) base + len > MEM_USER_START)
+		goto release;
 
+	addr = __mem_alloc_pages_onnode(base, nr_big, size, numa_node);
+	if (!addr || addr == MAP_FAILED)
+		goto release;
 
-	base = __mem_alloc_pages_onnode(base, nr, PGSIZE_2MB, numa_node);
-	if (!base)
-		return NULL;
+	/* the tail of the last large page is usable as well */
+	nr = len / PGSIZE_2MB;
 
 	for (i = 0; i < nr; i++) {
 
@@ -98,13 +104,49 @@ void *page_alloc_contig_on_node(unsigned int nr, int numa_node)
 		*((int *) pos) = 0; /* force a fault */
 		ret = mem_lookup_page_machine_addr(pos, PGSIZE_2MB, &ent->maddr);
 		if (ret) {
-			mem_free_pages(base, nr, PGSIZE_2MB);
+			mem_free_pages(base, nr_big, size);
 			log_err("page: failed to get machine address for %p\n", pos);
 			return NULL;
 		}
 	}
 
 	return base;
+
+release:
+	/*
+	 * Return the range, alignment included, unless a later allocation
+	 * follows it, so that a fallback to smaller pages reuses it.
+	 */
+	atomic64_cmpxchg(&page_pos, (long) base + len, cur);
+	return NULL;
+}
+
+/**
+ * page_alloc_contig_on_node - allocates a guest-physically contiguous set of 2MB pages
+ * @nr: the number of pages
+ * @numa_node: the numa node
+ *
+ * Returns an address, or NULL if fail.
+ */
+void *page_alloc_contig_on_node(unsigned int nr, int numa_node)
+{
+	return __page_alloc_contig(nr, numa_node, PGSIZE_2MB);
+}
+
+/**
+ * page_alloc_contig_1gb_on_node - like page_alloc_contig_on_node(), but
+ * backed by 1GB pages
+ * @nr: the number of 2MB pages, rounded up to whole 1GB pages
+ * @numa_node: the numa node
+ *
+ * The range is still handled as 2MB pages by the page table and
+ * page_free_contig(); only the TLB footprint shrinks.
+ *
+ * Returns an address, or NULL if fail (e.g. no free 1GB hugepages).
+ */
+void *page_alloc_contig_1gb_on_node(unsigned int nr, int numa_node)
+{
+	return __page_alloc_contig(nr, numa_node, PGSIZE_1GB);
 }
 
 /**
@@ -27,10 +27,9 @@
 #include <ix/mem.h>
 #include <ix/stddef.h>
 #include <ix/mempool.h>
-#include <ix/dispatch.h>
+#include <ix/taskqueue.h>
 
 #define TASK_CAPACITY    (768*1024)
-#define MCELL_CAPACITY   (768*1024)
 
 static int task_init_mempool(void)
 {
@@ -38,12 +37,6 @@ static int task_init_mempool(void)
 	return mempool_create(m, &task_datastore, MEMPOOL_SANITY_GLOBAL, 0);
 }
 
-static int mcell_init_mempool(void)
-{
-	struct mempool *m = &mcell_mempool;
-	return mempool_create(m, &mcell_datastore, MEMPOOL_SANITY_GLOBAL, 0);
-}
-
 /**
  * taskqueue_init - allocate global task mempool
  *
@@ -53,7 +46,6 @@ int taskqueue_init(void)
 {
 	int ret;
 	struct mempool_datastore *t = &task_datastore;
-	struct mempool_datastore *m = &mcell_datastore;
 
 	ret = mempool_create_datastore(t, TASK_CAPACITY, sizeof(struct task),
                                        1, MEMPOOL_DEFAULT_CHUNKSIZE, "task");
@@ -65,16 +57,5 @@ int taskqueue_init(void)
         if (ret) {
                 return ret;
         }
-
-	ret = mempool_create_datastore(m, MCELL_CAPACITY, sizeof(struct mbuf_cell),
-                                       1, MEMPOOL_DEFAULT_CHUNKSIZE, "mcell");
-	if (ret) {
-		return ret;
-	}
-
-        ret = mcell_init_mempool();
-        if (ret) {
-                return ret;
-        }
         return 0;
 }
@@ -0,0 +1,748 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * tcp_conn.c - requests and responses over TCP connections
+ *
+ * The networker owns the TCP stack: all connections live in one flow
+ * group, its outbound flow group, and are driven from do_networking(). A
+ * connection is a slot of a fixed table, and requests and responses refer
+ * to it by slot and generation, so that a response for a connection that
+ * went away in the meantime is recognized and dropped.
+ *
+ * Framed requests are numbered in the order they are dispatched, and up to
+ * 'tcp_window' of them past the oldest unfinished one may be dispatched.
+ * The rest wait on the connection, and when too many are waiting the stack
+ * is told to hold on to the received data, which stops the receive window
+ * from opening.
+ *
+ * Responses of the oldest unfinished request are written right away. Those
+ * of later requests are held back in a small reorder buffer, a list per
+ * window slot, and are written once every request before theirs is done.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ix/cfg.h>
+#include <ix/cpu.h>
+#include <ix/dispatch.h>
+#include <ix/errno.h>
+#include <ix/ethfg.h>
+#include <ix/log.h>
+#include <ix/mbuf.h>
+#include <ix/mempool.h>
+#include <ix/message.h>
+#include <ix/tcp_conn.h>
+
+#include <lwip/memp.h>
+#include <lwip/tcp.h>
+#include <lwip/tcp_impl.h>
+
+#define TCP_CONN_MAX            4096
+#define TCP_CONN_MAX_QUEUED     64
+#define TCP_FRAME_INLINE        (MBUF_DATA_LEN - sizeof(struct tcp_frame))
+#define TCP_CONN_SLOT(seq)      ((seq) % CFG_MAX_TCP_WINDOW)
+
+struct tcp_conn {
+        struct tcp_pcb * pcb;   /* NULL once the stack dropped it */
+        uint32_t gen;
+        uint8_t type;
+        bool fin;               /* the peer is done sending */
+        struct ip_tuple id;
+
+        /* the request being framed */
+        struct msg_hdr hdr;
+        unsigned int hdr_got;
+        struct mbuf * rx;
+        uint32_t rx_got;
+
+        /* framed requests waiting for room in the window */
+        struct mbuf * rq_head;
+        struct mbuf * rq_tail;
+        unsigned int nr_queued;
+
+        /* the reorder buffer */
+        uint32_t disp_seq;      /* of the next request to dispatch */
+        uint32_t tx_seq;        /* of the oldest unfinished request */
+        uint32_t done;          /* finished requests, by slot */
+        struct mbuf * held_head[CFG_MAX_TCP_WINDOW];
+        struct mbuf * held_tail[CFG_MAX_TCP_WINDOW];
+
+        /* responses waiting for send buffer space */
+        struct mbuf * tx_head;
+        struct mbuf * tx_tail;
+        size_t tx_off;
+};
+
+struct eth_fg * tcp_conn_fg;
+
+/* only used by the networker */
+static struct tcp_pcb_listen listen_pcbs[CFG_MAX_PORTS];
+static struct tcp_conn conns[TCP_CONN_MAX];
+static uint32_t free_conns[TCP_CONN_MAX];
+static int nr_free_conns;
+
+/* framed requests that may be dispatched */
+static struct mbuf * ready_head;
+static struct mbuf * ready_tail;
+
+/* finished requests handed back during the last poll */
+static struct mbuf * done_head;
+static struct mbuf * done_tail;
+
+static inline void frame_enqueue(struct mbuf ** head, struct mbuf ** tail,
+                                 struct mbuf * pkt)
+{
+        pkt->next = NULL;
+        if (*head)
+                (*tail)->next = pkt;
+        else
+                (*head) = pkt;
+        (*tail) = pkt;
+}
+
+static inline struct mbuf * frame_dequeue(struct mbuf ** head)
+{
+        struct mbuf * pkt = *head;
+
+        if (pkt)
+                (*head) = pkt->next;
+        return pkt;
+}
+
+/* frees a request or response mbuf on the networker */
+static void frame_free(struct mbuf * pkt)
+{
+        if (pkt->done_data)
+                mempool_free(&percpu_get(msg_pool), (void *) pkt->done_data);
+        mbuf_free(pkt);
+}
+
+static void frame_free_all(struct mbuf * pkt)
+{
+        struct mbuf * next;
+
+        for (; pkt; pkt = next) {
+                next = pkt->next;
+                frame_free(pkt);
+        }
+}
+
+/* some dispatched request of the connection is not done yet */
+static inline bool tcp_conn_busy(struct tcp_conn * c)
+{
+        return c->disp_seq != c->tx_seq;
+}
+
+static void tcp_conn_free(struct tcp_conn * c)
+{
+        c->gen++;
+        free_conns[nr_free_conns++] = c - conns;
+}
+
+/* drops everything the connection holds, except the dispatched requests */
+static void tcp_conn_drop(struct tcp_conn * c)
+{
+        int i;
+
+        if (c->rx) {
+                frame_free(c->rx);
+                c->rx = NULL;
+        }
+        frame_free_all(c->rq_head);
+        c->rq_head = NULL;
+        c->nr_queued = 0;
+        for (i = 0; i < CFG_MAX_TCP_WINDOW; i++) {
+                frame_free_all(c->held_head[i]);
+                c->held_head[i] = NULL;
+        }
+        frame_free_all(c->tx_head);
+        c->tx_head = NULL;
+        c->tx_off = 0;
+}
+
+/* closes a connection once the peer and we are both done */
+static void tcp_conn_try_close(struct tcp_conn * c)
+{
+        struct tcp_pcb * pcb = c->pcb;
+
+        if (!c->fin || !pcb || tcp_conn_busy(c) || c->rq_head || c->tx_head)
+                return;
+
+        /* no more events for this slot */
+        tcp_arg(pcb, NULL);
+        c->pcb = NULL;
+        tcp_conn_drop(c);
+        tcp_conn_free(c);
+        if (tcp_close(tcp_conn_fg, pcb) != ERR_OK)
+                tcp_abort(tcp_conn_fg, pcb);
+}
+
+/* dispatches the waiting requests that fit in the window */
+static void tcp_conn_dispatch(struct tcp_conn * c)
+{
+        struct mbuf * pkt;
+
+        while (c->rq_head && c->disp_seq - c->tx_seq < CFG.tcp_window) {
+                pkt = frame_dequeue(&c->rq_head);
+                c->nr_queued--;
+                tcp_frame(pkt)->seq = c->disp_seq++;
+                frame_enqueue(&ready_head, &ready_tail, pkt);
+        }
+}
+
+static void tcp_conn_queue(struct tcp_conn * c, struct mbuf * pkt)
+{
+        frame_enqueue(&c->rq_head, &c->rq_tail, pkt);
+        c->nr_queued++;
+        tcp_conn_dispatch(c);
+}
+
+/* allocates the mbuf of the request whose header was just received */
+static struct mbuf * tcp_conn_new_req(struct tcp_conn * c)
+{
+        struct msg_buf * buf = NULL;
+        struct tcp_frame * f;
+        struct mbuf * pkt;
+        uint32_t len = ntoh32(c->hdr.msg_len);
+
+        pkt = mbuf_alloc_local();
+        if (unlikely(!pkt))
+                return NULL;
+
+        f = tcp_frame(pkt);
+        if (len > TCP_FRAME_INLINE) {
+                buf = mempool_alloc(&percpu_get(msg_pool));
+                if (unlikely(!buf)) {
+                        mbuf_free(pkt);
+                        return NULL;
+                }
+                f->data = buf->data;
+        } else {
+                f->data = f + 1;
+        }
+
+        f->conn = c - conns;
+        f->gen = c->gen;
+        f->msg_id = ntoh32(c->hdr.msg_id);
+        f->len = len;
+        f->kind = TCP_FRAME_REQ;
+        f->type = c->type;
+        f->id = c->id;
+        pkt->dev_idx = MBUF_TCP_FRAME;
+        pkt->done_data = (unsigned long) buf;
+        /* the dispatcher ages the request from when its frame completed */
+        pkt->timestamp = rdtsc();
+        return pkt;
+}
+
+static err_t tcp_conn_accept(struct tcp_pcb * pcb)
+{
+        struct tcp_conn * c;
+        int i;
+
+        for (i = 0; i < CFG.num_ports; i++)
+                if (CFG.ports[i] == pcb->local_port)
+                        break;
+        if (unlikely(i == CFG.num_ports || !nr_free_conns))
+                return ERR_MEM;
+
+        c = &conns[free_conns[--nr_free_conns]];
+        c->pcb = pcb;
+        c->type = i;
+        c->fin = false;
+        c->id.src_ip = ntoh32(pcb->remote_ip.addr);
+        c->id.dst_ip = CFG.host_addr.addr;
+        c->id.src_port = pcb->remote_port;
+        c->id.dst_port = pcb->local_port;
+        c->hdr_got = 0;
+        c->rx = NULL;
+        c->rq_head = NULL;
+        c->nr_queued = 0;
+        c->disp_seq = 0;
+        c->tx_seq = 0;
+        c->done = 0;
+        c->tx_head = NULL;
+        c->tx_off = 0;
+
+        tcp_nagle_disable(pcb);
+        tcp_arg(pcb, c);
+        return ERR_OK;
+}
+
+static err_t tcp_conn_recv(struct tcp_conn * c, struct pbuf * p)
+{
+        struct tcp_frame * f;
+        struct pbuf * q;
+        char * pos;
+        size_t left, n;
+
+        if (!p) {
+                c->fin = true;
+                tcp_conn_try_close(c);
+                return ERR_OK;
+        }
+
+        /* the stack keeps the data and hands it to us again later */
+        if (c->nr_queued >= TCP_CONN_MAX_QUEUED)
+                return ERR_MEM;
+
+        for (q = p; q; q = q->next) {
+                pos = q->payload;
+                left = q->len;
+                while (left) {
+                        if (!c->rx) {
+                                n = min(left,
+                                        sizeof(struct msg_hdr) - c->hdr_got);
+                                memcpy((char *) &c->hdr + c->hdr_got, pos, n);
+                                c->hdr_got += n;
+                                pos += n;
+                                left -= n;
+                                if (c->hdr_got < sizeof(struct msg_hdr))
+                                        continue;
+                                if (unlikely(ntoh32(c->hdr.msg_len) >
+                                             MSG_MAX_LEN)) {
+                                        log_warn("tcp_conn: request too long\n");
+                                        goto abort;
+                                }
+                                c->rx = tcp_conn_new_req(c);
+                                if (unlikely(!c->rx)) {
+                                        log_warn("tcp_conn: out of buffers\n");
+                                        goto abort;
+                                }
+                                c->rx_got = 0;
+                        }
+
+                        f = tcp_frame(c->rx);
+                        n = min(left, (size_t) (f->len - c->rx_got));
+                        memcpy((char *) f->data + c->rx_got, pos, n);
+                        c->rx_got += n;
+                        pos += n;
+                        left -= n;
+                        if (c->rx_got == f->len) {
+                                tcp_conn_queue(c, c->rx);
+                                c->rx = NULL;
+                                c->hdr_got = 0;
+                        }
+                }
+        }
+
+        tcp_recved(tcp_conn_fg, c->pcb, p->tot_len);
+        pbuf_free(p);
+        return ERR_OK;
+
+abort:
+        pbuf_free(p);
+        /* reports ERR_ABRT, which releases the slot */
+        tcp_abort(tcp_conn_fg, c->pcb);
+        return ERR_ABRT;
+}
+
+/* writes as much of the queued responses as the send buffer takes */
+static void tcp_conn_flush(struct tcp_conn * c)
+{
+        struct tcp_frame * f;
+        struct msg_hdr hdr;
+        struct mbuf * pkt;
+        size_t total, n;
+        bool wrote = false;
+        char * pos;
+
+        while ((pkt = c->tx_head)) {
+                f = tcp_frame(pkt);
+                hdr.msg_id = hton32(f->msg_id);
+                hdr.msg_len = hton32(f->len);
+                hdr.seg = 0;
+                hdr.nr_segs = hton16(1);
+                total = sizeof(hdr) + f->len;
+
+                while (c->tx_off < total) {
+                        if (c->tx_off < sizeof(hdr)) {
+                                pos = (char *) &hdr + c->tx_off;
+                                n = sizeof(hdr) - c->tx_off;
+                        } else {
+                                pos = (char *) f->data + c->tx_off -
+                                      sizeof(hdr);
+                                n = total - c->tx_off;
+                        }
+                        n = min(n, (size_t) tcp_sndbuf(c->pcb));
+                        n = min(n, (size_t) UINT16_MAX);
+                        if (!n || tcp_write(c->pcb, pos, n,
+                                            TCP_WRITE_FLAG_COPY) != ERR_OK)
+                                goto out;
+                        c->tx_off += n;
+                        wrote = true;
+                }
+
+                c->tx_head = pkt->next;
+                c->tx_off = 0;
+                frame_free(pkt);
+        }
+
+out:
+        if (wrote)
+                tcp_output(tcp_conn_fg, c->pcb);
+        if (!c->tx_head)
+                tcp_conn_try_close(c);
+}
+
+static void tcp_conn_err(struct tcp_conn * c)
+{
+        /* the stack already freed the pcb */
+        c->pcb = NULL;
+        tcp_conn_drop(c);
+        if (!tcp_conn_busy(c))
+                tcp_conn_free(c);
+}
+
+/**
+ * tcp_conn_event - the event callback of the TCP stack
+ *
+ * Used instead of the one of the IX socket API when 'tcp' is enabled.
+ */
+err_t tcp_conn_event(struct eth_fg *cur_fg, void *arg, struct tcp_pcb *pcb,
+                     enum lwip_event event, struct pbuf *p, u16_t size,
+                     err_t err)
+{
+        struct tcp_conn * c = arg;
+
+        switch (event) {
+        case LWIP_EVENT_ACCEPT:
+                return tcp_conn_accept(pcb);
+        case LWIP_EVENT_RECV:
+                if (unlikely(!c)) {
+                        if (p)
+                                pbuf_free(p);
+                        return ERR_OK;
+                }
+                return tcp_conn_recv(c, p);
+        case LWIP_EVENT_SENT:
+                if (c)
+                        tcp_conn_flush(c);
+                return ERR_OK;
+        case LWIP_EVENT_ERR:
+                if (c)
+                        tcp_conn_err(c);
+                return ERR_OK;
+        default:
+                return ERR_OK;
+        }
+}
+
+/* moves the responses held for the oldest unfinished request to the TX queue */
+static void tcp_conn_retire(struct tcp_conn * c)
+{
+        uint32_t slot;
+
+        while (c->done & (1u << TCP_CONN_SLOT(c->tx_seq))) {
+                c->done &= ~(1u << TCP_CONN_SLOT(c->tx_seq));
+                c->tx_seq++;
+
+                slot = TCP_CONN_SLOT(c->tx_seq);
+                if (!c->held_head[slot])
+                        continue;
+                if (c->tx_head)
+                        c->tx_tail->next = c->held_head[slot];
+                else
+                        c->tx_head = c->held_head[slot];
+                c->tx_tail = c->held_tail[slot];
+                c->held_head[slot] = NULL;
+        }
+}
+
+/* a worker is done with a request: release the ones after it */
+static void tcp_conn_finish(struct mbuf * pkt)
+{
+        struct tcp_frame * f = tcp_frame(pkt);
+        struct tcp_conn * c = &conns[f->conn];
+
+        BUILD_ASSERT(CFG_MAX_TCP_WINDOW <= 32);
+
+        c->done |= 1u << TCP_CONN_SLOT(f->seq);
+        frame_free(pkt);
+        tcp_conn_retire(c);
+        if (!c->pcb) {
+                if (!tcp_conn_busy(c))
+                        tcp_conn_free(c);
+                return;
+        }
+
+        tcp_conn_dispatch(c);
+        if (c->pcb->refused_data)
+                tcp_process_refused_data(tcp_conn_fg, c->pcb);
+        if (c->pcb)
+                tcp_conn_flush(c);
+}
+
+static void tcp_conn_respond(struct mbuf * pkt)
+{
+        struct tcp_frame * f = tcp_frame(pkt);
+        struct tcp_conn * c = &conns[f->conn];
+        uint32_t slot;
+
+        if (unlikely(c->gen != f->gen || !c->pcb)) {
+                frame_free(pkt);
+                return;
+        }
+
+        if (f->seq != c->tx_seq) {
+                slot = TCP_CONN_SLOT(f->seq);
+                frame_enqueue(&c->held_head[slot], &c->held_tail[slot], pkt);
+                return;
+        }
+
+        frame_enqueue(&c->tx_head, &c->tx_tail, pkt);
+        if (c->tx_head == pkt)
+                tcp_conn_flush(c);
+}
+
+/**
+ * tcp_conn_poll - processes what the workers handed back
+ * @num_workers: the number of worker cores
+ *
+ * Returns the number of responses and finished requests handed back.
+ *
+ * Finished requests are processed one poll late. A request may be handed
+ * back by another worker than the one that queued some of its responses,
+ * after it was preempted, and its responses must not be written after
+ * those of the next request. They were queued before the request was
+ * handed back, so they are seen by the time the next poll drained the
+ * rings.
+ *
+ * The TCP timers are run by the networker loop, right after this.
+ */
+int tcp_conn_poll(int num_workers)
+{
+        struct mbuf * bufs[MBUF_RING_BATCH];
+        struct mbuf * done = done_head, * next;
+        struct mbuf_ring * r;
+        int i, j, n, count = 0;
+
+        done_head = NULL;
+        for (i = 0; i <= num_workers; i++) {
+                r = i < num_workers ? &tcp_rings[i] : DISPATCHER_TCP_RING;
+                while ((n = mbuf_ring_get(r, bufs))) {
+                        count += n;
+                        for (j = 0; j < n; j++) {
+                                if (tcp_frame(bufs[j])->kind == TCP_FRAME_REQ)
+                                        frame_enqueue(&done_head, &done_tail,
+                                                      bufs[j]);
+                                else
+                                        tcp_conn_respond(bufs[j]);
+                        }
+                }
+        }
+
+        for (; done; done = next) {
+                next = done->next;
+                tcp_conn_finish(done);
+        }
+
+        return count;
+}
+
+/**
+ * tcp_conn_ready - adds framed requests to the received packets
+ * @num_recv: the number of received packets
+ *
+ * Returns the new number of received packets.
+ */
+int tcp_conn_ready(int num_recv)
+{
+        struct mbuf * pkt;
+
+        while (num_recv < ETH_RX_MAX_BATCH &&
+               (pkt = frame_dequeue(&ready_head))) {
+                pkt->next = NULL;
+                recv_mbufs[num_recv] = pkt;
+                recv_type[num_recv] = tcp_frame(pkt)->type;
+                num_recv++;
+        }
+
+        return num_recv;
+}
+
+/**
+ * tcp_conn_send - hands a response to the networker
+ * @r: the TCP ring of the calling core
+ * @req: the request being answered
+ * @resp: an mbuf of the calling core
+ * @data: the response, in @resp or in @buf
+ * @len: the length of the response
+ * @buf: a message buffer to free once sent, or NULL
+ *
+ * @resp and @buf are consumed whether or not this succeeds. Must be called
+ * with preemption disabled.
+ *
+ * Returns 0 if successful, otherwise -EINVAL.
+ */
+int tcp_conn_send(struct mbuf_ring * r, struct mbuf * req, struct mbuf * resp,
+                  void * data, size_t len, struct msg_buf * buf)
+{
+        struct tcp_frame * f = tcp_frame(resp);
+        struct tcp_frame * rf = tcp_frame(req);
+
+        /* shinjuku_resp_init() replies start at UDP_PKT_SIZE */
+        BUILD_ASSERT(offsetof(struct tcp_frame, id) <= UDP_PKT_SIZE);
+
+        if (unlikely(len > MSG_MAX_LEN)) {
+                if (buf)
+                        mempool_free(&percpu_get(msg_pool), buf);
+                mbuf_free(resp);
+                return -EINVAL;
+        }
+
+        f->conn = rf->conn;
+        f->gen = rf->gen;
+        f->msg_id = rf->msg_id;
+        f->len = len;
+        f->seq = rf->seq;
+        f->kind = TCP_FRAME_RESP;
+        f->data = data;
+        resp->done_data = (unsigned long) buf;
+        mbuf_ring_put_wait(r, resp);
+        return 0;
+}
+
+/**
+ * tcp_conn_reply - copies a response and hands it to the networker
+ * @r: the TCP ring of the calling core
+ * @req: the request being answered
+ * @data: the response
+ * @len: the length of the response, at most MSG_MAX_LEN
+ *
+ * Must be called with preemption disabled.
+ *
+ * Returns 0 if successful, otherwise a negative error code.
+ */
+int tcp_conn_reply(struct mbuf_ring * r, struct mbuf * req, const void * data,
+                   size_t len)
+{
+        struct msg_buf * buf = NULL;
+        struct mbuf * resp;
+        void * dst;
+
+        if (unlikely(len > MSG_MAX_LEN))
+                return -EINVAL;
+
+        resp = mbuf_alloc_local();
+        if (unlikely(!resp))
+                return -ENOMEM;
+
+        dst = tcp_frame(resp) + 1;
+        if (len > TCP_FRAME_INLINE) {
+                buf = mempool_alloc(&percpu_get(msg_pool));
+                if (unlikely(!buf)) {
+                        mbuf_free(resp);
+                        return -ENOMEM;
+                }
+                dst = buf->data;
+        }
+
+        memcpy(dst, data, len);
+        return tcp_conn_send(r, req, resp, dst, len, buf);
+}
+
+/**
+ * tcp_conn_done - hands a finished request back to the networker
+ * @r: the TCP ring of the calling core
+ * @req: the request mbuf
+ *
+ * Once the networker sees it, the responses of the requests after it may
+ * go out and more requests of the connection are dispatched. Must be called
+ * with preemption disabled.
+ */
+void tcp_conn_done(struct mbuf_ring * r, struct mbuf * req)
+{
+        msg_release(req);
+        mbuf_ring_put_wait(r, req);
+}
+
+/**
+ * tcp_conn_start - sets up the TCP stack on the networker
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int tcp_conn_start(void)
+{
+        int i, ret, idx = outbound_fg_idx();
+        struct eth_fg * fg;
+
+        if (!CFG.tcp)
+                return 0;
+
+        fg = calloc(1, sizeof(*fg));
+        if (!fg)
+                return -ENOMEM;
+
+        /* nothing is declared per flow group, so no perfg area */
+        eth_fg_init(fg, idx);
+        fg->fg_id = idx;
+        fg->cur_cpu = percpu_get(cpu_id);
+        fg->dev_idx = 0;
+        fgs[idx] = fg;
+        tcp_init(fg);
+        tcp_conn_fg = fg;
+
+        for (i = 0; i < CFG.num_ports; i++) {
+                ret = tcp_listen_with_backlog(&listen_pcbs[i],
+                                              TCP_DEFAULT_LISTEN_BACKLOG,
+                                              IP_ADDR_ANY, CFG.ports[i]);
+                if (ret) {
+                        log_err("tcp_conn: cannot listen on port %d\n",
+                                CFG.ports[i]);
+                        return ret;
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * tcp_conn_init - allocates the TCP buffers and the connection table
+ */
+int tcp_conn_init(void)
+{
+        int i;
+
+        if (!CFG.tcp)
+                return 0;
+
+        for (i = 0; i < TCP_CONN_MAX; i++)
+                free_conns[i] = TCP_CONN_MAX - 1 - i;
+        nr_free_conns = TCP_CONN_MAX;
+
+        return memp_init() ? -ENOMEM : 0;
+}
+
+/**
+ * tcp_conn_init_cpu - allocates the per-cpu TCP buffer mempools
+ */
+int tcp_conn_init_cpu(void)
+{
+        if (!CFG.tcp)
+                return 0;
+
+        return memp_init_cpu() ? -ENOMEM : 0;
+}
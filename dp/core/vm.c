@@ -77,7 +77,7 @@ int __vm_map_phys(physaddr_t pa, virtaddr_t va,
 {
 	int ret;
 	struct vm_arg args;
-	size_t len = nr * size;
+	size_t len = (size_t) nr * size;
 	int create;
 
 	if (!(perm & VM_PERM_R))
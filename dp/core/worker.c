@@ -31,6 +31,7 @@
 #include <ucontext.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sched.h>
 #include <stdio.h>
@@ -43,9 +44,17 @@
 #include <ix/log.h>
 #include <ix/mbuf.h>
 #include <asm/cpu.h>
+#include <ix/batch.h>
+#include <ix/coalesce.h>
 #include <ix/context.h>
 #include <ix/dispatch.h>
+#include <ix/handler.h>
+#include <ix/idle.h>
+#include <ix/message.h>
+#include <ix/preempt.h>
+#include <ix/tcp_conn.h>
 #include <ix/transmit.h>
+#include <ix/timer.h>
 
 #include <dune.h>
 
@@ -59,12 +68,29 @@ __thread ucontext_t uctx_main;
 __thread ucontext_t * cont;
 __thread int cpu_nr_;
 __thread volatile uint8_t finished;
+__thread volatile unsigned int preempt_cnt;
+__thread volatile uint8_t preempt_pending;
+__thread int parked_call;
+
+/*
+ * TX doorbell batching: tx_max_delay is the configured bound (in cycles)
+ * on how long a response may wait for its doorbell, and loop_cycles an
+ * estimate of one iteration of do_work(). A response is only held back if
+ * the next iteration is expected to end within the bound, so coalescing
+ * happens at high load and turns itself off at low load or for long
+ * requests.
+ */
+#define LOOP_CYCLES_SHIFT 3
+
+__thread unsigned long tx_max_delay;
+__thread unsigned long loop_cycles;
 
 DEFINE_PERCPU(struct mempool, response_pool __attribute__((aligned(64))));
 
 extern int getcontext_fast(ucontext_t *ucp);
 extern int swapcontext_fast(ucontext_t *ouctx, ucontext_t *uctx);
 extern int swapcontext_very_fast(ucontext_t *ouctx, ucontext_t *uctx);
+extern int swapcontext_fast_to_control(ucontext_t *ouctx, ucontext_t *uctx);
 
 extern void dune_apic_eoi();
 extern int dune_register_intr_handler(int vector, dune_intr_cb cb);
@@ -84,10 +110,10 @@ struct request {
  */
 int response_init(void)
 {
-        return mempool_create_datastore(&response_datastore, 128000,
-                                        sizeof(struct response), 1,
-                                        MEMPOOL_DEFAULT_CHUNKSIZE,
-                                        "response");
+        return mempool_create_numa_datastore(&response_datastore, 128000,
+                                             sizeof(struct response), 1,
+                                             MEMPOOL_DEFAULT_CHUNKSIZE,
+                                             "response");
 }
 
 /**
@@ -96,33 +122,276 @@ int response_init(void)
 int response_init_cpu(void)
 {
         struct mempool *m = &percpu_get(response_pool);
-        return mempool_create(m, &response_datastore, MEMPOOL_SANITY_PERCPU,
-                              percpu_get(cpu_id));
+        return mempool_create_numa(m, &response_datastore,
+                                   MEMPOOL_SANITY_PERCPU, percpu_get(cpu_id),
+                                   percpu_get(cpu_numa_node));
 }
 
 static void test_handler(struct dune_tf *tf)
 {
         asm volatile ("cli":::);
         dune_apic_eoi();
+        if (preempt_cnt) {
+                preempt_pending = true;
+                return;
+        }
+        preempt_pending = false;
         swapcontext_fast_to_control(cont, &uctx_main);
 }
 
 /**
- * generic_work - generic function acting as placeholder for application-level
- *                work
- * @msw: the top 32-bits of the pointer containing the data
- * @lsw: the bottom 32 bits of the pointer containing the data
+ * shinjuku_yield - voluntarily gives up the worker
+ *
+ * The running context is returned to the dispatcher as preempted and is
+ * requeued at the tail of its task queue. Inside a preempt_disable()
+ * section it returns at once without yielding.
  */
-static void generic_work(uint32_t msw, uint32_t lsw, uint32_t msw_id,
-                         uint32_t lsw_id)
+void shinjuku_yield(void)
 {
+        if (unlikely(preempt_cnt)) {
+                log_warn("shinjuku_yield: called with preemption disabled\n");
+                return;
+        }
+        asm volatile ("cli":::);
+        preempt_pending = false;
+        swapcontext_fast_to_control(cont, &uctx_main);
         asm volatile ("sti":::);
+}
 
-        struct ip_tuple * id = (struct ip_tuple *) ((uint64_t) msw_id << 32 | lsw_id);
-        void * data = (void *)((uint64_t) msw << 32 | lsw);
+static int call_slot_alloc(void)
+{
+        static volatile unsigned int call_next;
+        unsigned int i, slot;
+
+        for (i = 0; i < CFG_MAX_CALLS; i++) {
+                slot = __sync_fetch_and_add(&call_next, 1) % CFG_MAX_CALLS;
+                if (__sync_bool_compare_and_swap(&call_slots[slot].state,
+                                                 CALL_FREE, CALL_SENT))
+                        return slot;
+        }
+        return -1;
+}
+
+/**
+ * shinjuku_call - sends a UDP request and waits for the reply
+ * @dst_ip: the backend address
+ * @dst_port: the backend port
+ * @msg: the request, built with shinjuku_resp_init(); always consumed
+ * @reply: filled with the reply payload
+ *
+ * The calling context is parked until the reply arrives, so the worker is
+ * free to run other requests. The reply stays in its receive buffer, which
+ * is released when the handler finishes. There is no timeout: a lost
+ * reply leaves the handler parked. Requests of batched datagrams share their
+ * receive buffer, so they cannot make calls, and neither can handlers
+ * inside a preempt_disable() section.
+ *
+ * Returns 0 if successful, otherwise a negative error code.
+ */
+int shinjuku_call(uint32_t dst_ip, uint16_t dst_port,
+                  struct shinjuku_resp *msg, struct shinjuku_reply *reply)
+{
+        int ret, slot;
+        struct mbuf *pkt, *req;
+        struct eth_hdr *ethhdr;
+        struct ip_hdr *iphdr;
+        struct udp_hdr *udphdr;
+        bool batched;
+
+        if (unlikely(!CFG.call_port || preempt_cnt)) {
+                shinjuku_resp_discard(msg);
+                return -EINVAL;
+        }
+
+        preempt_disable();
+        req = (struct mbuf *) dispatcher_requests[cpu_nr_].mbuf;
+        batched = req && batch_is_req(req);
+        preempt_enable();
+        if (unlikely(batched)) {
+                shinjuku_resp_discard(msg);
+                return -EINVAL;
+        }
+
+        slot = call_slot_alloc();
+        if (unlikely(slot < 0)) {
+                shinjuku_resp_discard(msg);
+                return -EBUSY;
+        }
+
+        struct ip_tuple id = {
+                .src_ip = CFG.host_addr.addr,
+                .dst_ip = dst_ip,
+                .src_port = CFG.call_port + slot,
+                .dst_port = dst_port
+        };
+
+        asm volatile ("cli":::);
+        ret = udp_send_pkt(msg->pkt, msg->len, &id);
+        if (ret) {
+                mbuf_free(msg->pkt);
+                msg->pkt = NULL;
+                call_slots[slot].state = CALL_FREE;
+                asm volatile ("sti":::);
+                return ret;
+        }
+        msg->pkt = NULL;
+
+        preempt_pending = false;
+        parked_call = slot;
+        swapcontext_fast_to_control(cont, &uctx_main);
+
+        /*
+         * Chain the reply to the request buffer so that the dispatcher
+         * returns both to the networker once the handler finishes.
+         */
+        pkt = call_slots[slot].reply;
+        req = (struct mbuf *) dispatcher_requests[cpu_nr_].mbuf;
+        pkt->next = req->next;
+        req->next = pkt;
+
+        ethhdr = mbuf_mtod(pkt, struct eth_hdr *);
+        iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
+        udphdr = mbuf_nextd_off(iphdr, struct udp_hdr *,
+                                iphdr->header_len * sizeof(uint32_t));
+        reply->data = mbuf_nextd(udphdr, void *);
+        reply->len = ntoh16(udphdr->len) - sizeof(struct udp_hdr);
+
+        /* the slot is CALL_DONE, so no reply lands in between */
+        call_slots[slot].reply = NULL;
+        asm volatile("" ::: "memory");
+        call_slots[slot].state = CALL_FREE;
+        asm volatile ("sti":::);
+        return 0;
+}
+
+/**
+ * shinjuku_reply_inplace - answers a request by rewriting its receive buffer
+ * @req: the request
+ * @len: the length of the reply, already written at @req->data
+ *
+ * The addresses and ports of the request are swapped and the buffer is sent
+ * back from this worker, which saves allocating a reply and returning the
+ * request buffer to the networker. The request payload and the replies
+ * of earlier shinjuku_call()s are no longer accessible afterwards. With the
+ * message layer enabled, the reply is sent as a single-segment message.
+ *
+ * Requests received over TCP are answered on their connection instead, and
+ * with 'coalesce_ns' set the reply is packed into the open datagram to the
+ * client. In both cases, and for requests of batched datagrams, whose
+ * receive buffer is shared, the reply is copied and the request payload
+ * stays accessible.
+ *
+ * Returns 0 if successful, otherwise a negative error code; the request
+ * buffer is then released as usual when the handler finishes.
+ */
+int shinjuku_reply_inplace(struct shinjuku_req *req, size_t len)
+{
         int ret;
+        struct mbuf *pkt, *m, *next;
+        struct msg_hdr *hdr;
+        size_t off = UDP_PKT_SIZE, hdr_len;
+        char *dst;
+        void *payload;
+        struct ip_tuple id = {
+                .src_ip = req->id->dst_ip,
+                .dst_ip = req->id->src_ip,
+                .src_port = req->id->dst_port,
+                .dst_port = req->id->src_port
+        };
+
+        preempt_disable();
+        pkt = (struct mbuf *) dispatcher_requests[cpu_nr_].mbuf;
+        if (pkt && tcp_frame_is_req(pkt)) {
+                ret = tcp_conn_reply(&tcp_rings[cpu_nr_], pkt, req->data, len);
+                preempt_enable();
+                return ret;
+        }
+
+        if (CFG.coalesce_ns) {
+                hdr_len = CFG.msg_layer ? sizeof(struct msg_hdr) : 0;
+                if (unlikely(hdr_len + len > COALESCE_MAX_LEN)) {
+                        preempt_enable();
+                        return -EINVAL;
+                }
+                dst = coalesce_reserve(&id, hdr_len + len);
+                if (unlikely(!dst)) {
+                        preempt_enable();
+                        return -ENOMEM;
+                }
+                if (hdr_len) {
+                        hdr = (struct msg_hdr *) dst;
+                        hdr->msg_id = hton32(req->msg_id);
+                        hdr->msg_len = hton32(len);
+                        hdr->seg = 0;
+                        hdr->nr_segs = hton16(1);
+                }
+                memcpy(dst + hdr_len, req->data, len);
+                preempt_enable();
+                return 0;
+        }
+
+        if (CFG.msg_layer)
+                off += sizeof(struct msg_hdr);
+        if (unlikely(off + len > UDP_PKT_SIZE + UDP_MAX_LEN)) {
+                preempt_enable();
+                return -EINVAL;
+        }
+
+        if (batch_is_req(pkt)) {
+                /* the other requests of the datagram still use it */
+                m = mbuf_alloc_local();
+                if (unlikely(!m)) {
+                        preempt_enable();
+                        return -ENOMEM;
+                }
+                memcpy(mbuf_mtod_off(m, void *, UDP_PKT_SIZE), req->data, len);
+                ret = udp_send_pkt(m, len, &id);
+                if (ret)
+                        mbuf_free(m);
+                preempt_enable();
+                return ret;
+        }
+
+        /* IP options would leave the payload past UDP_PKT_SIZE */
+        payload = mbuf_mtod_off(pkt, void *, off);
+        if (unlikely(req->data != payload))
+                memmove(payload, req->data, len);
+        if (CFG.msg_layer) {
+                msg_release(pkt);
+                hdr = mbuf_mtod_off(pkt, struct msg_hdr *, UDP_PKT_SIZE);
+                hdr->msg_id = hton32(req->msg_id);
+                hdr->msg_len = hton32(len);
+                hdr->seg = 0;
+                hdr->nr_segs = hton16(1);
+                len += sizeof(struct msg_hdr);
+        }
+
+        for (m = pkt->next; m; m = next) {
+                next = m->next;
+                mbuf_free(m);
+        }
+        pkt->next = NULL;
+        pkt->done = &mbuf_default_done;
+
+        ret = udp_send_pkt(pkt, len, &id);
+        if (!ret) {
+                /* the TX queue owns the buffer now */
+                dispatcher_requests[cpu_nr_].mbuf = NULL;
+                req->data = NULL;
+        }
+        preempt_enable();
+        return ret;
+}
 
-        struct request * req = (struct request *) data;
+/**
+ * generic_work - default handler, a synthetic workload spinning for the
+ *                duration requested by the client
+ * @r: the request
+ */
+static void generic_work(struct shinjuku_req *r)
+{
+        struct request * req = (struct request *) r->data;
+        int ret;
 
         uint64_t i = 0;
         do {
@@ -130,35 +399,92 @@ static void generic_work(uint32_t msw, uint32_t lsw, uint32_t msw_id,
                 i++;
         } while ( i / 0.233 < req->runNs);
 
+        if (CFG.inplace_reply || CFG.coalesce_ns || r->tcp) {
+                /* struct response has the layout of the request */
+                ret = shinjuku_reply_inplace(r, sizeof(struct response));
+                if (ret)
+                        log_warn("in-place reply failed with error %d\n", ret);
+                return;
+        }
+
         asm volatile ("cli":::);
         struct response * resp = mempool_alloc(&percpu_get(response_pool));
         if (!resp) {
                 log_warn("Cannot allocate response buffer\n");
-                finished = true;
-                swapcontext_very_fast(cont, &uctx_main);
+                return;
         }
 
         resp->genNs = req->genNs;
         resp->runNs = req->runNs;
         struct ip_tuple new_id = {
-                .src_ip = id->dst_ip,
-                .dst_ip = id->src_ip,
-                .src_port = id->dst_port,
-                .dst_port = id->src_port
+                .src_ip = r->id->dst_ip,
+                .dst_ip = r->id->src_ip,
+                .src_port = r->id->dst_port,
+                .dst_port = r->id->src_port
         };
 
         ret = udp_send((void *)resp, sizeof(struct response), &new_id,
                        (uint64_t) resp);
         if (ret)
                 log_warn("udp_send failed with error %d\n", ret);
+}
+
+/**
+ * run_handler - entry point of a request context
+ * @msw: the top 32-bits of the pointer containing the data
+ * @lsw: the bottom 32 bits of the pointer containing the data
+ * @msw_id: the top 32-bits of the pointer to the request 4-tuple
+ * @lsw_id: the bottom 32-bits of the pointer to the request 4-tuple
+ * @meta: the request type in bits 24-31, whether the request came over TCP
+ *        in bit 23 and the payload length in bits 0-22
+ * @msg_id: the message id of the request
+ */
+static void run_handler(uint32_t msw, uint32_t lsw, uint32_t msw_id,
+                        uint32_t lsw_id, uint32_t meta, uint32_t msg_id)
+{
+        struct shinjuku_req req = {
+                .data = (void *)((uint64_t) msw << 32 | lsw),
+                .len = meta & 0x7FFFFF,
+                .type = meta >> 24,
+                .tcp = (meta >> 23) & 1,
+                .id = (struct ip_tuple *) ((uint64_t) msw_id << 32 | lsw_id),
+                .msg_id = msg_id
+        };
+        shinjuku_handler_t handler = handlers[req.type];
+
+        asm volatile ("sti":::);
+        if (handler)
+                handler(&req);
+        else
+                generic_work(&req);
+        asm volatile ("cli":::);
 
         finished = true;
         swapcontext_very_fast(cont, &uctx_main);
 }
 
 static inline void parse_packet(struct mbuf * pkt, void ** data_ptr,
-                                struct ip_tuple ** id_ptr)
+                                uint32_t * len_ptr, struct ip_tuple ** id_ptr,
+                                uint32_t * msg_id_ptr)
 {
+        if (batch_is_req(pkt)) {
+                /* the networker located the requests of the datagram */
+                batch_claim(pkt, data_ptr, len_ptr);
+                (*id_ptr) = &batch_desc(pkt)->id;
+                (*msg_id_ptr) = 0;
+                return;
+        }
+
+        if (tcp_frame_is_req(pkt)) {
+                /* already framed by the networker */
+                struct tcp_frame * f = tcp_frame(pkt);
+                (*data_ptr) = f->data;
+                (*len_ptr) = f->len;
+                (*id_ptr) = &f->id;
+                (*msg_id_ptr) = f->msg_id;
+                return;
+        }
+
         // Quickly parse packet without doing checks
         struct eth_hdr * ethhdr = mbuf_mtod(pkt, struct eth_hdr *);
         struct ip_hdr *  iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
@@ -174,6 +500,15 @@ static inline void parse_packet(struct mbuf * pkt, void ** data_ptr,
                 (*data_ptr) = NULL;
                 return;
         }
+        (*len_ptr) = len - sizeof(struct udp_hdr);
+
+        (*msg_id_ptr) = 0;
+        if (CFG.msg_layer && msg_parse(pkt, *data_ptr, data_ptr, len_ptr,
+                                       msg_id_ptr)) {
+                log_warn("worker: request without a message header\n");
+                (*data_ptr) = NULL;
+                return;
+        }
 
         (*id_ptr) = mbuf_mtod(pkt, struct ip_tuple *);
         (*id_ptr)->src_ip = ntoh32(iphdr->src_addr.addr);
@@ -187,6 +522,7 @@ static inline void init_worker(void)
 {
         cpu_nr_ = percpu_get(cpu_nr) - 2;
         worker_responses[cpu_nr_].flag = PROCESSED;
+        parked_call = -1;
         dune_register_intr_handler(PREEMPT_VECTOR, test_handler);
         eth_process_reclaim();
         asm volatile ("cli":::);
@@ -196,19 +532,26 @@ static inline void handle_new_packet(void)
 {
         int ret;
         void * data;
+        uint32_t len, msg_id;
         struct ip_tuple * id;
         struct mbuf * pkt = (struct mbuf *) dispatcher_requests[cpu_nr_].mbuf;
-        parse_packet(pkt, &data, &id);
+        uint8_t type = dispatcher_requests[cpu_nr_].type;
+        pkt->next = NULL;
+        parse_packet(pkt, &data, &len, &id, &msg_id);
         if (data) {
                 uint32_t msw = ((uint64_t) data & 0xFFFFFFFF00000000) >> 32;
                 uint32_t lsw = (uint64_t) data & 0x00000000FFFFFFFF;
                 uint32_t msw_id = ((uint64_t) id & 0xFFFFFFFF00000000) >> 32;
                 uint32_t lsw_id = (uint64_t) id & 0x00000000FFFFFFFF;
                 cont = dispatcher_requests[cpu_nr_].rnbl;
+                preempt_cnt = 0;
+                preempt_pending = false;
                 getcontext_fast(cont);
                 set_context_link(cont, &uctx_main);
-                makecontext(cont, (void (*)(void)) generic_work, 4, msw, lsw,
-                            msw_id, lsw_id);
+                makecontext(cont, (void (*)(void)) run_handler, 6, msw, lsw,
+                            msw_id, lsw_id, (uint32_t) type << 24 |
+                            (uint32_t) tcp_frame_is_req(pkt) << 23 | len,
+                            msg_id);
                 finished = false;
                 ret = swapcontext_very_fast(&uctx_main, cont);
                 if (ret) {
@@ -234,9 +577,45 @@ static inline void handle_context(void)
         }
 }
 
+/**
+ * tx_delay_budget - how much longer queued responses may wait
+ */
+static inline unsigned long tx_delay_budget(void)
+{
+        if (tx_max_delay <= loop_cycles)
+                return 0;
+        return tx_max_delay - loop_cycles;
+}
+
 static inline void handle_request(void)
 {
-        while (dispatcher_requests[cpu_nr_].flag == WAITING);
+        bool reclaimed = false;
+        unsigned long idle_start = 0;
+
+        arp_process_parked();
+        coalesce_flush_expired();
+        eth_process_send_batched(tx_delay_budget());
+        eth_process_reclaim_lazy();
+
+        while (dispatcher_requests[cpu_nr_].flag == WAITING) {
+                /* parked packets may be released while waiting */
+                arp_process_parked();
+                coalesce_flush_expired();
+                if (eth_process_send_batched(tx_delay_budget())) {
+                        continue;
+                } else if (!reclaimed) {
+                        /* idle: release what the device is done with */
+                        eth_process_reclaim();
+                        mempool_flush_remote_percpu();
+                        reclaimed = true;
+                        idle_start = rdtsc();
+                } else if (idle_cycles &&
+                           rdtsc() - idle_start > idle_cycles) {
+                        /* still idle: sleep until the dispatcher writes */
+                        idle_wait(&dispatcher_requests[cpu_nr_].flag,
+                                  WAITING);
+                }
+        }
         dispatcher_requests[cpu_nr_].flag = WAITING;
         if (dispatcher_requests[cpu_nr_].category == PACKET)
                 handle_new_packet();
@@ -246,29 +625,56 @@ static inline void handle_request(void)
 
 static inline void finish_request(void)
 {
-        worker_responses[cpu_nr_].timestamp = \
-                        dispatcher_requests[cpu_nr_].timestamp;
-        worker_responses[cpu_nr_].type = \
-                        dispatcher_requests[cpu_nr_].type;
-        worker_responses[cpu_nr_].mbuf = \
-                        dispatcher_requests[cpu_nr_].mbuf;
-        worker_responses[cpu_nr_].rnbl = cont;
-        worker_responses[cpu_nr_].category = CONTEXT;
+        struct mbuf * pkt = (struct mbuf *) dispatcher_requests[cpu_nr_].mbuf;
+        uint8_t category = CONTEXT;
+
         if (finished) {
-                worker_responses[cpu_nr_].flag = FINISHED;
+                if (pkt && tcp_frame_is_req(pkt)) {
+                        /* tells the networker to release the next request */
+                        struct mbuf * next = pkt->next;
+                        tcp_conn_done(&tcp_rings[cpu_nr_], pkt);
+                        pkt = next;
+                } else if (pkt && batch_is_req(pkt)) {
+                        /* the last request of the datagram returns it */
+                        if (!batch_release(pkt))
+                                pkt = NULL;
+                } else if (CFG.msg_layer && pkt) {
+                        msg_release(pkt);
+                }
+                /* replies to outbound calls are chained to the request */
+                while (pkt) {
+                        struct mbuf * next = pkt->next;
+                        mbuf_ring_put(&mbuf_rings[cpu_nr_], pkt);
+                        pkt = next;
+                }
+                worker_respond(cpu_nr_, cont, NULL, category, FINISHED);
         } else {
-                worker_responses[cpu_nr_].flag = PREEMPTED;
+                if (parked_call >= 0) {
+                        category = PARKED;
+                        worker_responses[cpu_nr_].call = parked_call;
+                        parked_call = -1;
+                }
+                worker_respond(cpu_nr_, cont,
+                               dispatcher_requests[cpu_nr_].mbuf, category,
+                               PREEMPTED);
         }
 }
 
 void do_work(void)
 {
+        unsigned long now, last;
+
         init_worker();
         log_info("do_work: Waiting for dispatcher work\n");
 
+        tx_max_delay = (unsigned long) CFG.tx_batch_us * cycles_per_us;
+        last = rdtsc();
         while (true) {
-                eth_process_reclaim();
-                eth_process_send();
+                now = rdtsc();
+                loop_cycles += ((long) (now - last) - (long) loop_cycles) >>
+                               LOOP_CYCLES_SHIFT;
+                last = now;
+
                 handle_request();
                 finish_request();
         }
@@ -21,6 +21,9 @@
  * THE SOFTWARE.
  */
 
+/* For ENOTSUP */
+#include <errno.h>
+
 /* For memmove and size_t */
 #include <string.h>
 
@@ -77,6 +80,7 @@
 #include <ix/ethdev.h>
 #include <ix/dpdk.h>
 #include <ix/drivers.h>
+#include <ix/log.h>
 
 struct rte_eth_rxconf rx_conf;
 struct rte_eth_txconf tx_conf;
@@ -276,6 +280,14 @@ int driver_init(struct pci_dev *pci_dev, struct ix_rte_eth_dev **ethp)
 	if (ret < 0)
 		return ret;
 
+	/* only ixgbe takes the wildcard mask from fdir_conf; i40e ignores it
+	 * and would never match a steering rule */
+	if (CFG.rx_steering && strcmp(driver->name, "rte_ixgbe_pmd")) {
+		log_err("driver: rx_steering is not supported by %s\n",
+			driver->name);
+		return -ENOTSUP;
+	}
+
 	rte_eth_dev_info_get(port, &dev_info);
 
 	rx_conf = dev_info.default_rxconf;
@@ -299,6 +311,11 @@ int driver_init(struct pci_dev *pci_dev, struct ix_rte_eth_dev **ethp)
 	conf.fdir_conf.mask.mac_addr_byte_mask = 0;
 	conf.fdir_conf.mask.tunnel_type_mask = 0;
 	conf.fdir_conf.mask.tunnel_id_mask = 0;
+	if (CFG.rx_steering) {
+		/* steering rules match requests of a type from any client */
+		conf.fdir_conf.mask.ipv4_mask.src_ip = 0;
+		conf.fdir_conf.mask.src_port_mask = 0;
+	}
 	conf.fdir_conf.drop_queue = 127;
 	conf.fdir_conf.flex_conf.nb_payloads = 0;
 	conf.fdir_conf.flex_conf.nb_flexmasks = 0;
@@ -369,7 +386,17 @@ static void init_filter(struct rte_eth_fdir_filter *filter, struct rte_fdir_filt
 	memset(filter, 0, sizeof(*filter));
 
 	assert(in->iptype == RTE_FDIR_IPTYPE_IPV4);
-	assert(in->l4type == RTE_FDIR_L4TYPE_TCP);
+	assert(in->l4type == RTE_FDIR_L4TYPE_TCP ||
+	       in->l4type == RTE_FDIR_L4TYPE_UDP);
+
+	if (in->l4type == RTE_FDIR_L4TYPE_UDP) {
+		filter->input.flow_type = RTE_ETH_FLOW_NONFRAG_IPV4_UDP;
+		filter->input.flow.udp4_flow.ip.src_ip = ntoh32(in->ip_src.ipv4_addr);
+		filter->input.flow.udp4_flow.ip.dst_ip = ntoh32(in->ip_dst.ipv4_addr);
+		filter->input.flow.udp4_flow.src_port = hton16(in->port_src);
+		filter->input.flow.udp4_flow.dst_port = hton16(in->port_dst);
+		return;
+	}
 
 	filter->input.flow_type = RTE_ETH_FLOW_NONFRAG_IPV4_TCP;
 	filter->input.flow.tcp4_flow.ip.src_ip = ntoh32(in->ip_src.ipv4_addr);
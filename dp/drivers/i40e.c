@@ -30,6 +30,8 @@
 /* For pipe */
 #include <unistd.h>
 
+#include <emmintrin.h>
+
 /* General DPDK includes */
 #include <rte_config.h>
 #include <rte_ethdev.h>
@@ -71,6 +73,7 @@
 #undef LIST_HEAD
 #undef PKT_TX_IP_CKSUM
 #undef PKT_TX_TCP_CKSUM
+#undef PKT_TX_UDP_CKSUM
 #undef VMDQ_DCB
 #undef likely
 #undef mb
@@ -93,6 +96,8 @@
 
 #define I40E_RING_BASE_ALIGN 128
 #define I40E_RDT_THRESH 32
+#define I40E_RX_VEC_BATCH 4
+#define I40E_TX_FREE_BATCH 32
 #define I40E_TX_MAX_BURST  32
 #define DEFAULT_TX_FREE_THRESH 32
 #define DEFAULT_TX_RS_THRESH 32
@@ -332,6 +337,111 @@ static int reta_update(struct ix_rte_eth_dev *dev, struct rte_eth_rss_reta *reta
 	return 0;
 }
 
+/**
+ * i40e_rx_poll_vec - receives up to I40E_RX_VEC_BATCH packets at once
+ * @rx: the RX queue
+ * @timestamp: the receive timestamp
+ *
+ * The status and error bits of the whole batch are tested with SSE2 and
+ * the lengths and RSS hashes are extracted in bulk. The batch must not
+ * wrap around the end of the ring.
+ *
+ * Returns the number of descriptors consumed, or -ENOMEM if replacement
+ * mbufs could not be allocated.
+ */
+static int i40e_rx_poll_vec(struct eth_rx_queue *rx, long timestamp)
+{
+	struct rx_queue *rxq = eth_rx_queue_to_drv(rx);
+	unsigned int idx = rxq->head & (rxq->len - 1);
+	volatile union i40e_rx_desc *rxdp = &((volatile union i40e_rx_desc *)rxq->ring)[idx];
+	struct rx_entry *rxqe = &rxq->ring_entries[idx];
+	struct mbuf *new_bufs[I40E_RX_VEC_BATCH];
+	uint32_t qw1_hi[I40E_RX_VEC_BATCH], rss[I40E_RX_VEC_BATCH];
+	__m128i d0, d1, d2, d3, lo01, lo23, hi01, hi23, st;
+	const __m128i dd_bit = _mm_set1_epi32(1 << I40E_RX_DESC_STATUS_DD_SHIFT);
+	const __m128i flm_bit = _mm_set1_epi32(1 << I40E_RX_DESC_STATUS_FLM_SHIFT);
+	const __m128i err_bits = _mm_set1_epi32(((1 << I40E_RX_DESC_ERROR_IPE_SHIFT) |
+						 (1 << I40E_RX_DESC_ERROR_L4E_SHIFT)) <<
+						I40E_RXD_QW1_ERROR_SHIFT);
+	int i, nb, dd_mask, err_mask, flm_mask;
+	machaddr_t maddr;
+	struct mbuf *b;
+
+	/*
+	 * Read back to front: the NIC writes descriptors back in order, so if
+	 * a later descriptor is done, the earlier ones are complete as well.
+	 * Only the first 16 bytes (qword0 and qword1) are needed.
+	 */
+	d3 = _mm_loadu_si128((__m128i *) &rxdp[3]);
+	rte_compiler_barrier();
+	d2 = _mm_loadu_si128((__m128i *) &rxdp[2]);
+	rte_compiler_barrier();
+	d1 = _mm_loadu_si128((__m128i *) &rxdp[1]);
+	rte_compiler_barrier();
+	d0 = _mm_loadu_si128((__m128i *) &rxdp[0]);
+
+	/* lanes: lo = qword0 {l2tag1, rss}, hi = qword1 {status/error, length} */
+	lo01 = _mm_unpacklo_epi64(d0, d1);
+	lo23 = _mm_unpacklo_epi64(d2, d3);
+	hi01 = _mm_unpackhi_epi64(d0, d1);
+	hi23 = _mm_unpackhi_epi64(d2, d3);
+	st = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(hi01),
+					     _mm_castsi128_ps(hi23),
+					     _MM_SHUFFLE(2, 0, 2, 0)));
+	_mm_storeu_si128((__m128i *) qw1_hi,
+			 _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(hi01),
+							 _mm_castsi128_ps(hi23),
+							 _MM_SHUFFLE(3, 1, 3, 1))));
+	_mm_storeu_si128((__m128i *) rss,
+			 _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo01),
+							 _mm_castsi128_ps(lo23),
+							 _MM_SHUFFLE(3, 1, 3, 1))));
+
+	dd_mask = _mm_movemask_ps(_mm_castsi128_ps(
+			_mm_cmpeq_epi32(_mm_and_si128(st, dd_bit), dd_bit)));
+	nb = __builtin_ctz(~dd_mask);
+	if (!nb)
+		return 0;
+
+	err_mask = ~_mm_movemask_ps(_mm_castsi128_ps(
+			_mm_cmpeq_epi32(_mm_and_si128(st, err_bits),
+					_mm_setzero_si128())));
+	flm_mask = _mm_movemask_ps(_mm_castsi128_ps(
+			_mm_cmpeq_epi32(_mm_and_si128(st, flm_bit), flm_bit)));
+
+	if (unlikely(mbuf_alloc_bulk_local(new_bufs, nb))) {
+		log_err("i40e: unable to allocate RX mbufs\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nb; i++) {
+		b = rxqe[i].mbuf;
+		b->len = (((uint64_t) le32_to_cpu(qw1_hi[i]) << 32) &
+			  I40E_RXD_QW1_LENGTH_PBUF_MASK) >>
+			 I40E_RXD_QW1_LENGTH_PBUF_SHIFT;
+		if (flm_mask & (1 << i)) {
+			b->fg_id = MBUF_INVALID_FG_ID;
+		} else {
+			b->fg_id = rx->dev->data->rx_fgs[le32_to_cpu(rss[i]) &
+					(rx->dev->data->nb_rx_fgs - 1)].fg_id;
+		}
+		b->timestamp = timestamp;
+
+		maddr = mbuf_get_data_machaddr(new_bufs[i]);
+		rxqe[i].mbuf = new_bufs[i];
+		rxdp[i].read.hdr_addr = rte_cpu_to_le_64(maddr);
+		rxdp[i].read.pkt_addr = rte_cpu_to_le_64(maddr);
+
+		if (unlikely((err_mask & (1 << i)) || eth_recv(rx, b))) {
+			log_info("i40e: dropping packet\n");
+			mbuf_free(b);
+		}
+	}
+
+	rxq->head += nb;
+	return nb;
+}
+
 static int i40e_rx_poll(struct eth_rx_queue *rx)
 {
 	struct rx_queue *rxq = eth_rx_queue_to_drv(rx);
@@ -343,13 +453,24 @@ static int i40e_rx_poll(struct eth_rx_queue *rx)
 	struct mbuf *b, *new_b;
 	struct rx_entry *rxqe;
 	machaddr_t maddr;
-	int nb_descs = 0;
+	int nb_descs = 0, ret;
 	bool valid_checksum;
 	int local_fg_id;
 	long timestamp;
 
 	timestamp = rdtsc();
 	while (1) {
+		if ((rxq->head & (rxq->len - 1)) <= rxq->len - I40E_RX_VEC_BATCH) {
+			ret = i40e_rx_poll_vec(rx, timestamp);
+			if (ret < 0)
+				goto out;
+			nb_descs += ret;
+			if (ret < I40E_RX_VEC_BATCH)
+				break;
+			continue;
+		}
+
+		/* handle the descriptors left before the ring wraps */
 		rxdp = &((volatile union i40e_rx_desc *)rxq->ring)[rxq->head & (rxq->len - 1)];
 		qword1 = rte_le_to_cpu_64(rxdp->wb.qword1.status_error_len);
 		rx_status = (qword1 & I40E_RXD_QW1_STATUS_MASK) >> I40E_RXD_QW1_STATUS_SHIFT;
@@ -537,7 +658,8 @@ static int i40e_tx_reclaim(struct eth_tx_queue *tx)
 	struct tx_queue *txq = eth_tx_queue_to_drv(tx);
 	struct tx_entry *txe;
 	volatile struct i40e_tx_desc *txdp;
-	int idx = 0, nb_desc = 0;
+	struct mbuf *done[I40E_TX_FREE_BATCH];
+	int idx = 0, nb_desc = 0, nb_done = 0;
 
 	while ((uint16_t)(txq->head + idx) != txq->tail) {
 		txe = &txq->ring_entries[(txq->head + idx) & (txq->len - 1)];
@@ -553,12 +675,21 @@ static int i40e_tx_reclaim(struct eth_tx_queue *tx)
 				rte_cpu_to_le_64(I40E_TX_DESC_DTYPE_DESC_DONE))
 			break;
 
-		mbuf_xmit_done(txe->mbuf);
+		/* plain mbufs are returned to the mempool in bulk */
+		if (txe->mbuf->done == &mbuf_default_done) {
+			done[nb_done++] = txe->mbuf;
+			if (nb_done == I40E_TX_FREE_BATCH) {
+				mbuf_free_bulk(done, nb_done);
+				nb_done = 0;
+			}
+		} else
+			mbuf_xmit_done(txe->mbuf);
 		txe->mbuf = NULL;
 		idx++;
 		nb_desc = idx;
 	}
 
+	mbuf_free_bulk(done, nb_done);
 	txq->head += nb_desc;
 	return (uint16_t)(txq->len + txq->head - txq->tail);
 }
@@ -570,9 +701,15 @@ i40e_txd_enable_checksum(uint64_t ol_flags,
 			union i40e_tx_offload tx_offload,
 			uint32_t *cd_tunneling)
 {
-		*td_cmd |= I40E_TX_DESC_CMD_L4T_EOFT_TCP;
-		*td_offset |= (sizeof(struct tcp_hdr) >> 2) <<
-				I40E_TX_DESC_LENGTH_L4_FC_LEN_SHIFT;
+		if (ol_flags & PKT_TX_UDP_CKSUM) {
+			*td_cmd |= I40E_TX_DESC_CMD_L4T_EOFT_UDP;
+			*td_offset |= (sizeof(struct udp_hdr) >> 2) <<
+					I40E_TX_DESC_LENGTH_L4_FC_LEN_SHIFT;
+		} else {
+			*td_cmd |= I40E_TX_DESC_CMD_L4T_EOFT_TCP;
+			*td_offset |= (sizeof(struct tcp_hdr) >> 2) <<
+					I40E_TX_DESC_LENGTH_L4_FC_LEN_SHIFT;
+		}
 
 		*td_cmd |= I40E_TX_DESC_CMD_IIPT_IPV4_CSUM;
 		*td_offset |= (20 >> 2) << I40E_TX_DESC_LENGTH_IPLEN_SHIFT;
@@ -603,7 +740,7 @@ static int i40e_tx_xmit_one(struct tx_queue *txq, struct mbuf *mbuf)
 
 	/* Enable checksum offloading */
 	uint32_t cd_tunneling_params = 0;
-	if (ol_flags & PKT_TX_TCP_CKSUM) {
+	if (ol_flags & (PKT_TX_TCP_CKSUM | PKT_TX_UDP_CKSUM)) {
 		i40e_txd_enable_checksum(ol_flags, &td_cmd, &td_offset, tx_offload, &cd_tunneling_params);
 	}
 
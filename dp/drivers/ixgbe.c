@@ -30,6 +30,8 @@
 /* For pipe */
 #include <unistd.h>
 
+#include <emmintrin.h>
+
 /* General DPDK includes */
 #include <rte_config.h>
 #include <rte_ethdev.h>
@@ -67,6 +69,7 @@
 #undef LIST_HEAD
 #undef PKT_TX_IP_CKSUM
 #undef PKT_TX_TCP_CKSUM
+#undef PKT_TX_UDP_CKSUM
 #undef VMDQ_DCB
 #undef likely
 #undef mb
@@ -88,6 +91,12 @@
 #define IXGBE_MAX_RING_DESC	4096
 
 #define IXGBE_RDT_THRESH	32
+#define IXGBE_RX_VEC_BATCH	4
+#define IXGBE_TX_FREE_BATCH	32
+
+/* the TX context descriptor slots programmed at start */
+#define IXGBE_TX_CTX_TCP	0
+#define IXGBE_TX_CTX_UDP	1
 
 struct rx_entry {
 	struct mbuf *mbuf;
@@ -176,8 +185,9 @@ static int dev_start(struct ix_rte_eth_dev *dev)
 		IXGBE_WRITE_REG(hw, IXGBE_TDBAH(txq->reg_idx), (uint32_t)(txq->ring_physaddr >> 32));
 		IXGBE_WRITE_REG(hw, IXGBE_TDLEN(txq->reg_idx), txq->len * sizeof(union ixgbe_adv_tx_desc));
 
-		/* setup context descriptor 0 for IP/TCP checksums */
-		ixgbe_tx_xmit_ctx(txq, PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM, 0);
+		/* setup context descriptors 0 and 1 for IP/TCP and IP/UDP checksums */
+		ixgbe_tx_xmit_ctx(txq, PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM, IXGBE_TX_CTX_TCP);
+		ixgbe_tx_xmit_ctx(txq, PKT_TX_IP_CKSUM | PKT_TX_UDP_CKSUM, IXGBE_TX_CTX_UDP);
 	}
 
 	return 0;
@@ -216,8 +226,9 @@ static int dev_start_vf(struct ix_rte_eth_dev *dev)
 		IXGBE_WRITE_REG(hw, IXGBE_VFTDBAH(i), (uint32_t)(txq->ring_physaddr >> 32));
 		IXGBE_WRITE_REG(hw, IXGBE_VFTDLEN(i), txq->len * sizeof(union ixgbe_adv_tx_desc));
 
-		/* setup context descriptor 0 for IP/TCP checksums */
-		ixgbe_tx_xmit_ctx(txq, PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM, 0);
+		/* setup context descriptors 0 and 1 for IP/TCP and IP/UDP checksums */
+		ixgbe_tx_xmit_ctx(txq, PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM, IXGBE_TX_CTX_TCP);
+		ixgbe_tx_xmit_ctx(txq, PKT_TX_IP_CKSUM | PKT_TX_UDP_CKSUM, IXGBE_TX_CTX_UDP);
 	}
 
 	return 0;
@@ -283,6 +294,107 @@ fail:
 	return -ENOMEM;
 }
 
+/**
+ * ixgbe_rx_poll_vec - receives up to IXGBE_RX_VEC_BATCH packets at once
+ * @rx: the RX queue
+ * @timestamp: the receive timestamp
+ *
+ * The DD, checksum and flow director bits of the whole batch are tested
+ * with SSE2 and the lengths and RSS hashes are extracted in bulk. The batch
+ * must not wrap around the end of the ring.
+ *
+ * Returns the number of descriptors consumed, or -ENOMEM if replacement
+ * mbufs could not be allocated.
+ */
+static int ixgbe_rx_poll_vec(struct eth_rx_queue *rx, long timestamp)
+{
+	struct rx_queue *rxq = eth_rx_queue_to_drv(rx);
+	unsigned int idx = rxq->head & (rxq->len - 1);
+	volatile union ixgbe_adv_rx_desc *rxdp = &rxq->ring[idx];
+	struct rx_entry *rxqe = &rxq->ring_entries[idx];
+	struct mbuf *new_bufs[IXGBE_RX_VEC_BATCH];
+	uint32_t lens[IXGBE_RX_VEC_BATCH], rss[IXGBE_RX_VEC_BATCH];
+	__m128i d0, d1, d2, d3, lo01, lo23, hi01, hi23, st, err;
+	const __m128i dd_bit = _mm_set1_epi32(IXGBE_RXDADV_STAT_DD);
+	const __m128i flm_bit = _mm_set1_epi32(IXGBE_RXDADV_STAT_FLM);
+	const __m128i ip_err = _mm_set1_epi32(IXGBE_RXD_STAT_IPCS | IXGBE_RXDADV_ERR_IPE);
+	const __m128i l4_err = _mm_set1_epi32(IXGBE_RXD_STAT_L4CS | IXGBE_RXDADV_ERR_TCPE);
+	int i, nb, dd_mask, err_mask, flm_mask;
+	machaddr_t maddr;
+	struct mbuf *b;
+
+	/*
+	 * Read back to front: the NIC writes descriptors back in order, so if
+	 * a later descriptor is done, the earlier ones are complete as well.
+	 */
+	d3 = _mm_loadu_si128((__m128i *) &rxdp[3]);
+	rte_compiler_barrier();
+	d2 = _mm_loadu_si128((__m128i *) &rxdp[2]);
+	rte_compiler_barrier();
+	d1 = _mm_loadu_si128((__m128i *) &rxdp[1]);
+	rte_compiler_barrier();
+	d0 = _mm_loadu_si128((__m128i *) &rxdp[0]);
+
+	/* lanes: lo = {pkt_info, rss}, hi = {status_error, length | vlan} */
+	lo01 = _mm_unpacklo_epi64(d0, d1);
+	lo23 = _mm_unpacklo_epi64(d2, d3);
+	hi01 = _mm_unpackhi_epi64(d0, d1);
+	hi23 = _mm_unpackhi_epi64(d2, d3);
+	st = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(hi01),
+					     _mm_castsi128_ps(hi23),
+					     _MM_SHUFFLE(2, 0, 2, 0)));
+	_mm_storeu_si128((__m128i *) lens,
+			 _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(hi01),
+							 _mm_castsi128_ps(hi23),
+							 _MM_SHUFFLE(3, 1, 3, 1))));
+	_mm_storeu_si128((__m128i *) rss,
+			 _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo01),
+							 _mm_castsi128_ps(lo23),
+							 _MM_SHUFFLE(3, 1, 3, 1))));
+
+	dd_mask = _mm_movemask_ps(_mm_castsi128_ps(
+			_mm_cmpeq_epi32(_mm_and_si128(st, dd_bit), dd_bit)));
+	nb = __builtin_ctz(~dd_mask);
+	if (!nb)
+		return 0;
+
+	err = _mm_or_si128(_mm_cmpeq_epi32(_mm_and_si128(st, ip_err), ip_err),
+			   _mm_cmpeq_epi32(_mm_and_si128(st, l4_err), l4_err));
+	err_mask = _mm_movemask_ps(_mm_castsi128_ps(err));
+	flm_mask = _mm_movemask_ps(_mm_castsi128_ps(
+			_mm_cmpeq_epi32(_mm_and_si128(st, flm_bit), flm_bit)));
+
+	if (unlikely(mbuf_alloc_bulk_local(new_bufs, nb))) {
+		log_err("ixgbe: unable to allocate RX mbufs\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nb; i++) {
+		b = rxqe[i].mbuf;
+		b->len = le32_to_cpu(lens[i]) & 0xFFFF;
+		if (flm_mask & (1 << i)) {
+			b->fg_id = MBUF_INVALID_FG_ID;
+		} else {
+			b->fg_id = rx->dev->data->rx_fgs[le32_to_cpu(rss[i]) &
+					(rx->dev->data->nb_rx_fgs - 1)].fg_id;
+		}
+		b->timestamp = timestamp;
+
+		maddr = mbuf_get_data_machaddr(new_bufs[i]);
+		rxqe[i].mbuf = new_bufs[i];
+		rxdp[i].read.hdr_addr = cpu_to_le32(maddr);
+		rxdp[i].read.pkt_addr = cpu_to_le32(maddr);
+
+		if (unlikely((err_mask & (1 << i)) || eth_recv(rx, b))) {
+			log_debug("ixgbe: dropping packet\n");
+			mbuf_free(b);
+		}
+	}
+
+	rxq->head += nb;
+	return nb;
+}
+
 static int ixgbe_rx_poll(struct eth_rx_queue *rx)
 {
 	struct rx_queue *rxq = eth_rx_queue_to_drv(rx);
@@ -292,13 +404,25 @@ static int ixgbe_rx_poll(struct eth_rx_queue *rx)
 	struct rx_entry *rxqe;
 	machaddr_t maddr;
 	uint32_t status;
-	int nb_descs = 0;
+	int nb_descs = 0, ret;
 	bool valid_checksum;
 	int local_fg_id;
 	long timestamp;
 
 	timestamp = rdtsc();
 	while (1) {
+		if ((rxq->head & (rxq->len - 1)) <=
+		    rxq->len - IXGBE_RX_VEC_BATCH) {
+			ret = ixgbe_rx_poll_vec(rx, timestamp);
+			if (ret < 0)
+				goto out;
+			nb_descs += ret;
+			if (ret < IXGBE_RX_VEC_BATCH)
+				break;
+			continue;
+		}
+
+		/* handle the descriptors left before the ring wraps */
 		rxdp = &rxq->ring[rxq->head & (rxq->len - 1)];
 		status = le32_to_cpu(rxdp->wb.upper.status_error);
 		valid_checksum = true;
@@ -476,7 +600,8 @@ static int ixgbe_tx_reclaim(struct eth_tx_queue *tx)
 	struct tx_queue *txq = eth_tx_queue_to_drv(tx);
 	struct tx_entry *txe;
 	volatile union ixgbe_adv_tx_desc *txdp;
-	int idx = 0, nb_desc = 0;
+	struct mbuf *done[IXGBE_TX_FREE_BATCH];
+	int idx = 0, nb_desc = 0, nb_done = 0;
 
 	while ((uint16_t)(txq->head + idx) != txq->tail) {
 		txe = &txq->ring_entries[(txq->head + idx) & (txq->len - 1)];
@@ -490,12 +615,21 @@ static int ixgbe_tx_reclaim(struct eth_tx_queue *tx)
 		if (!(le32_to_cpu(txdp->wb.status) & IXGBE_TXD_STAT_DD))
 			break;
 
-		mbuf_xmit_done(txe->mbuf);
+		/* plain mbufs are returned to the mempool in bulk */
+		if (txe->mbuf->done == &mbuf_default_done) {
+			done[nb_done++] = txe->mbuf;
+			if (nb_done == IXGBE_TX_FREE_BATCH) {
+				mbuf_free_bulk(done, nb_done);
+				nb_done = 0;
+			}
+		} else
+			mbuf_xmit_done(txe->mbuf);
 		txe->mbuf = NULL;
 		idx++;
 		nb_desc = idx;
 	}
 
+	mbuf_free_bulk(done, nb_done);
 	txq->head += nb_desc;
 	return (uint16_t)(txq->len + txq->head - txq->tail);
 }
@@ -529,6 +663,10 @@ static int ixgbe_tx_xmit_ctx(struct tx_queue *txq, int ol_flags, int ctx_idx)
 		type_tucmd_mlhl |= IXGBE_ADVTXD_TUCMD_L4T_TCP;
 	}
 
+	if (ol_flags & PKT_TX_UDP_CKSUM) {
+		type_tucmd_mlhl |= IXGBE_ADVTXD_TUCMD_L4T_UDP;
+	}
+
 	/* Set context idx. MSS and L4LEN ignored if no LSO */
 	mss_l4len_idx = ctx_idx << IXGBE_ADVTXD_IDX_SHIFT;
 
@@ -576,7 +714,8 @@ static int ixgbe_tx_xmit_one(struct tx_queue *txq, struct mbuf *mbuf)
 
 	/*
 	 * Check mbuf's offload flags
-	 * If flags match context 0 on NIC (IP and TCP chksum), use context
+	 * If flags match context 0 (IP and TCP chksum) or context 1 (IP and
+	 * UDP chksum) on the NIC, use that context
 	 * Otherwise, no context
 	 */
 	if ((mbuf->ol_flags & PKT_TX_IP_CKSUM) &&
@@ -584,6 +723,12 @@ static int ixgbe_tx_xmit_one(struct tx_queue *txq, struct mbuf *mbuf)
 		olinfo_status |= IXGBE_ADVTXD_POPTS_IXSM;
 		olinfo_status |= IXGBE_ADVTXD_POPTS_TXSM;
 		olinfo_status |= IXGBE_ADVTXD_CC;
+	} else if ((mbuf->ol_flags & PKT_TX_IP_CKSUM) &&
+		   (mbuf->ol_flags & PKT_TX_UDP_CKSUM)) {
+		olinfo_status |= IXGBE_ADVTXD_POPTS_IXSM;
+		olinfo_status |= IXGBE_ADVTXD_POPTS_TXSM;
+		olinfo_status |= IXGBE_ADVTXD_CC;
+		olinfo_status |= IXGBE_TX_CTX_UDP << IXGBE_ADVTXD_IDX_SHIFT;
 	}
 
 	for (i = 0; i < nr_iov; i++) {
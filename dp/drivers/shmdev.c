@@ -0,0 +1,436 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * shmdev.c - a software ethernet device backed by shared memory
+ *
+ * Frames are copied between mbufs and the slots of the shared rings, see
+ * shmdev.h. The copy takes the place of DMA, and the checksums the NIC
+ * would compute or verify are done in software. Sent mbufs are complete
+ * as soon as they are copied, so reclaiming only looks for free slots.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <ix/stddef.h>
+#include <ix/byteorder.h>
+#include <ix/drivers.h>
+#include <ix/ethdev.h>
+#include <ix/log.h>
+#include <ix/mbuf.h>
+#include <ix/shmdev.h>
+
+#include <asm/chksum.h>
+
+#include <net/ethernet.h>
+#include <net/ip.h>
+#include <net/udp.h>
+
+#define SHMDEV_RX_BATCH		32
+#define SHMDEV_LINK_SPEED	10000
+/* offset of the checksum in the TCP header */
+#define SHMDEV_TCP_CHKSUM_OFF	16
+
+struct shmdev {
+	struct shmdev_region *region;
+};
+
+#define eth_dev_to_shm(dev) ((struct shmdev *) (dev)->data->dev_private)
+
+struct shm_rx_queue {
+	struct eth_rx_queue	erxq;
+	struct shmdev_ring	*ring;
+};
+
+#define eth_rx_queue_to_shm(rxq) container_of(rxq, struct shm_rx_queue, erxq)
+
+struct shm_tx_queue {
+	struct eth_tx_queue	etxq;
+	struct shmdev_ring	*ring;
+};
+
+#define eth_tx_queue_to_shm(txq) container_of(txq, struct shm_tx_queue, etxq)
+
+static int nr_shmdevs;
+
+/**
+ * shmdev_rx_chksum_ok - verifies the IP header checksum of a frame
+ * @b: the received frame
+ *
+ * Returns false if the frame should be dropped.
+ */
+static bool shmdev_rx_chksum_ok(struct mbuf *b)
+{
+	struct eth_hdr *ethhdr = mbuf_mtod(b, struct eth_hdr *);
+	struct ip_hdr *iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
+
+	if (ethhdr->type != hton16(ETHTYPE_IP))
+		return true;
+	if (b->len < sizeof(struct eth_hdr) + sizeof(struct ip_hdr) ||
+	    b->len < sizeof(struct eth_hdr) + iphdr->header_len * 4)
+		return false;
+
+	return !chksum_internet((void *) iphdr, iphdr->header_len * 4);
+}
+
+static int shmdev_rx_poll(struct eth_rx_queue *rx)
+{
+	struct shm_rx_queue *rxq = eth_rx_queue_to_shm(rx);
+	struct shmdev_ring *r = rxq->ring;
+	struct shmdev_slot *slot;
+	uint32_t tail = r->tail, head = r->head;
+	struct mbuf *b;
+	uint32_t len;
+	long timestamp;
+	int nb = 0;
+
+	/* the slots must not be read before head */
+	asm volatile("" ::: "memory");
+
+	timestamp = rdtsc();
+	while (tail != head && nb < SHMDEV_RX_BATCH) {
+		slot = &r->slots[tail & (SHMDEV_RING_SIZE - 1)];
+		/* the peer may rewrite the slot, so read the length once */
+		len = *(volatile uint32_t *) &slot->len;
+		if (unlikely(len > SHMDEV_FRAME_MAX)) {
+			log_debug("shmdev: dropping oversized packet\n");
+			tail++;
+			nb++;
+			continue;
+		}
+
+		b = mbuf_alloc_local();
+		if (unlikely(!b)) {
+			log_err("shmdev: unable to allocate RX mbuf\n");
+			break;
+		}
+
+		b->len = len;
+		memcpy(mbuf_mtod(b, void *), slot->data, len);
+		b->fg_id = rx->dev->data->rx_fgs[0].fg_id;
+		b->timestamp = timestamp;
+		tail++;
+		nb++;
+
+		if (unlikely(!shmdev_rx_chksum_ok(b) || eth_recv(rx, b))) {
+			log_debug("shmdev: dropping packet\n");
+			mbuf_free(b);
+		}
+	}
+
+	/* the slots must be read before they are handed back */
+	asm volatile("" ::: "memory");
+	r->tail = tail;
+
+	return nb;
+}
+
+static bool shmdev_rx_ready(struct eth_rx_queue *rx)
+{
+	struct shmdev_ring *r = eth_rx_queue_to_shm(rx)->ring;
+
+	return r->head != r->tail;
+}
+
+/**
+ * shmdev_tx_chksum - computes the checksums a NIC would offload
+ * @frame: the frame
+ * @len: the length of the frame
+ * @ol_flags: the offloads requested by the mbuf
+ *
+ * As for the NIC, the L4 checksum field holds the pseudo-header sum on
+ * entry, so summing the segment with it gives the final checksum.
+ */
+static void shmdev_tx_chksum(uint8_t *frame, size_t len, uint16_t ol_flags)
+{
+	struct ip_hdr *iphdr = (struct ip_hdr *) (frame + sizeof(struct eth_hdr));
+	struct udp_hdr *udphdr;
+	uint16_t *tcp_chksum;
+	size_t ip_len, l4_len;
+	uint16_t sum;
+
+	if (!(ol_flags & (PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM | PKT_TX_UDP_CKSUM)))
+		return;
+	if (len < sizeof(struct eth_hdr) + sizeof(struct ip_hdr))
+		return;
+
+	ip_len = iphdr->header_len * 4;
+	if (ol_flags & PKT_TX_IP_CKSUM) {
+		iphdr->chksum = 0;
+		iphdr->chksum = chksum_internet((void *) iphdr, ip_len);
+	}
+
+	l4_len = ntoh16(iphdr->len) - ip_len;
+	if (sizeof(struct eth_hdr) + ip_len + l4_len > len)
+		return;
+
+	if (ol_flags & PKT_TX_UDP_CKSUM) {
+		udphdr = (struct udp_hdr *) ((uint8_t *) iphdr + ip_len);
+		sum = chksum_internet((void *) udphdr, l4_len);
+		/* zero means no checksum for UDP */
+		udphdr->chksum = sum ? sum : 0xFFFF;
+	} else if (ol_flags & PKT_TX_TCP_CKSUM) {
+		tcp_chksum = (uint16_t *) ((uint8_t *) iphdr + ip_len +
+					   SHMDEV_TCP_CHKSUM_OFF);
+		*tcp_chksum = chksum_internet((char *) iphdr + ip_len, l4_len);
+	}
+}
+
+/**
+ * shmdev_tx_copy - gathers an mbuf and its scatter-gather vectors
+ * @slot: the slot to fill
+ * @m: the mbuf
+ *
+ * Returns 0 if successful, otherwise -EINVAL if the frame does not fit.
+ */
+static int shmdev_tx_copy(struct shmdev_slot *slot, struct mbuf *m)
+{
+	size_t len = m->len;
+	unsigned int i;
+
+	if (unlikely(len > SHMDEV_FRAME_MAX))
+		return -EINVAL;
+	memcpy(slot->data, mbuf_mtod(m, void *), len);
+
+	for (i = 0; i < m->nr_iov; i++) {
+		if (unlikely(len + m->iovs[i].len > SHMDEV_FRAME_MAX))
+			return -EINVAL;
+		memcpy(slot->data + len, m->iovs[i].base, m->iovs[i].len);
+		len += m->iovs[i].len;
+	}
+
+	slot->len = len;
+	shmdev_tx_chksum(slot->data, len, m->ol_flags);
+	return 0;
+}
+
+static int shmdev_tx_reclaim(struct eth_tx_queue *tx)
+{
+	struct shmdev_ring *r = eth_tx_queue_to_shm(tx)->ring;
+
+	return SHMDEV_RING_SIZE - (uint32_t) (r->head - r->tail);
+}
+
+static int shmdev_tx_xmit(struct eth_tx_queue *tx, int nr, struct mbuf **mbufs)
+{
+	struct shmdev_ring *r = eth_tx_queue_to_shm(tx)->ring;
+	uint32_t head = r->head;
+	int nb_pkts;
+
+	for (nb_pkts = 0; nb_pkts < nr; nb_pkts++) {
+		if (unlikely(head - r->tail == SHMDEV_RING_SIZE))
+			break;
+
+		if (unlikely(shmdev_tx_copy(&r->slots[head & (SHMDEV_RING_SIZE - 1)],
+					    mbufs[nb_pkts])))
+			log_err("shmdev: dropping oversized packet\n");
+		else
+			head++;
+
+		mbuf_xmit_done(mbufs[nb_pkts]);
+	}
+
+	/* the slots must be written before they are published */
+	asm volatile("" ::: "memory");
+	r->head = head;
+
+	return nb_pkts;
+}
+
+static int shmdev_rx_queue_setup(struct ix_rte_eth_dev *dev, int queue_idx,
+				 int numa_node, uint16_t nb_desc)
+{
+	struct shm_rx_queue *rxq;
+
+	/* a single ring: there is nothing to steer or spread */
+	if (queue_idx)
+		return -EINVAL;
+
+	rxq = calloc(1, sizeof(*rxq));
+	if (!rxq)
+		return -ENOMEM;
+
+	rxq->ring = &eth_dev_to_shm(dev)->region->rx;
+	rxq->erxq.poll = shmdev_rx_poll;
+	rxq->erxq.ready = shmdev_rx_ready;
+	dev->data->rx_queues[queue_idx] = &rxq->erxq;
+	return 0;
+}
+
+static void shmdev_rx_queue_release(struct eth_rx_queue *rx)
+{
+	if (rx)
+		free(eth_rx_queue_to_shm(rx));
+}
+
+static int shmdev_tx_queue_setup(struct ix_rte_eth_dev *dev, int queue_idx,
+				 int numa_node, uint16_t nb_desc)
+{
+	struct shm_tx_queue *txq;
+
+	if (queue_idx >= SHMDEV_MAX_TX_RINGS)
+		return -EMFILE;
+
+	txq = calloc(1, sizeof(*txq));
+	if (!txq)
+		return -ENOMEM;
+
+	txq->ring = &eth_dev_to_shm(dev)->region->tx[queue_idx];
+	txq->etxq.reclaim = shmdev_tx_reclaim;
+	txq->etxq.xmit = shmdev_tx_xmit;
+	dev->data->tx_queues[queue_idx] = &txq->etxq;
+	return 0;
+}
+
+static void shmdev_tx_queue_release(struct eth_tx_queue *tx)
+{
+	if (tx)
+		free(eth_tx_queue_to_shm(tx));
+}
+
+static int shmdev_dev_start(struct ix_rte_eth_dev *dev)
+{
+	struct shmdev_region *region = eth_dev_to_shm(dev)->region;
+
+	region->nr_tx_rings = dev->data->nb_tx_queues;
+	memcpy(region->mac, dev->data->mac_addrs[0].addr, ETH_ADDR_LEN);
+
+	/* the header must be complete before the peer sees it */
+	asm volatile("" ::: "memory");
+	region->magic = SHMDEV_MAGIC;
+	return 0;
+}
+
+static void shmdev_dev_stop(struct ix_rte_eth_dev *dev)
+{
+	/* the peer has to wait for the magic again */
+	eth_dev_to_shm(dev)->region->magic = 0;
+}
+
+static void shmdev_dev_infos_get(struct ix_rte_eth_dev *dev,
+				 struct ix_rte_eth_dev_info *dev_info)
+{
+	dev_info->nb_rx_fgs = 1;
+	dev_info->max_rx_queues = 1;
+	dev_info->max_tx_queues = SHMDEV_MAX_TX_RINGS;
+}
+
+static int shmdev_link_update(struct ix_rte_eth_dev *dev, int wait_to_complete)
+{
+	dev->data->dev_link.link_speed = SHMDEV_LINK_SPEED;
+	dev->data->dev_link.link_duplex = ETH_LINK_FULL_DUPLEX;
+	dev->data->dev_link.link_status = 1;
+	return 0;
+}
+
+static void shmdev_rx_mode_nop(struct ix_rte_eth_dev *dev)
+{
+}
+
+static void shmdev_mac_addr_add(struct ix_rte_eth_dev *dev,
+				struct eth_addr *mac_addr,
+				uint32_t index, uint32_t vmdq)
+{
+	memcpy(&dev->data->mac_addrs[0], mac_addr, ETH_ADDR_LEN);
+	memcpy(eth_dev_to_shm(dev)->region->mac, mac_addr, ETH_ADDR_LEN);
+}
+
+static struct ix_eth_dev_ops shmdev_ops = {
+	.allmulticast_enable = shmdev_rx_mode_nop,
+	.dev_infos_get = shmdev_dev_infos_get,
+	.dev_start = shmdev_dev_start,
+	.dev_stop = shmdev_dev_stop,
+	.link_update = shmdev_link_update,
+	.promiscuous_disable = shmdev_rx_mode_nop,
+	.rx_queue_setup = shmdev_rx_queue_setup,
+	.rx_queue_release = shmdev_rx_queue_release,
+	.tx_queue_setup = shmdev_tx_queue_setup,
+	.tx_queue_release = shmdev_tx_queue_release,
+	.mac_addr_add = shmdev_mac_addr_add,
+};
+
+/**
+ * shmdev_init - creates a shared memory ethernet device
+ * @path: the file backing the rings, created if needed
+ * @ethp: pointer to store the device
+ *
+ * The rings are reset, so a peer left over from an earlier run has to wait
+ * for the magic again.
+ *
+ * Returns 0 if successful, otherwise fail.
+ */
+int shmdev_init(const char *path, struct ix_rte_eth_dev **ethp)
+{
+	struct shmdev_region *region;
+	struct ix_rte_eth_dev *dev;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		log_err("shmdev: unable to open %s\n", path);
+		return -EIO;
+	}
+
+	if (ftruncate(fd, sizeof(struct shmdev_region))) {
+		log_err("shmdev: unable to size %s\n", path);
+		close(fd);
+		return -EIO;
+	}
+
+	region = mmap(NULL, sizeof(struct shmdev_region),
+		      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (region == MAP_FAILED) {
+		log_err("shmdev: unable to map %s\n", path);
+		return -ENOMEM;
+	}
+	memset(region, 0, sizeof(struct shmdev_region));
+
+	dev = eth_dev_alloc(sizeof(struct shmdev));
+	if (!dev)
+		goto err;
+	eth_dev_to_shm(dev)->region = region;
+	dev->dev_ops = &shmdev_ops;
+	spin_lock_init(&dev->lock);
+
+	dev->data->mac_addrs = calloc(1, ETH_ADDR_LEN);
+	if (!dev->data->mac_addrs) {
+		eth_dev_destroy(dev);
+		goto err;
+	}
+	/* locally administered, one per device */
+	dev->data->mac_addrs[0].addr[0] = 0x02;
+	dev->data->mac_addrs[0].addr[5] = ++nr_shmdevs;
+
+	*ethp = dev;
+	return 0;
+
+err:
+	munmap(region, sizeof(struct shmdev_region));
+	return -ENOMEM;
+}
@@ -62,6 +62,7 @@ struct pending_pkt {
 };
 
 struct arp_entry {
+	volatile uint32_t	seq;	/* odd while being updated */
 	struct ip_addr		addr;
 	struct eth_addr		mac;
 	uint8_t			flags;
@@ -69,17 +70,32 @@ struct arp_entry {
 	struct timer		timer;
 	struct hlist_node	link;
 	struct hlist_head 	pending_pkts;
+	bool			queued;	/* on arp_reqs */
+	struct arp_entry	*next_req;
+	bool			dead;	/* on arp_dead */
+	struct arp_entry	*next_dead;
 };
 
+/* serializes all updates of the table; lookups take no lock */
 static DEFINE_SPINLOCK(arp_lock);
 
 static DEFINE_SPINLOCK(pending_pkt_lock);
 
-static DEFINE_SPINLOCK(arp_send_pkt_lock);
+/*
+ * Entries other cores failed to resolve, protected by arp_lock. Only the
+ * networker sends ARP requests and runs the ARP timers, so that they all
+ * stay on its timer wheel; see arp_process_requests().
+ */
+static struct arp_entry *volatile arp_reqs;
+
+/* entries that failed to resolve, for reuse once the pool runs dry */
+static struct arp_entry *arp_dead;
 
 #define ARP_FLAG_RESOLVING	0x1
 #define ARP_FLAG_VALID		0x2
 #define ARP_FLAG_STATIC		0x4
+/* returned by arp_read() only */
+#define ARP_FLAG_MOVED		0x80
 
 #define ARP_REFRESH_TIMEOUT	(10 * ONE_SECOND)
 #define ARP_RESOLVE_TIMEOUT	(1 * ONE_SECOND)
@@ -91,10 +107,44 @@ static DEFINE_SPINLOCK(arp_send_pkt_lock);
 
 #define MAX_PENDING_PKTS	1024
 
+#define ARP_CACHE_SIZE		64
+#define ARP_MAX_PARKED		64
+#define ARP_PARK_TIMEOUT	(1 * ONE_SECOND)
+
+/* a per-core cache of resolved addresses, valid for one arp_epoch */
+struct arp_cache_entry {
+	uint32_t		addr;
+	uint32_t		epoch;
+	struct eth_addr		mac;
+};
+
+/* packets of this core waiting for their destination to be resolved */
+struct parked_pkt {
+	struct mbuf		*mbuf;
+	struct eth_tx_queue	*txq;
+	unsigned long		deadline;
+};
+
+struct arp_parking {
+	uint32_t		epoch;	/* arp_epoch of the last retry */
+	struct parked_pkt	pkts[ARP_MAX_PARKED];
+};
+
+static DEFINE_PERCPU(struct arp_cache_entry, arp_cache[ARP_CACHE_SIZE]);
+static DEFINE_PERCPU(struct arp_parking, arp_parking);
+DEFINE_PERCPU(int, arp_nr_parked);
+
 static struct mempool_datastore arp_datastore;
 static struct mempool		arp_mempool;
 static struct hlist_head	arp_tbl[ARP_MAX_ENTRIES];
 
+/*
+ * Bumped whenever a resolved MAC changes or goes away, so that caches
+ * built on top of the table (e.g. UDP header templates) can be revalidated
+ * with a single load.
+ */
+volatile uint32_t arp_epoch = 1;
+
 static struct mempool_datastore pending_pkt_datastore;
 static struct mempool		pending_pkt_mempool;
 
@@ -107,6 +157,73 @@ static inline int arp_ip_to_idx(struct ip_addr *addr)
 	return idx;
 }
 
+/*
+ * Lookups walk the hash chains without locks. Entries are never freed once
+ * published, only invalidated, so a walk never touches freed memory. A dead
+ * entry may however be reused for another address and moved to another
+ * chain, which can lead a walk astray: lock-free misses are therefore
+ * retried under arp_lock. Each entry carries a sequence count that readers
+ * use to retry instead of seeing a torn MAC address, or the MAC address of
+ * the next owner of the entry.
+ */
+static inline void arp_write_begin(struct arp_entry *e)
+{
+	e->seq++;
+	asm volatile("" ::: "memory");
+}
+
+static inline void arp_write_end(struct arp_entry *e)
+{
+	asm volatile("" ::: "memory");
+	e->seq++;
+}
+
+/**
+ * arp_read - takes a consistent snapshot of an entry
+ * @e: the entry
+ * @addr: the IP address the entry was looked up for
+ * @mac: a buffer to store the MAC value
+ *
+ * Returns the flags of the entry, or ARP_FLAG_MOVED if it was reused for
+ * another address in the meantime.
+ */
+static inline uint8_t arp_read(struct arp_entry *e, struct ip_addr *addr,
+			       struct eth_addr *mac)
+{
+	uint32_t seq;
+	uint8_t flags;
+
+	do {
+		while ((seq = e->seq) & 1)
+			cpu_relax();
+		asm volatile("" ::: "memory");
+		flags = e->flags;
+		if (e->addr.addr != addr->addr)
+			flags = ARP_FLAG_MOVED;
+		*mac = e->mac;
+		asm volatile("" ::: "memory");
+	} while (seq != e->seq);
+
+	return flags;
+}
+
+/**
+ * arp_publish - links a fully initialized entry into a hash chain
+ * @h: the chain
+ * @e: the entry
+ *
+ * Must be called with arp_lock held.
+ */
+static inline void arp_publish(struct hlist_head *h, struct arp_entry *e)
+{
+	e->link.next = h->head;
+	e->link.prev = (struct hlist_node *) h;
+	if (e->link.next)
+		e->link.next->prev = &e->link;
+	asm volatile("" ::: "memory");
+	h->head = &e->link;
+}
+
 static struct arp_entry *__arp_lookup(struct hlist_head *h, struct ip_addr *addr)
 {
 	struct arp_entry *e;
@@ -121,38 +238,102 @@ static struct arp_entry *__arp_lookup(struct hlist_head *h, struct ip_addr *addr
 	return NULL;
 }
 
-static struct arp_entry *arp_lookup(struct ip_addr *addr, bool create_okay)
+/**
+ * arp_reuse - takes back a dead entry
+ *
+ * Must be called with arp_lock held.
+ *
+ * Returns the entry, still linked and marked as being written, or NULL.
+ */
+static struct arp_entry *arp_reuse(void)
 {
 	struct arp_entry *e;
-	struct hlist_head *h = &arp_tbl[arp_ip_to_idx(addr)];
-
-	e = __arp_lookup(h, addr);
-	if (e)
-		return e;
+	bool idle;
 
-	if (create_okay) {
-		spin_lock(&arp_lock);
+	while ((e = arp_dead)) {
+		arp_dead = e->next_dead;
+		e->dead = false;
+		/* looked up again since it died */
+		if (e->flags || e->queued || timer_pending(&e->timer))
+			continue;
 
-		e = __arp_lookup(h, addr);
-		if (e) {
-			spin_unlock(&arp_lock);
+		spin_lock(&pending_pkt_lock);
+		idle = hlist_empty(&e->pending_pkts);
+		if (idle) {
+			arp_write_begin(e);
+			/* keep arp_add_pending_pkt() off it from now on */
+			e->addr.addr = 0;
+		}
+		spin_unlock(&pending_pkt_lock);
+		if (idle) {
+			hlist_del(&e->link);
 			return e;
 		}
+	}
+
+	return NULL;
+}
+
+/**
+ * arp_new - adds an entry to the table
+ * @h: the chain of @addr
+ * @addr: the IP address
+ * @mac: the MAC address
+ * @flags: the flags of the entry
+ * @handler: the timer handler of the entry
+ *
+ * Must be called with arp_lock held.
+ *
+ * Returns the entry, or NULL if the table is full.
+ */
+static struct arp_entry *arp_new(struct hlist_head *h, struct ip_addr *addr,
+				 struct eth_addr *mac, uint8_t flags,
+				 void (*handler)(struct timer *, struct eth_fg *))
+{
+	struct arp_entry *e;
+	bool reused = false;
 
-		e = (struct arp_entry *)mempool_alloc(&arp_mempool);
-		if (unlikely(!e))
+	e = (struct arp_entry *)mempool_alloc(&arp_mempool);
+	if (unlikely(!e)) {
+		e = arp_reuse();
+		if (!e)
 			return NULL;
+		reused = true;
+	} else {
+		e->seq = 0;
+		e->dead = false;
+		hlist_init_head(&e->pending_pkts);
+	}
 
-		e->addr.addr = addr->addr;
-		e->flags = 0;
-		e->retries = 0;
-		timer_init_entry(&e->timer, &arp_timer_handler);
-		hlist_add_head(h, &e->link);
-		spin_unlock(&arp_lock);
+	e->addr.addr = addr->addr;
+	if (mac)
+		e->mac = *mac;
+	e->flags = flags;
+	e->retries = 0;
+	e->queued = false;
+	timer_init_entry(&e->timer, handler);
+	arp_publish(h, e);
+	if (reused)
+		arp_write_end(e);
+	return e;
+}
+
+static struct arp_entry *arp_lookup(struct ip_addr *addr, bool create_okay)
+{
+	struct arp_entry *e;
+	struct hlist_head *h = &arp_tbl[arp_ip_to_idx(addr)];
+
+	e = __arp_lookup(h, addr);
+	if (e)
 		return e;
-	}
 
-	return NULL;
+	/* the walk may have followed an entry being reused */
+	spin_lock(&arp_lock);
+	e = __arp_lookup(h, addr);
+	if (!e && create_okay)
+		e = arp_new(h, addr, NULL, 0, &arp_timer_handler);
+	spin_unlock(&arp_lock);
+	return e;
 }
 
 static void send_pending_pkt(void *data)
@@ -175,6 +356,7 @@ static int arp_update_mac(struct ip_addr *addr,
 {
 	struct hlist_node *n;
 	struct pending_pkt *pkt;
+	bool changed;
 	struct arp_entry *e = arp_lookup(addr, create_okay);
 	if (unlikely(!e))
 		return -ENOMEM;
@@ -209,9 +391,26 @@ static int arp_update_mac(struct ip_addr *addr,
 	}
 #endif /* DEBUG */
 
+	spin_lock(&arp_lock);
+	if (unlikely(e->addr.addr != addr->addr)) {
+		/* reused since the lookup; it died, so there is nothing to do */
+		spin_unlock(&arp_lock);
+		return 0;
+	}
+	changed = !(e->flags & ARP_FLAG_VALID) ||
+		  memcmp(&mac->addr, &e->mac.addr, ETH_ADDR_LEN);
+
+	arp_write_begin(e);
 	e->mac = *mac;
 	e->flags = ARP_FLAG_VALID;
+	arp_write_end(e);
 	e->retries = 0;
+
+	/* bumped after the update, so caches never pair a new epoch and old MAC */
+	if (changed)
+		arp_epoch++;
+	spin_unlock(&arp_lock);
+
 	timer_mod(&e->timer, NULL, ARP_REFRESH_TIMEOUT);
 
 	spin_lock(&pending_pkt_lock);
@@ -360,31 +559,146 @@ out:
  * @addr: the IP address to lookup
  * @mac: a buffer to store the MAC value
  *
+ * Hits in the per-core cache touch no shared state other than arp_epoch;
+ * other lookups are lock-free unless the address must be resolved, which
+ * is left to the networker.
+ *
  * Returns 0 if successful, -EAGAIN if waiting to resolve, otherwise fail.
  */
 int arp_lookup_mac(struct ip_addr *addr, struct eth_addr *mac)
 {
-	struct arp_entry *e = arp_lookup(addr, true);
-	if (!e)
-		return -ENOENT;
+	struct arp_cache_entry *c;
+	struct arp_entry *e;
+	uint32_t epoch = arp_epoch;
+	uint8_t flags;
 
-	if (!(e->flags & ARP_FLAG_VALID)) {
-		spin_lock(&arp_send_pkt_lock);
-		if (!timer_pending(&e->timer)) {
-			struct eth_addr target = ETH_ADDR_BROADCAST;
+	c = &percpu_get(arp_cache[addr->addr & (ARP_CACHE_SIZE - 1)]);
+	if (likely(c->epoch == epoch && c->addr == addr->addr)) {
+		*mac = c->mac;
+		return 0;
+	}
+
+	do {
+		e = arp_lookup(addr, true);
+		if (!e)
+			return -ENOENT;
+		flags = arp_read(e, addr, mac);
+	} while (unlikely(flags & ARP_FLAG_MOVED));
 
-			e->flags |= ARP_FLAG_RESOLVING;
-			arp_send_pkt(ARP_OP_REQUEST, addr, &target);
-			timer_add(&e->timer, NULL, ARP_RESOLVE_TIMEOUT);
+	if (unlikely(!(flags & ARP_FLAG_VALID))) {
+		spin_lock(&arp_lock);
+		if (e->addr.addr == addr->addr &&
+		    !(e->flags & (ARP_FLAG_VALID | ARP_FLAG_RESOLVING)) &&
+		    !e->queued) {
+			e->queued = true;
+			e->next_req = arp_reqs;
+			arp_reqs = e;
 		}
-		spin_unlock(&arp_send_pkt_lock);
+		spin_unlock(&arp_lock);
 		return -EAGAIN;
 	}
 
-	*mac = e->mac;
+	c->addr = addr->addr;
+	c->mac = *mac;
+	c->epoch = epoch;
 	return 0;
 }
 
+/**
+ * arp_process_requests - starts resolving the addresses other cores missed
+ *
+ * Must only be called by the networker, which also runs the ARP timers
+ * through timer_run().
+ */
+void arp_process_requests(void)
+{
+	struct arp_entry *e, *next;
+	struct eth_addr target = ETH_ADDR_BROADCAST;
+
+	if (likely(!arp_reqs))
+		return;
+
+	spin_lock(&arp_lock);
+	for (e = arp_reqs; e; e = next) {
+		next = e->next_req;
+		e->queued = false;
+		/* resolved, or being retried, in the meantime */
+		if ((e->flags & (ARP_FLAG_VALID | ARP_FLAG_RESOLVING)) ||
+		    timer_pending(&e->timer))
+			continue;
+		arp_write_begin(e);
+		e->flags |= ARP_FLAG_RESOLVING;
+		arp_write_end(e);
+		arp_send_pkt(ARP_OP_REQUEST, &e->addr, &target);
+		timer_add(&e->timer, NULL, ARP_RESOLVE_TIMEOUT);
+	}
+	arp_reqs = NULL;
+	spin_unlock(&arp_lock);
+}
+
+/**
+ * arp_park_pkt - holds a packet until its destination is resolved
+ * @pkt: the packet, complete except for the destination MAC
+ * @txq: the TX queue to send it on
+ *
+ * The packet is retried by arp_process_parked() on this core whenever the
+ * ARP table changes, and dropped after ARP_PARK_TIMEOUT.
+ *
+ * Returns 0 if successful, otherwise -EAGAIN and the packet is left to the
+ * caller.
+ */
+int arp_park_pkt(struct mbuf *pkt, struct eth_tx_queue *txq)
+{
+	struct arp_parking *p = &percpu_get(arp_parking);
+	int nr = percpu_get(arp_nr_parked);
+
+	if (unlikely(nr >= ARP_MAX_PARKED))
+		return -EAGAIN;
+
+	p->pkts[nr].mbuf = pkt;
+	p->pkts[nr].txq = txq;
+	p->pkts[nr].deadline = rdtsc() +
+			       (unsigned long) ARP_PARK_TIMEOUT * cycles_per_us;
+	/* the table may have changed since the failed lookup */
+	p->epoch = 0;
+	percpu_get(arp_nr_parked) = nr + 1;
+	return 0;
+}
+
+/**
+ * __arp_process_parked - sends or expires the parked packets of this core
+ */
+void __arp_process_parked(void)
+{
+	struct arp_parking *p = &percpu_get(arp_parking);
+	int i, kept = 0, nr = percpu_get(arp_nr_parked);
+	uint32_t epoch = arp_epoch;
+	bool retry = p->epoch != epoch;
+	unsigned long now = rdtsc();
+
+	p->epoch = epoch;
+	for (i = 0; i < nr; i++) {
+		struct parked_pkt *pp = &p->pkts[i];
+		struct eth_hdr *ethhdr = mbuf_mtod(pp->mbuf, struct eth_hdr *);
+		struct ip_hdr *iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
+		struct ip_addr dst_addr;
+
+		dst_addr.addr = ntoh32(iphdr->dst_addr.addr);
+		if (retry && !arp_lookup_mac(&dst_addr, &ethhdr->dhost) &&
+		    !eth_send(pp->txq, pp->mbuf))
+			continue;
+
+		if ((long) (now - pp->deadline) >= 0) {
+			mbuf_xmit_done(pp->mbuf);
+			continue;
+		}
+
+		p->pkts[kept++] = *pp;
+	}
+
+	percpu_get(arp_nr_parked) = kept;
+}
+
 /**
  * arp_insert - insert a static entry into the ARP table
  * @addr: the IP address to insert
@@ -397,21 +711,25 @@ int arp_insert(struct ip_addr *addr, struct eth_addr *mac)
 	struct arp_entry *e;
 	struct hlist_head *h;
 
-	e = arp_lookup(addr, false);
+	h = &arp_tbl[arp_ip_to_idx(addr)];
+	spin_lock(&arp_lock);
+	e = __arp_lookup(h, addr);
 	if (!e) {
-		h = &arp_tbl[arp_ip_to_idx(addr)];
-		e = (struct arp_entry *)mempool_alloc(&arp_mempool);
-		if (unlikely(!e))
+		e = arp_new(h, addr, mac, ARP_FLAG_VALID | ARP_FLAG_STATIC,
+			    NULL);
+		if (unlikely(!e)) {
+			spin_unlock(&arp_lock);
 			return -ENOMEM;
-		e->addr.addr = addr->addr;
+		}
+	} else {
+		timer_del(&e->timer);
+		arp_write_begin(e);
+		e->mac = *mac;
 		e->flags = ARP_FLAG_VALID | ARP_FLAG_STATIC;
-		e->retries = 0;
-		timer_init_entry(&e->timer, NULL);
-		hlist_add_head(h, &e->link);
+		arp_write_end(e);
 	}
-
-	timer_del(&e->timer);
-	e->mac = *mac;
+	arp_epoch++;
+	spin_unlock(&arp_lock);
 
 	return 0;
 }
@@ -441,12 +759,25 @@ static void arp_timer_handler(struct timer *t, struct eth_fg *cur_fg)
 		}
 		spin_unlock(&pending_pkt_lock);
 
-		hlist_del(&e->link);
-		mempool_free(&arp_mempool, e);
+		/* lookups may still be walking past it, so keep it linked */
+		spin_lock(&arp_lock);
+		arp_write_begin(e);
+		e->flags = 0;
+		arp_write_end(e);
+		e->retries = 0;
+		if (!e->dead) {
+			e->dead = true;
+			e->next_dead = arp_dead;
+			arp_dead = e;
+		}
+		arp_epoch++;
+		spin_unlock(&arp_lock);
 		return;
 	}
 
+	spin_lock(&arp_lock);
 	e->flags |= ARP_FLAG_RESOLVING;
+	spin_unlock(&arp_lock);
 
 	if (e->flags & ARP_FLAG_VALID) {
 		arp_send_pkt(ARP_OP_REQUEST, &e->addr, &e->mac);
@@ -466,6 +797,11 @@ int arp_add_pending_pkt(struct ip_addr *dst_addr, struct eth_fg *fg, struct mbuf
 		return -ENOENT;
 
 	spin_lock(&pending_pkt_lock);
+	/* reused for another address since the lookup */
+	if (unlikely(e->addr.addr != dst_addr->addr)) {
+		spin_unlock(&pending_pkt_lock);
+		return -ENOENT;
+	}
 	pkt = (struct pending_pkt *)mempool_alloc(&pending_pkt_mempool);
 	if (unlikely(!pkt)) {
 		spin_unlock(&pending_pkt_lock);
@@ -35,6 +35,7 @@
 #include <ix/log.h>
 #include <ix/cfg.h>
 #include <ix/control_plane.h>
+#include <ix/tcp_conn.h>
 #include <ix/transmit.h>
 
 #include <asm/chksum.h>
@@ -94,8 +95,14 @@ static int ip_input(struct eth_fg *cur_fg, struct mbuf *pkt, struct ip_hdr *hdr)
 
 	switch (hdr->proto) {
 	case IPPROTO_TCP:
-                log_debug("ip: dropping TCP packet\n");
-                goto out;
+		if (!CFG.tcp) {
+			log_debug("ip: dropping TCP packet\n");
+			goto out;
+		}
+		/* the stack owns the packet, requests come out framed */
+		tcp_input_tmp(tcp_conn_fg, pkt, hdr,
+			      mbuf_nextd_off(hdr, void *, hdrlen));
+		return -1;
 	case IPPROTO_UDP:
 		ret = udp_input(pkt, hdr, mbuf_nextd_off(hdr,struct udp_hdr *,
                                                          hdrlen));
@@ -128,7 +135,11 @@ int eth_input(struct eth_rx_queue *rx_queue, struct mbuf *pkt)
 
 	if (ethhdr->type == hton16(ETHTYPE_IP))
                 return ip_input(NULL, pkt, mbuf_nextd(ethhdr, struct ip_hdr *));
-	else {
+	else if (ethhdr->type == hton16(ETHTYPE_ARP)) {
+		/* answers requests and resolves packets parked by the workers */
+		arp_input(pkt, mbuf_nextd(ethhdr, struct arp_hdr *));
+		return -1;
+	} else {
 		mbuf_free(pkt);
                 return -1;
         }
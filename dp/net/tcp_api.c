@@ -38,6 +38,9 @@
 #include <lwip/tcp.h>
 
 int ip_send_one(struct eth_fg *cur_fg, struct ip_addr *dst_addr, struct mbuf *pkt, size_t len);
+err_t tcp_conn_event(struct eth_fg *cur_fg, void *arg, struct tcp_pcb *pcb,
+		     enum lwip_event event, struct pbuf *p, u16_t size,
+		     err_t err);
 
 #define MAX_PCBS	(512*1024)
 #define DEFAULT_PORT 8000
@@ -512,6 +515,10 @@ lwip_tcp_event(struct eth_fg *cur_fg, void *arg, struct tcp_pcb *pcb,
 	       u16_t size,
 	       err_t err)
 {
+	/* connections served through the dispatcher */
+	if (CFG.tcp)
+		return tcp_conn_event(cur_fg, arg, pcb, event, p, size, err);
+
 	switch (event) {
 	case LWIP_EVENT_ACCEPT:
 		return on_accept(cur_fg, arg, pcb, err);
@@ -35,6 +35,7 @@
 #include <ix/kstats.h>
 #include <ix/cfg.h>
 #include <ix/mempool.h>
+#include <ix/dispatch.h>
 #include <ix/transmit.h>
 #include <ix/networker.h>
 #include <asm/chksum.h>
@@ -44,6 +45,8 @@
 
 #include "net.h"
 
+DEFINE_PERCPU(struct udp_tmpl, udp_tmpls[UDP_TMPL_NR]);
+
 int udp_input(struct mbuf *pkt, struct ip_hdr *iphdr, struct udp_hdr *udphdr)
 {
 	int i;
@@ -74,6 +77,9 @@ int udp_input(struct mbuf *pkt, struct ip_hdr *iphdr, struct udp_hdr *udphdr)
         for (i = 0; i < CFG.num_ports; i++)
                 if (dst_port == CFG.ports[i])
                         return i;
+        if (CFG.call_port &&
+            (uint16_t) (dst_port - CFG.call_port) < CFG_MAX_CALLS)
+                return CALL_TYPE;
         if (dst_port == 6666)
             exit(0);
         return -1;
@@ -82,49 +88,9 @@ int udp_input(struct mbuf *pkt, struct ip_hdr *iphdr, struct udp_hdr *udphdr)
 static int udp_output(struct mbuf *__restrict pkt,
 		      struct ip_tuple *__restrict id, size_t len)
 {
-	struct eth_hdr *ethhdr = mbuf_mtod(pkt, struct eth_hdr *);
-	struct ip_hdr *iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
-	struct udp_hdr *udphdr = mbuf_nextd(iphdr, struct udp_hdr *);
-	size_t full_len = len + sizeof(struct udp_hdr);
-	struct ip_addr dst_addr;
-	int ret;
-
-	dst_addr.addr = id->dst_ip;
-	if (arp_lookup_mac(&dst_addr, &ethhdr->dhost))
-		return -RET_AGAIN;
-
-	ethhdr->shost = CFG.mac;
-	ethhdr->type = hton16(ETHTYPE_IP);
-
-	ip_setup_header(iphdr, IPPROTO_UDP,
-			CFG.host_addr.addr, id->dst_ip, full_len);
-	iphdr->chksum = chksum_internet((void *) iphdr, sizeof(struct ip_hdr));
-
-	udphdr->src_port = hton16(id->src_port);
-	udphdr->dst_port = hton16(id->dst_port);
-	udphdr->len = hton16(full_len);
-	udphdr->chksum = 0;
-
-	/* No TX checksum offload for UDP since only using context 0 for IP + TCP chekcusm */
-	pkt->ol_flags = 0;
-
 	pkt->len = UDP_PKT_SIZE;
 
-	/* FIXME: cur_fg makes no sense in the context of a UDP datagram send.
-	 *        For single-device interfaces, this is trivial (there's only one dev_ix)
-	 *        For multi-device bonds, the interface needs to be provided implicitly or explicitly
-	 */
-
-	ret = 0;
-	if (eth_dev_count > 1)
-		panic("udp_send not implemented for bonded interfaces\n");
-	else
-		ret = eth_send(percpu_get(eth_txqs)[0], pkt);
-
-	if (ret)
-		return ret;
-
-	return 0;
+	return udp_xmit(pkt, id, udp_setup_headers(pkt, len, id));
 }
 
 /**
@@ -78,3 +78,44 @@ static inline unsigned long rdmsr(unsigned int msr)
 	asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
 	return low | ((unsigned long)high << 32);
 }
+
+static inline void cpuid(unsigned int leaf, unsigned int subleaf,
+			 unsigned int *a, unsigned int *b,
+			 unsigned int *c, unsigned int *d)
+{
+	asm volatile("cpuid"
+		     : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+		     : "a"(leaf), "c"(subleaf));
+}
+
+/*
+ * User-level wait instructions (WAITPKG). They are emitted as bytes for
+ * assemblers that predate them. @ctrl 1 selects the C0.1 state, which is
+ * the faster to leave; the wait also ends at the TSC @deadline.
+ */
+
+#define CPUID_7_ECX_WAITPKG	(1 << 5)
+
+static inline void cpu_umonitor(const volatile void *addr)
+{
+	/* umonitor %rax */
+	asm volatile(".byte 0xf3, 0x0f, 0xae, 0xf0" : : "a"(addr));
+}
+
+static inline void cpu_umwait(unsigned int ctrl, unsigned long deadline)
+{
+	/* umwait %ecx */
+	asm volatile(".byte 0xf2, 0x0f, 0xae, 0xf1"
+		     : : "c"(ctrl), "a"((unsigned int) deadline),
+		       "d"((unsigned int) (deadline >> 32))
+		     : "cc", "memory");
+}
+
+static inline void cpu_tpause(unsigned int ctrl, unsigned long deadline)
+{
+	/* tpause %ecx */
+	asm volatile(".byte 0x66, 0x0f, 0xae, 0xf1"
+		     : : "c"(ctrl), "a"((unsigned int) deadline),
+		       "d"((unsigned int) (deadline >> 32))
+		     : "cc", "memory");
+}
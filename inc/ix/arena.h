@@ -0,0 +1,66 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * arena.h - per-request scratch memory
+ *
+ * Each request context owns a chain of fixed-size blocks carved from the
+ * per-cpu arena mempools. Handlers bump-allocate from the newest block and
+ * everything is returned at once when the request finishes.
+ */
+
+#pragma once
+
+#include <ix/cpu.h>
+#include <ix/mempool.h>
+
+#define ARENA_BLOCK_SIZE        4096
+#define ARENA_CAPACITY          (64 * 1024)
+
+/* the header keeps the block payload 16-byte aligned */
+struct arena_block {
+        struct arena_block * next;
+        size_t used;
+};
+
+#define ARENA_DATA_LEN  (ARENA_BLOCK_SIZE - sizeof(struct arena_block))
+
+DECLARE_PERCPU(struct mempool, arena_pool);
+
+extern void * arena_alloc(struct arena_block ** arena, size_t size);
+
+/**
+ * arena_release - returns all blocks of an arena to the core-local pool
+ * @arena: the newest block of the arena
+ *
+ * Requests almost always fit in one block, so this is O(1) in practice.
+ */
+static inline void arena_release(struct arena_block * arena)
+{
+        struct arena_block * next;
+
+        for (; arena; arena = next) {
+                next = arena->next;
+                mempool_free(&percpu_get(arena_pool), arena);
+        }
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * batch.h - request datagrams carrying several requests
+ *
+ * When 'batch_requests' is enabled, the payload of every request datagram
+ * is a sequence of records, each a struct coalesce_rec (a 16-bit length in
+ * network byte order) followed by that many bytes of request. The networker
+ * locates the records and writes a struct batch_desc past the end of the
+ * datagram, in the same mbuf. The dispatcher then queues one task per
+ * record, all pointing to that mbuf, so the requests of a datagram are
+ * scheduled, run and preempted independently.
+ *
+ * The tasks of a datagram are interchangeable: a worker starting one claims
+ * the next record. The mbuf is handed back to the networker by the worker
+ * that finishes the last of them, and is never rewritten in the meantime.
+ */
+
+#pragma once
+
+#include <ix/cfg.h>
+#include <ix/coalesce.h>
+#include <ix/mbuf.h>
+#include <ix/syscall.h>
+
+#define BATCH_MAX_REQS  64
+
+struct batch_desc {
+        uint32_t next;                  /* the next record to start */
+        uint32_t refs;                  /* the records not finished yet */
+        uint16_t nr;                    /* the number of records */
+        uint16_t off[BATCH_MAX_REQS];   /* of each request in the mbuf */
+        uint16_t len[BATCH_MAX_REQS];
+        struct ip_tuple id;             /* in host byte order */
+};
+
+#define BATCH_DESC_OFF  (MBUF_DATA_LEN - sizeof(struct batch_desc))
+
+/**
+ * batch_is_req - determines if a request mbuf is a batched datagram
+ * @pkt: the request mbuf, as delivered by the networker
+ */
+static inline bool batch_is_req(struct mbuf * pkt)
+{
+        return CFG.batch_requests && pkt->dev_idx != MBUF_TCP_FRAME;
+}
+
+/**
+ * batch_desc - the descriptor of a batched datagram
+ * @pkt: the mbuf
+ */
+static inline struct batch_desc * batch_desc(struct mbuf * pkt)
+{
+        return mbuf_mtod_off(pkt, struct batch_desc *, BATCH_DESC_OFF);
+}
+
+/**
+ * batch_claim - picks the request a new task of a batched datagram runs
+ * @pkt: the mbuf
+ * @data_ptr: set to the request
+ * @len_ptr: set to the length of the request
+ */
+static inline void batch_claim(struct mbuf * pkt, void ** data_ptr,
+                               uint32_t * len_ptr)
+{
+        struct batch_desc * b = batch_desc(pkt);
+        uint32_t i = __sync_fetch_and_add(&b->next, 1);
+
+        (*data_ptr) = mbuf_mtod_off(pkt, void *, b->off[i]);
+        (*len_ptr) = b->len[i];
+}
+
+/**
+ * batch_release - drops the reference of a finished (or dropped) request
+ * @pkt: the mbuf
+ *
+ * Returns true if it was the last one, and the mbuf must be handed back to
+ * the networker.
+ */
+static inline bool batch_release(struct mbuf * pkt)
+{
+        return __sync_sub_and_fetch(&batch_desc(pkt)->refs, 1) == 0;
+}
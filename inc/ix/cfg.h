@@ -34,6 +34,14 @@
 #define CFG_MAX_PORTS    16
 #define CFG_MAX_CPU     128
 #define CFG_MAX_ETHDEV   16
+#define CFG_MAX_CALLS  1024
+#define CFG_MAX_TX_BATCH_US 100
+#define CFG_MAX_TCP_WINDOW   32
+#define CFG_MAX_COALESCE_NS 10000
+#define CFG_MAX_IDLE_US  10000
+#define CFG_MIN_STACK_KB     4
+#define CFG_MAX_STACK_KB  1024
+#define CFG_DEFAULT_STACK_KB 16
 
 
 struct cfg_ip_addr {
@@ -53,6 +61,8 @@ struct cfg_parameters {
 
 	int num_ethdev;
 	struct pci_addr ethdev[CFG_MAX_ETHDEV];
+	/* the file of a software device, empty for a PCI device */
+	char ethdev_shm[CFG_MAX_ETHDEV][64];
 
 	int num_ports;
 	uint16_t ports[CFG_MAX_PORTS];
@@ -61,6 +71,32 @@ struct cfg_parameters {
 	float slos[CFG_MAX_PORTS];
 
 	char loader_path[256];
+	char handler_path[256];
+
+	uint16_t call_port;
+
+	bool inplace_reply;
+
+	bool page_1gb;
+
+	unsigned int tx_batch_us;
+
+	bool msg_layer;
+
+	bool tcp;
+
+	unsigned int tcp_window;
+
+	unsigned int coalesce_ns;
+
+	bool batch_requests;
+
+	bool rx_steering;
+
+	unsigned int idle_us;
+
+	/* of each request context, in bytes */
+	unsigned int stack_size;
 };
 
 extern struct cfg_parameters CFG;
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * coalesce.h - packing responses to the same client into one datagram
+ *
+ * When 'coalesce_ns' is set, the payload of every UDP response sent by a
+ * worker is a sequence of records, each a struct coalesce_rec followed by
+ * that many bytes of response. A response to a 4-tuple that has a datagram
+ * open on the worker is appended to it; otherwise a new datagram is opened,
+ * which goes out coalesce_ns after its first response, or earlier once it
+ * is full or its slot is needed for another 4-tuple.
+ *
+ * Responses are copied into the open datagram, so the zero-copy reply paths
+ * copy instead while coalescing is enabled.
+ */
+
+#pragma once
+
+#include <ix/syscall.h>
+#include <ix/types.h>
+
+#include <net/udp.h>
+
+struct coalesce_rec {
+        uint16_t len;           /* of the response, in network byte order */
+} __packed;
+
+#define COALESCE_REC_LEN        sizeof(struct coalesce_rec)
+#define COALESCE_MAX_LEN        (UDP_MAX_LEN - COALESCE_REC_LEN)
+
+extern void * coalesce_reserve(struct ip_tuple * id, size_t len);
+extern int coalesce_send(struct ip_tuple * id, const void * data, size_t len);
+extern void coalesce_flush_expired(void);
+
+extern int coalesce_init(void);
@@ -29,46 +29,71 @@
 #include <stdint.h>
 #include <ucontext.h>
 
+#include <ix/arena.h>
+#include <ix/cfg.h>
 #include <ix/mempool.h>
 
-struct mempool_datastore context_datastore;
-struct mempool context_pool __attribute((aligned(64)));
-struct mempool_datastore stack_datastore;
-struct mempool stack_pool __attribute((aligned(64)));
+/* contexts and stacks are kept on the NUMA node of the worker running them */
+struct mempool_numa_datastore context_datastore;
+struct mempool context_pool[MEMPOOL_MAX_NODES] __attribute((aligned(64)));
+struct mempool_numa_datastore stack_datastore;
+struct mempool stack_pool[MEMPOOL_MAX_NODES] __attribute((aligned(64)));
 
 extern int getcontext_fast(ucontext_t *ucp);
 
+/*
+ * Per-request state stored right after the ucontext_t in the same context
+ * pool element, so that it follows the context across workers.
+ */
+struct context_data {
+    struct arena_block * arena;
+};
+
+#define CONTEXT_ELEM_LEN    (sizeof(ucontext_t) + sizeof(struct context_data))
+
+/**
+ * context_data - returns the per-request state of a context
+ * @c: the context
+ */
+static inline struct context_data * context_data(ucontext_t *c)
+{
+    return (struct context_data *) (c + 1);
+}
+
 /**
  * context_alloc - allocates a ucontext_t and its stack
  * @cont: pointer to the pointer of the allocated context
+ * @node: the NUMA node to allocate from, if possible
  *
  * Returns 0 on success, -1 if failure.
  */
-static inline int context_alloc(ucontext_t ** cont)
+static inline int context_alloc(ucontext_t ** cont, int node)
 {
-    (*cont) = mempool_alloc(&context_pool);
+    (*cont) = mempool_numa_alloc(context_pool, node);
     if (unlikely(!(*cont)))
         return -1;
 
-    void * stack = mempool_alloc(&stack_pool);
+    void * stack = mempool_numa_alloc(stack_pool, node);
     if (unlikely(!stack)) {
-        mempool_free(&context_pool, (*cont));
+        mempool_numa_free(context_pool, &context_datastore, (*cont));
         return -1;
     }
 
     (*cont)->uc_stack.ss_sp = stack;
-    (*cont)->uc_stack.ss_size = sizeof(stack);
+    (*cont)->uc_stack.ss_size = CFG.stack_size;
+    context_data(*cont)->arena = NULL;
     return 0;
 }
 
 /**
- * context_free - frees a context and the associated stack
+ * context_free - frees a context, the associated stack and its arena
  * @c: the context
  */
 static inline void context_free(ucontext_t *c)
 {
-    mempool_free(&stack_pool, c->uc_stack.ss_sp);
-    mempool_free(&context_pool, c);
+    arena_release(context_data(c)->arena);
+    mempool_numa_free(stack_pool, &stack_datastore, c->uc_stack.ss_sp);
+    mempool_numa_free(context_pool, &context_datastore, c);
 }
 
 /**
@@ -80,7 +105,7 @@ static inline void set_context_link(ucontext_t *c, ucontext_t *uc_link)
 {
     uintptr_t *sp;
     /* Set up the sp pointer so that we save uc_link in the correct address. */
-    sp = ((uintptr_t *) c->uc_stack.ss_sp + c->uc_stack.ss_size);
+    sp = (uintptr_t *) ((uintptr_t) c->uc_stack.ss_sp + c->uc_stack.ss_size);
     /* We assume that we have less than 6 arguments here. */
     sp -= 1;
     sp = (uintptr_t *) ((((uintptr_t) sp) & -16L) - 8);
@@ -24,9 +24,12 @@
 #include <stdint.h>
 #include <ucontext.h>
 
+#include <asm/cpu.h>
+
 #include <ix/cfg.h>
 #include <ix/mempool.h>
 #include <ix/ethqueue.h>
+#include <ix/taskqueue.h>
 
 #define MAX_WORKERS   18
 
@@ -41,13 +44,21 @@
 #define NOCONTENT   0x00
 #define PACKET      0x01
 #define CONTEXT     0x02
+#define PARKED      0x03
+
+#define CALL_FREE   0x00
+#define CALL_SENT   0x01
+#define CALL_PARKED 0x02
+/* the context is requeued; only the worker frees the slot */
+#define CALL_DONE   0x03
+
+/* pseudo request type of replies to outbound calls */
+#define CALL_TYPE   0xFF
 
 #define MAX_UINT64  0xFFFFFFFFFFFFFFFF
 
-struct mempool_datastore task_datastore;
-struct mempool task_mempool __attribute((aligned(64)));
-struct mempool_datastore mcell_datastore;
-struct mempool mcell_mempool __attribute((aligned(64)));
+#define MBUF_RING_SIZE      512
+#define MBUF_RING_BATCH     64
 
 struct worker_response
 {
@@ -57,7 +68,8 @@ struct worker_response
         uint64_t timestamp;
         uint8_t type;
         uint8_t category;
-        char make_it_64_bytes[30];
+        uint16_t call;
+        char make_it_64_bytes[28];
 } __attribute__((packed, aligned(64)));
 
 struct dispatcher_request
@@ -74,182 +86,163 @@ struct dispatcher_request
 struct networker_pointers_t
 {
         uint8_t cnt;
-        uint8_t free_cnt;
         uint8_t types[ETH_RX_MAX_BATCH];
         struct mbuf * pkts[ETH_RX_MAX_BATCH];
-        char make_it_64_bytes[64 - ETH_RX_MAX_BATCH*9 - 2];
+        char make_it_64_bytes[64 - ETH_RX_MAX_BATCH*9 - 1];
 } __attribute__((packed, aligned(64)));
 
-struct mbuf_cell {
-        struct mbuf * buffer;
-        struct mbuf_cell * next;
-};
-
-struct mbuf_queue {
-        struct mbuf_cell * head;
-};
+/*
+ * Single-producer single-consumer ring that hands received mbufs back to
+ * the networker, which allocated them, so that they are freed on their
+ * owning core in batches. The producer only writes head and the consumer
+ * only writes tail; x86 keeps stores in order, so compiler barriers are
+ * enough.
+ */
+struct mbuf_ring {
+        volatile uint32_t head;
+        char pad0[60];
+        volatile uint32_t tail;
+        char pad1[60];
+        struct mbuf * bufs[MBUF_RING_SIZE];
+} __attribute__((aligned(64)));
+
+/* one ring per worker, the last one belongs to the dispatcher */
+struct mbuf_ring mbuf_rings[MAX_WORKERS + 1];
+#define DISPATCHER_MBUF_RING    (&mbuf_rings[MAX_WORKERS])
 
-struct mbuf_queue mqueue;
+/*
+ * The same for framed TCP requests, which tell the networker that the
+ * request is done, and their responses; the last one belongs to the
+ * dispatcher. See tcp_conn.c.
+ */
+struct mbuf_ring tcp_rings[MAX_WORKERS + 1];
+#define DISPATCHER_TCP_RING     (&tcp_rings[MAX_WORKERS])
 
-static inline struct mbuf * mbuf_dequeue(struct mbuf_queue * mq)
+/**
+ * mbuf_ring_put - returns an mbuf to the networker
+ * @r: the ring of the calling core
+ * @buf: the mbuf
+ */
+static inline void mbuf_ring_put(struct mbuf_ring * r, struct mbuf * buf)
 {
-        struct mbuf_cell * tmp;
-        struct mbuf * buf;
-
-        if (!mq->head)
-                return NULL;
-
-        buf = mq->head->buffer;
-        tmp = mq->head;
-        mempool_free(&mcell_mempool, tmp);
-        mq->head = mq->head->next;
-
-        return buf;
-}
+        uint32_t head = r->head;
 
-static inline void mbuf_enqueue(struct mbuf_queue * mq, struct mbuf * buf)
-{
         if (unlikely(!buf))
                 return;
-        struct mbuf_cell * mcell = mempool_alloc(&mcell_mempool);
-        mcell->buffer = buf;
-        mcell->next = mq->head;
-        mq->head = mcell;
-}
-
-struct task {
-        void * runnable;
-        void * mbuf;
-        uint8_t type;
-        uint8_t category;
-        uint64_t timestamp;
-        struct task * next;
-};
-
-struct task_queue
-{
-        struct task * head;
-        struct task * tail;
-};
-        
-struct task_queue tskq[CFG_MAX_PORTS];
-
-static inline void tskq_enqueue_head(struct task_queue * tq, void * rnbl,
-                                     void * mbuf, uint8_t type,
-                                     uint8_t category, uint64_t timestamp)
-{
-        struct task * tsk = mempool_alloc(&task_mempool);
-        tsk->runnable = rnbl;
-        tsk->mbuf = mbuf;
-        tsk->type = type;
-        tsk->category = category;
-        tsk->timestamp = timestamp;
-        if (tq->head != NULL) {
-            struct task * tmp = tq->head;
-            tq->head = tsk;
-            tsk->next = tmp;
-        } else {
-            tq->head = tsk;
-            tq->tail = tsk;
-            tsk->next = NULL;
-        }
-}
-
-static inline void tskq_enqueue_tail(struct task_queue * tq, void * rnbl,
-                                     void * mbuf, uint8_t type,
-                                     uint8_t category, uint64_t timestamp)
-{
-        struct task * tsk = mempool_alloc(&task_mempool);
-        if (!tsk)
+        /* the networker fell behind; freeing here works too, just slower */
+        if (unlikely(head - r->tail == MBUF_RING_SIZE)) {
+                mbuf_free(buf);
                 return;
-        tsk->runnable = rnbl;
-        tsk->mbuf = mbuf;
-        tsk->type = type;
-        tsk->category = category;
-        tsk->timestamp = timestamp;
-        if (tq->head != NULL) {
-            tq->tail->next = tsk;
-            tq->tail = tsk;
-            tsk->next = NULL;
-        } else {
-            tq->head = tsk;
-            tq->tail = tsk;
-            tsk->next = NULL;
         }
+        r->bufs[head & (MBUF_RING_SIZE - 1)] = buf;
+        asm volatile("" ::: "memory");
+        r->head = head + 1;
 }
 
-static inline int tskq_dequeue(struct task_queue * tq, void ** rnbl_ptr,
-                                void ** mbuf, uint8_t *type, uint8_t *category,
-                                uint64_t *timestamp)
+/**
+ * mbuf_ring_put_wait - hands an mbuf to the networker, waiting for room
+ * @r: the ring of the calling core
+ * @buf: the mbuf
+ *
+ * Unlike mbuf_ring_put(), the mbuf is never freed in place, for mbufs the
+ * networker has to see.
+ */
+static inline void mbuf_ring_put_wait(struct mbuf_ring * r, struct mbuf * buf)
 {
-        if (tq->head == NULL)
-            return -1;
-        (*rnbl_ptr) = tq->head->runnable;
-        (*mbuf) = tq->head->mbuf;
-        (*type) = tq->head->type;
-        (*category) = tq->head->category;
-        (*timestamp) = tq->head->timestamp;
-        struct task * tsk = tq->head;
-        tq->head = tq->head->next;
-        mempool_free(&task_mempool, tsk);
-        if (tq->head == NULL)
-                tq->tail = NULL;
-        return 0;
-}
+        uint32_t head = r->head;
 
-static inline uint64_t get_queue_timestamp(struct task_queue * tq, uint64_t * timestamp)
-{
-        if (tq->head == NULL)
-            return -1;
-        (*timestamp) = tq->head->timestamp;
-        return 0;
+        while (unlikely(head - r->tail == MBUF_RING_SIZE))
+                cpu_relax();
+        r->bufs[head & (MBUF_RING_SIZE - 1)] = buf;
+        asm volatile("" ::: "memory");
+        r->head = head + 1;
 }
 
-static inline int naive_tskq_dequeue(struct task_queue * tq, void ** rnbl_ptr,
-                                     void ** mbuf, uint8_t *type,
-                                     uint8_t *category, uint64_t *timestamp)
+/**
+ * mbuf_ring_get - takes up to MBUF_RING_BATCH mbufs from a ring
+ * @r: the ring
+ * @bufs: filled with the mbufs
+ *
+ * Must only be called by the networker.
+ *
+ * Returns the number of mbufs taken.
+ */
+static inline int mbuf_ring_get(struct mbuf_ring * r, struct mbuf ** bufs)
 {
-        int i;
-        for (i = 0; i < CFG.num_ports; i++) {
-                if(tskq_dequeue(&tq[i], rnbl_ptr, mbuf, type, category,
-                                timestamp) == 0)
-                        return 0;
-        }
-        return -1;
+        uint32_t tail = r->tail;
+        int i, n = r->head - tail;
+
+        if (likely(!n))
+                return 0;
+        if (n > MBUF_RING_BATCH)
+                n = MBUF_RING_BATCH;
+        asm volatile("" ::: "memory");
+        for (i = 0; i < n; i++)
+                bufs[i] = r->bufs[(tail + i) & (MBUF_RING_SIZE - 1)];
+        asm volatile("" ::: "memory");
+        r->tail = tail + n;
+        return n;
 }
 
-static inline int smart_tskq_dequeue(struct task_queue * tq, void ** rnbl_ptr,
-                                     void ** mbuf, uint8_t *type,
-                                     uint8_t *category, uint64_t *timestamp,
-                                     uint64_t cur_time)
+/**
+ * mbuf_ring_drain - frees up to MBUF_RING_BATCH mbufs of a ring
+ * @r: the ring
+ *
+ * Must only be called by the networker.
+ *
+ * Returns the number of mbufs freed.
+ */
+static inline int mbuf_ring_drain(struct mbuf_ring * r)
 {
-        int i, ret;
-        uint64_t queue_stamp;
-        int index = -1;
-        double max = 0;
-
-        for (i = 0; i < CFG.num_ports; i++) {
-                ret = get_queue_timestamp(&tq[i], &queue_stamp);
-                if (ret)
-                        continue;
-
-                int64_t diff = cur_time - queue_stamp;
-                double current = diff / CFG.slos[i];
-                if (current > max) {
-                        max = current;
-                        index = i;
-                }
-        }
+        struct mbuf * bufs[MBUF_RING_BATCH];
+        int n = mbuf_ring_get(r, bufs);
 
-        if (index != -1) {
-                return tskq_dequeue(&tq[index], rnbl_ptr, mbuf, type, category,
-                                    timestamp);
-        }
-        return -1;
+        if (n)
+                mbuf_free_bulk(bufs, n);
+        return n;
 }
 
+/*
+ * An outbound call from a handler. The worker claims a free slot and sends
+ * the request from port CFG.call_port + slot. The dispatcher parks the
+ * context in the slot and requeues it once the networker delivers the reply,
+ * moving the slot to CALL_DONE so that later replies are dropped. The worker
+ * frees the slot when the context resumes.
+ */
+struct call_slot {
+        volatile uint8_t state;
+        uint8_t type;
+        void * rnbl;
+        void * mbuf;
+        uint64_t timestamp;
+        struct mbuf * volatile reply;
+} __attribute__((aligned(64)));
+
+struct call_slot call_slots[CFG_MAX_CALLS];
+
 uint64_t timestamps[MAX_WORKERS];
 uint8_t preempt_check[MAX_WORKERS];
 volatile struct networker_pointers_t networker_pointers;
 volatile struct worker_response worker_responses[MAX_WORKERS];
 volatile struct dispatcher_request dispatcher_requests[MAX_WORKERS];
+
+/**
+ * worker_respond - hands the request of a worker back to the dispatcher
+ * @i: the worker
+ * @rnbl: the context of the request
+ * @mbuf: the mbuf of the request, NULL once it is released
+ * @category: CONTEXT, or PARKED for a context waiting for a call
+ * @flag: FINISHED or PREEMPTED
+ *
+ * The flag is written last; the dispatcher reads the rest once it changes.
+ */
+static inline void worker_respond(int i, void * rnbl, void * mbuf,
+                                  uint8_t category, uint64_t flag)
+{
+        worker_responses[i].timestamp = dispatcher_requests[i].timestamp;
+        worker_responses[i].type = dispatcher_requests[i].type;
+        worker_responses[i].mbuf = mbuf;
+        worker_responses[i].rnbl = rnbl;
+        worker_responses[i].category = category;
+        worker_responses[i].flag = flag;
+}
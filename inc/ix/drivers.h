@@ -36,6 +36,9 @@ extern struct rte_eth_txconf tx_conf;
 int ixgbe_init(struct ix_rte_eth_dev *dev, const char *driver_name);
 int i40e_init(struct ix_rte_eth_dev *dev, const char *driver_name);
 
+/* software device initialization function */
+int shmdev_init(const char *path, struct ix_rte_eth_dev **eth);
+
 /* driver-independent eth_dev_ops */
 void generic_allmulticast_enable(struct ix_rte_eth_dev *dev);
 void generic_dev_infos_get(struct ix_rte_eth_dev *dev, struct ix_rte_eth_dev_info *dev_info);
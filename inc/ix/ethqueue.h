@@ -32,15 +32,28 @@
 #include <ix/errno.h>
 #include <ix/bitmap.h>
 #include <ix/ethfg.h>
+#include <ix/cfg.h>
 
 #define ETH_DEV_RX_QUEUE_SZ     512
 #define ETH_DEV_TX_QUEUE_SZ     4096
 #define ETH_RX_MAX_DEPTH	32768
 #define ETH_RX_MAX_BATCH        6
 
+/* ring the TX doorbell at least once per this many queued buffers */
+#define ETH_TX_MAX_BATCH	32
+/* reclaim once this many buffers were sent, or when space runs low */
+#define ETH_TX_RECLAIM_BATCH	64
+#define ETH_TX_RECLAIM_LOW	256
+
 DECLARE_PERCPU(int, eth_num_queues);
+DECLARE_PERCPU(int, eth_rx_next);
 
 struct eth_rx_queue * eth_rxqs[NETHDEV];
+/* with rx_steering, the queue of each request type on each device */
+struct eth_rx_queue * eth_type_rxqs[CFG_MAX_PORTS][NETHDEV];
+/* request types, tightest SLO first; eth_num_types is 0 without steering */
+int eth_type_order[CFG_MAX_PORTS];
+int eth_num_types;
 struct mbuf * recv_mbufs[ETH_RX_MAX_BATCH];
 int recv_type[ETH_RX_MAX_BATCH];
 
@@ -85,9 +98,17 @@ static inline int eth_rx_poll(struct eth_rx_queue *rx)
  */
 static inline int eth_process_poll(void)
 {
-        int i, count = 0;
+        int i, t, count = 0;
         struct eth_rx_queue *rxq;
 
+        /* steered queues first, so that urgent requests are seen early */
+        for (t = 0; t < eth_num_types; t++) {
+                for (i = 0; i < percpu_get(eth_num_queues); i++) {
+                        rxq = eth_type_rxqs[eth_type_order[t]][i];
+                        count += eth_rx_poll(rxq);
+                }
+        }
+
         for (i = 0; i < percpu_get(eth_num_queues); i++) {
                 rxq = eth_rxqs[i];
                 count += eth_rx_poll(rxq);
@@ -96,7 +117,8 @@ static inline int eth_process_poll(void)
         return count;
 }
 
-static inline int eth_process_recv_queue(struct eth_rx_queue *rxq, struct mbuf ** pos_p)
+static inline int eth_process_recv_queue(struct eth_rx_queue *rxq, int dev_idx,
+                                         struct mbuf ** pos_p)
 {
         (*pos_p) = rxq->head;
 
@@ -106,10 +128,46 @@ static inline int eth_process_recv_queue(struct eth_rx_queue *rxq, struct mbuf *
         /* NOTE: pos could get freed after eth_input(), so check here */
         rxq->head = (*pos_p)->next;
         rxq->len--;
+        (*pos_p)->dev_idx = dev_idx;
 
         return eth_input(rxq, *pos_p);
 }
 
+/**
+ * eth_process_recv_steered - retrieves packets from the steered queues
+ *
+ * Drains the queues of each request type in priority order, so that
+ * requests with a tight SLO never wait behind a batch of bulk traffic.
+ *
+ * Returns the number of packets stored in recv_mbufs.
+ */
+static inline int eth_process_recv_steered(void)
+{
+        int i, t, type, count = 0;
+        struct mbuf * pos;
+
+        for (t = 0; t < eth_num_types; t++) {
+                for (i = 0; i < percpu_get(eth_num_queues); i++) {
+                        struct eth_rx_queue *rxq = eth_type_rxqs[eth_type_order[t]][i];
+
+                        while (count < ETH_RX_MAX_BATCH) {
+                                type = eth_process_recv_queue(rxq, i, &pos);
+                                if (type == -EAGAIN)
+                                        break;
+                                if (type < 0)
+                                        continue;
+                                recv_mbufs[count] = pos;
+                                recv_type[count] = type;
+                                count++;
+                        }
+                        if (count == ETH_RX_MAX_BATCH)
+                                return count;
+                }
+        }
+
+        return count;
+}
+
 /**
  * eth_process_recv - retrieves pending received packets
  *
@@ -117,29 +175,39 @@ static inline int eth_process_recv_queue(struct eth_rx_queue *rxq, struct mbuf *
  */
 static inline int eth_process_recv(void)
 {
-        int i, type, count = 0;
-        bool empty;
+        int i, type, count = eth_process_recv_steered();
+        int nr = percpu_get(eth_num_queues);
+        int start = percpu_get(eth_rx_next);
+        int idle = 0;
         struct mbuf * pos;
 
         /*
         * We round robin through each queue one packet at
         * a time for fairness, and stop when all queues are
-        * empty or the batch limit is hit.
+        * empty or the batch limit is hit. The next batch
+        * starts at the queue after the last one served, so
+        * that with several devices the batch limit does not
+        * always favor the first ones. Steered queues, if any,
+        * have already been drained above.
         */
-        do {
-                empty = true;
-                for (i = 0; i < percpu_get(eth_num_queues); i++) {
-                        struct eth_rx_queue *rxq = eth_rxqs[i];
-                        type = eth_process_recv_queue(rxq, &pos);
-                        if (type >= 0) {
-                                recv_mbufs[count] = pos;
-                                recv_type[count] = type;
-                                count++;
-                                empty = false;
-                        }
+        i = start;
+        while (idle < nr && count < ETH_RX_MAX_BATCH) {
+                type = eth_process_recv_queue(eth_rxqs[i], i, &pos);
+                if (type >= 0) {
+                        recv_mbufs[count] = pos;
+                        recv_type[count] = type;
+                        count++;
+                        idle = 0;
+                } else if (type == -EAGAIN) {
+                        idle++;
+                } else {
+                        idle = 0;
                 }
-        } while (!empty && count < ETH_RX_MAX_BATCH);
+                if (++i == nr)
+                        i = 0;
+        }
 
+        percpu_get(eth_rx_next) = i;
         return count;
 }
 
@@ -181,6 +249,8 @@ extern bool eth_rx_idle_wait(uint64_t max_usecs);
 struct eth_tx_queue {
 	int cap;	/* number of available buffers left */
 	int len;	/* number of buffers used so far */
+	int sent;	/* number of buffers sent since the last reclaim */
+	unsigned long first_ts;	/* when the oldest unsent buffer was queued */
 	struct mbuf *bufs[ETH_DEV_TX_QUEUE_SZ];
 
 	int (*reclaim)(struct eth_tx_queue *tx);
@@ -219,6 +289,8 @@ static inline int eth_tx_xmit(struct eth_tx_queue *tx,
 /* FIXME: convert to per-flowgroup */
 //DECLARE_PERQUEUE(struct eth_tx_queue *, eth_txq);
 
+extern int eth_tx_refill(struct eth_tx_queue *txq);
+
 /**
  * eth_send - enqueues a packet to be sent
  * @mbuf: the packet
@@ -228,9 +300,11 @@ static inline int eth_tx_xmit(struct eth_tx_queue *tx,
 static inline int eth_send(struct eth_tx_queue *txq, struct mbuf *mbuf)
 {
 	int nr = 1 + mbuf->nr_iov;
-	if (unlikely(nr > txq->cap))
+	if (unlikely(nr > txq->cap) && nr > eth_tx_refill(txq))
 		return -EBUSY;
 
+	if (!txq->len)
+		txq->first_ts = rdtsc();
 	txq->bufs[txq->len++] = mbuf;
 	txq->cap -= nr;
 
@@ -254,6 +328,9 @@ static inline int eth_send_one(struct eth_tx_queue *txq, struct mbuf *mbuf, size
 
 DECLARE_PERCPU(struct eth_tx_queue *, eth_txqs[]);
 
+extern void eth_tx_flush(struct eth_tx_queue *txq);
 extern void eth_process_send(void);
+extern int eth_process_send_batched(unsigned long max_delay);
 extern void eth_process_reclaim(void);
+extern void eth_process_reclaim_lazy(void);
 
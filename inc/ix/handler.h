@@ -0,0 +1,140 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * handler.h - application request handlers
+ *
+ * Each request type (i.e. each configured port) is served by a handler. The
+ * handler runs inside a preemptible context on a worker core and reads the
+ * request payload directly from the receive buffer. Replies are built in
+ * place in a transmit mbuf with the shinjuku_resp_* helpers, or written over
+ * the request payload and sent with shinjuku_reply_inplace().
+ *
+ * With 'coalesce_ns' set, UDP replies to the same client are packed into
+ * one datagram as length-prefixed records (see coalesce.h). With
+ * 'batch_requests' set, request datagrams carry such records too, and each
+ * request is handled separately (see batch.h).
+ *
+ * Handlers run on a stack of 'stack_kb' (16KB by default), shared with the
+ * preemption interrupt frame. Large buffers belong in shinjuku_alloc()
+ * memory; a handler that overflows its stack crashes the dataplane.
+ *
+ * Scratch memory for the duration of a request comes from shinjuku_alloc().
+ * It survives preemption and is released when the request finishes.
+ *
+ * A handler can also call out to a UDP backend with shinjuku_call(). Its
+ * context is parked until the reply arrives, and the worker serves other
+ * requests in the meantime.
+ *
+ * With 'msg_layer' enabled, requests may span several datagrams and reach
+ * the handler reassembled; large replies are built in a buffer from
+ * shinjuku_msg_alloc() and sent segmented with shinjuku_msg_send().
+ *
+ * With 'tcp' enabled, requests also arrive over TCP connections, up to
+ * 'tcp_window' at a time per connection, so requests of one connection may
+ * run concurrently. They are answered on their connection, in request
+ * order, by shinjuku_resp_send(), shinjuku_reply_inplace() and
+ * shinjuku_msg_send(); udp_send() must not be used for them.
+ *
+ * Handlers may be linked into the dataplane or loaded from the shared object
+ * named by 'handler_path' in shinjuku.conf, which must export
+ * 'int shinjuku_handler_init(void)' and register its handlers from there.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ix/syscall.h>
+
+struct mbuf;
+
+/**
+ * struct shinjuku_req - a request as seen by a handler
+ * @data: the request payload, pointing into the receive mbuf
+ * @len: the length of the payload
+ * @type: the request type (index of the destination port)
+ * @id: the 4-tuple of the request, in host byte order
+ * @msg_id: the message id of the request, with the message layer or TCP
+ * @tcp: whether the request came over a TCP connection
+ */
+struct shinjuku_req {
+        void * data;
+        size_t len;
+        uint8_t type;
+        struct ip_tuple * id;
+        uint32_t msg_id;
+        bool tcp;
+};
+
+/**
+ * struct shinjuku_resp - a reply under construction
+ * @pkt: the transmit mbuf
+ * @data: the start of the reply payload inside @pkt
+ * @len: the number of payload bytes written so far
+ */
+struct shinjuku_resp {
+        struct mbuf * pkt;
+        void * data;
+        size_t len;
+};
+
+/**
+ * struct shinjuku_reply - the reply to an outbound call
+ * @data: the reply payload, valid until the handler returns
+ * @len: the length of the payload
+ */
+struct shinjuku_reply {
+        void * data;
+        size_t len;
+};
+
+typedef void (*shinjuku_handler_t)(struct shinjuku_req *req);
+
+#define SHINJUKU_HANDLER_INIT "shinjuku_handler_init"
+
+extern int shinjuku_register_handler(uint8_t type, shinjuku_handler_t handler);
+
+extern int shinjuku_resp_init(struct shinjuku_resp *resp);
+extern size_t shinjuku_resp_space(struct shinjuku_resp *resp);
+extern int shinjuku_resp_append(struct shinjuku_resp *resp, const void *buf,
+                                size_t len);
+extern int shinjuku_resp_send(struct shinjuku_req *req,
+                              struct shinjuku_resp *resp);
+extern void shinjuku_resp_discard(struct shinjuku_resp *resp);
+
+extern int shinjuku_reply_inplace(struct shinjuku_req *req, size_t len);
+
+extern void * shinjuku_msg_alloc(void);
+extern int shinjuku_msg_send(struct shinjuku_req *req, void *data, size_t len);
+
+extern void * shinjuku_alloc(size_t size);
+
+extern int shinjuku_call(uint32_t dst_ip, uint16_t dst_port,
+                         struct shinjuku_resp *msg,
+                         struct shinjuku_reply *reply);
+
+/* handlers indexed by request type, used by the workers */
+extern shinjuku_handler_t handlers[];
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * idle.h - parking idle cores
+ *
+ * When 'idle_us' is set, a worker that has had no request for that long
+ * parks on the cache line of its dispatcher_requests[] mailbox with
+ * UMONITOR/UMWAIT and wakes up as soon as the dispatcher writes to it.
+ * The networker, which has to watch the devices as well as the rings of the
+ * other cores, backs off instead: after as long without a packet, it pauses
+ * between polls for 1 us, doubling up to IDLE_BACKOFF_MAX_US. Both wait in
+ * the C0.1 state, which takes well under a microsecond to leave, and each
+ * wait is bounded by 'idle_us' so that the housekeeping around it still
+ * runs.
+ *
+ * Dune does not set "enable user wait and pause" in the VMCS, and without
+ * it the three instructions raise #UD in VMX non-root mode whatever CPUID
+ * says. idle_init() therefore tries TPAUSE once; where it faults, or where
+ * the CPU lacks WAITPKG, cores wait with PAUSE instead, which saves less
+ * power but wakes up just as fast.
+ */
+
+#pragma once
+
+#include <ix/types.h>
+
+#include <asm/cpu.h>
+
+#define IDLE_BACKOFF_MAX_US     4
+#define IDLE_C0_1               1
+
+/* 0 when cores never park */
+extern unsigned long idle_cycles;
+extern unsigned long idle_backoff_min;
+/* the wait instructions work in this guest */
+extern bool idle_waitpkg;
+
+/**
+ * idle_wait - parks the core until a word changes
+ * @word: the word, the first of its cache line
+ * @val: the value to wait out
+ *
+ * Returns when @word no longer holds @val, after at most idle_cycles, or
+ * earlier for an interrupt.
+ */
+static inline void idle_wait(volatile uint64_t * word, uint64_t val)
+{
+        unsigned long deadline = rdtsc() + idle_cycles;
+
+        if (!idle_waitpkg) {
+                while (*word == val && rdtsc() < deadline)
+                        cpu_relax();
+                return;
+        }
+
+        cpu_umonitor(word);
+        /* a write before the monitor was armed would go unnoticed */
+        if (*word != val)
+                return;
+        cpu_umwait(IDLE_C0_1, deadline);
+}
+
+/**
+ * idle_backoff - pauses a polling core that found nothing to do
+ * @backoff: the current pause in cycles, 0 while busy; updated
+ */
+static inline void idle_backoff(unsigned long * backoff)
+{
+        if (!*backoff)
+                *backoff = idle_backoff_min;
+        else if (*backoff < idle_backoff_min * IDLE_BACKOFF_MAX_US)
+                *backoff <<= 1;
+
+        if (!idle_waitpkg) {
+                unsigned long deadline = rdtsc() + *backoff;
+
+                while (rdtsc() < deadline)
+                        cpu_relax();
+                return;
+        }
+        cpu_tpause(IDLE_C0_1, rdtsc() + *backoff);
+}
+
+extern int idle_init(void);
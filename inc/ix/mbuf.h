@@ -28,6 +28,7 @@
 #pragma once
 
 #include <ix/stddef.h>
+#include <ix/errno.h>
 #include <ix/mem.h>
 #include <ix/mempool.h>
 #include <ix/cpu.h>
@@ -69,6 +70,8 @@ static inline void mbuf_iov_free(struct mbuf_iov *iov)
 }
 
 #define MBUF_INVALID_FG_ID 0xFFFF
+#define MBUF_INVALID_DEV 0xFFFF
+#define MBUF_TCP_FRAME 0xFFFE	/* dev_idx of requests framed from TCP */
 
 struct mbuf {
 	size_t len;		/* the length of the mbuf data */
@@ -83,6 +86,7 @@ struct mbuf {
 	void (*done)(struct mbuf *m);  /* called on free */
 	unsigned long done_data; /* extra data to pass to done() */
 	unsigned long timestamp; /* receive timestamp (in CPU clock ticks) */
+	uint16_t dev_idx;	/* the ingress device, or MBUF_INVALID_DEV */
 };
 
 #define MBUF_HEADER_LEN		64	/* one cache line */
@@ -92,6 +96,7 @@ struct mbuf {
 /* Offload flag bits */
 #define PKT_TX_IP_CKSUM      0x1000 /**< IP cksum of TX pkt. computed by NIC. */
 #define PKT_TX_TCP_CKSUM     0x2000 /**< TCP cksum of TX pkt. computed by NIC. */
+#define PKT_TX_UDP_CKSUM     0x4000 /**< UDP cksum of TX pkt. computed by NIC. */
 
 
 /**
@@ -178,6 +183,7 @@ static inline struct mbuf *mbuf_alloc(struct mempool *pool)
 
 	m->next = NULL;
 	m->done = &mbuf_default_done;
+	m->dev_idx = MBUF_INVALID_DEV;
 
 	return m;
 }
@@ -221,6 +227,42 @@ static inline struct mbuf *mbuf_alloc_local(void)
 	return mbuf_alloc(&percpu_get(mbuf_mempool));
 }
 
+/**
+ * mbuf_alloc_bulk_local - allocate several mbufs from the core-local mempool
+ * @bufs: the array to fill
+ * @n: the number of mbufs
+ *
+ * Either all @n mbufs are allocated or none is.
+ *
+ * Returns 0 if successful, otherwise -ENOMEM.
+ */
+static inline int mbuf_alloc_bulk_local(struct mbuf **bufs, int n)
+{
+	int i;
+
+	if (unlikely(mempool_alloc_bulk(&percpu_get(mbuf_mempool),
+					(void **) bufs, n)))
+		return -ENOMEM;
+
+	for (i = 0; i < n; i++) {
+		bufs[i]->next = NULL;
+		bufs[i]->done = &mbuf_default_done;
+		bufs[i]->dev_idx = MBUF_INVALID_DEV;
+	}
+
+	return 0;
+}
+
+/**
+ * mbuf_free_bulk - frees several mbufs to the core-local mempool
+ * @bufs: the mbufs
+ * @n: the number of mbufs
+ */
+static inline void mbuf_free_bulk(struct mbuf **bufs, int n)
+{
+	mempool_free_bulk(&percpu_get(mbuf_mempool), (void **) bufs, n);
+}
+
 extern int mbuf_init(void);
 extern int mbuf_init_cpu(void);
 extern void mbuf_exit_cpu(void);
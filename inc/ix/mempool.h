@@ -28,6 +28,7 @@
 #pragma once
 
 #include <ix/stddef.h>
+#include <ix/errno.h>
 #include <ix/mem.h>
 #include <assert.h>
 #include <ix/cpu.h>
@@ -41,6 +42,7 @@
 
 
 #define MEMPOOL_DEFAULT_CHUNKSIZE 128
+#define MEMPOOL_MAX_NODES 8
 
 
 #undef  DEBUG_MEMPOOL
@@ -56,12 +58,18 @@ struct mempool_hdr {
 	struct mempool_hdr *next_chunk;
 } __packed;
 
+/*
+ * The depot of free chunks is a lock-free (Treiber) stack. Its head packs
+ * the chunk pointer in the low 48 bits with a generation tag in the upper
+ * 16 bits, so that a single 64-bit compare-and-swap is safe against ABA.
+ */
+#define MEMPOOL_DEPOT_PTR_BITS	48
+#define MEMPOOL_DEPOT_PTR_MASK	((1UL << MEMPOOL_DEPOT_PTR_BITS) - 1)
 
 // one per data type
 struct mempool_datastore {
 	uint64_t                 magic;
-	spinlock_t               lock;
-	struct mempool_hdr      *chunk_head;
+	volatile uint64_t        depot_head __aligned(CACHE_LINE_SIZE);
 	void			*buf;
 	int			nr_pages;
 	uint32_t                nr_elems;
@@ -70,7 +78,10 @@ struct mempool_datastore {
 	int                     chunk_size;
 	int                     num_chunks;
 	int                     free_chunks;
-	int64_t                 num_locks;
+	int                     numa_node;
+	int                     page_size;
+	int64_t                 num_ops;
+	int64_t                 num_retries;
 	const char             *prettyname;
 	struct mempool_datastore *next_ds;
 #ifdef __KERNEL__
@@ -79,15 +90,24 @@ struct mempool_datastore {
 #endif
 };
 
+/*
+ * A datastore split into one partition per NUMA node that runs a configured
+ * core, indexed by node id. Unused partitions are left zeroed.
+ */
+struct mempool_numa_datastore {
+	struct mempool_datastore node[MEMPOOL_MAX_NODES];
+};
+
 
 struct mempool {
 	// hot fields:
 	struct mempool_hdr	*head;
 	int                     num_free;
 	size_t                  elem_len;
+	void			*buf;
+	size_t			buf_len;
 
 	uint64_t                 magic;
-	void			*buf;
 	struct mempool_datastore *datastore;
 	struct mempool_hdr      *private_chunk;
 //	int			nr_pages;
@@ -95,6 +115,10 @@ struct mempool {
 	uint32_t                nr_elems;
 	int                     nostraddle;
 	int                     chunk_size;
+	/* batched return of objects freed here but owned by another node */
+	struct mempool_numa_datastore *numa;
+	struct mempool_hdr	*remote_head[MEMPOOL_MAX_NODES];
+	int			remote_cnt[MEMPOOL_MAX_NODES];
 #ifdef __KERNEL__
 	void 			*iomap_addr;
 	uintptr_t		iomap_offset;
@@ -145,6 +169,18 @@ static inline int __mempool_get_sanity(void *a)
 #endif
 
 
+/**
+ * mempool_is_local - determines if an element belongs to a memory pool
+ * @m: the memory pool
+ * @ptr: the element
+ *
+ * Elements of the other node partitions of a NUMA datastore are not local.
+ */
+static inline bool mempool_is_local(struct mempool *m, void *ptr)
+{
+	return (uintptr_t) ptr - (uintptr_t) m->buf < m->buf_len;
+}
+
 /**
  * mempool_alloc - allocates an element from a memory pool
  * @m: the memory pool
@@ -173,11 +209,19 @@ static inline void *mempool_alloc(struct mempool *m)
  * NOTE: Must be the same memory pool that it was allocated from
  */
 extern void mempool_free_2(struct mempool *m, void *ptr);
+extern void mempool_free_remote(struct mempool *m, void *ptr);
+extern void mempool_flush_remote(struct mempool *m);
+extern void mempool_flush_remote_percpu(void);
 static inline void mempool_free(struct mempool *m, void *ptr)
 {
 	struct mempool_hdr *elem = (struct mempool_hdr *) ptr;
 	MEMPOOL_SANITY_ACCESS(ptr);
 
+	if (unlikely(!mempool_is_local(m, ptr))) {
+		mempool_free_remote(m, ptr);
+		return;
+	}
+
 	if (likely(m->num_free < m->chunk_size)) {
 		m->num_free++;
 		elem->next = m->head;
@@ -186,6 +230,96 @@ static inline void mempool_free(struct mempool *m, void *ptr)
 		mempool_free_2(m, ptr);
 }
 
+/**
+ * mempool_alloc_bulk - allocates several elements from a memory pool
+ * @m: the memory pool
+ * @objs: the array to fill
+ * @n: the number of elements
+ *
+ * Whole chunks are spliced in from the datastore when the core-local list
+ * runs dry. Either all @n elements are allocated or none is.
+ *
+ * Returns 0 if successful, otherwise -ENOMEM.
+ */
+extern struct mempool_hdr *mempool_refill(struct mempool *m);
+static inline int mempool_alloc_bulk(struct mempool *m, void **objs, int n)
+{
+	struct mempool_hdr *h = m->head;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (unlikely(!h)) {
+			m->head = NULL;
+			h = mempool_refill(m);
+			if (unlikely(!h)) {
+				/* give back what we got so far */
+				while (i--) {
+					h = (struct mempool_hdr *) objs[i];
+					h->next = m->head;
+					m->head = h;
+				}
+				return -ENOMEM;
+			}
+		}
+		objs[i] = h;
+		h = h->next;
+	}
+
+	m->head = h;
+	m->num_free -= n;
+	return 0;
+}
+
+/**
+ * mempool_free_bulk - frees several elements back in to a memory pool
+ * @m: the memory pool
+ * @objs: the elements
+ * @n: the number of elements
+ *
+ * The elements are linked together and spliced onto the core-local list.
+ * When the list grows past a chunk, it is handed to the datastore as a
+ * whole. Elements of other NUMA nodes take the remote return path.
+ *
+ * NOTE: Must be the same memory pool that they were allocated from
+ */
+extern void mempool_free_bulk_2(struct mempool *m, struct mempool_hdr *first,
+				struct mempool_hdr *last, int n);
+static inline void mempool_free_bulk(struct mempool *m, void **objs, int n)
+{
+	struct mempool_hdr *first = NULL, *last = NULL, *h;
+	int i, nr = 0;
+
+	for (i = 0; i < n; i++) {
+		h = (struct mempool_hdr *) objs[i];
+		MEMPOOL_SANITY_ACCESS(h);
+		if (unlikely(!mempool_is_local(m, h))) {
+			mempool_free_remote(m, h);
+			continue;
+		}
+		if (last)
+			last->next = h;
+		else
+			first = h;
+		last = h;
+		nr++;
+	}
+
+	if (unlikely(!nr))
+		return;
+	n = nr;
+
+	if (likely(m->num_free + n <= m->chunk_size)) {
+		last->next = m->head;
+		m->head = first;
+		m->num_free += n;
+	} else
+		mempool_free_bulk_2(m, first, last, n);
+}
+
+#ifdef MEMPOOL_BENCH
+extern void mempool_bench(struct mempool *m);
+#endif
+
 static inline void *mempool_idx_to_ptr(struct mempool *m, uint32_t idx, int elem_len)
 {
 	void *p;
@@ -205,8 +339,78 @@ static inline uintptr_t mempool_ptr_to_idx(struct mempool *m, void *p, int elem_
 }
 
 
+/**
+ * mempool_numa_node - finds the NUMA partition an element belongs to
+ * @nds: the NUMA datastore
+ * @ptr: the element
+ *
+ * Returns the node id, or -1 if @ptr is not part of @nds.
+ */
+static inline int mempool_numa_node(struct mempool_numa_datastore *nds, void *ptr)
+{
+	int i;
+
+	for (i = 0; i < MEMPOOL_MAX_NODES; i++) {
+		struct mempool_datastore *mds = &nds->node[i];
+		if ((uintptr_t) ptr - (uintptr_t) mds->buf <
+		    (size_t) mds->nr_pages * PGSIZE_2MB)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * mempool_numa_alloc - allocates from a set of per-node memory pools
+ * @pools: the memory pools, indexed by node id
+ * @node: the preferred node
+ *
+ * Falls back to the other nodes when @node is exhausted.
+ *
+ * Returns a pointer to the allocated element or NULL if unsuccessful.
+ */
+static inline void *mempool_numa_alloc(struct mempool *pools, int node)
+{
+	void *p = mempool_alloc(&pools[node]);
+	int i;
+
+	if (likely(p))
+		return p;
+
+	for (i = 0; i < MEMPOOL_MAX_NODES; i++) {
+		if (i == node || pools[i].magic != MEMPOOL_MAGIC)
+			continue;
+		p = mempool_alloc(&pools[i]);
+		if (p)
+			return p;
+	}
+
+	return NULL;
+}
+
+/**
+ * mempool_numa_free - frees an element to its node in a set of memory pools
+ * @pools: the memory pools, indexed by node id
+ * @nds: the NUMA datastore backing @pools
+ * @ptr: the element
+ */
+static inline void mempool_numa_free(struct mempool *pools,
+				     struct mempool_numa_datastore *nds,
+				     void *ptr)
+{
+	int node = mempool_numa_node(nds, ptr);
+
+	assert(node >= 0);
+	mempool_free(&pools[node], ptr);
+}
+
 extern int mempool_create_datastore(struct mempool_datastore *m, int nr_elems, size_t elem_len, int nostraddle, int chunk_size, const char *prettyname);
+extern int mempool_create_datastore_on_node(struct mempool_datastore *m, int nr_elems, size_t elem_len, int nostraddle, int chunk_size, const char *prettyname, int numa_node);
+extern int mempool_create_numa_datastore(struct mempool_numa_datastore *nds, int nr_elems, size_t elem_len, int nostraddle, int chunk_size, const char *prettyname);
+extern int mempool_create_guarded_numa_datastore(struct mempool_numa_datastore *nds, int nr_elems, size_t elem_len, int chunk_size, const char *prettyname);
+extern bool mempool_guard_fault(uintptr_t addr);
 extern int mempool_create(struct mempool *m, struct mempool_datastore *mds, int16_t sanity_type, int16_t sanity_id);
+extern int mempool_create_numa(struct mempool *m, struct mempool_numa_datastore *nds, int16_t sanity_type, int16_t sanity_id, int numa_node);
 extern void mempool_destroy(struct mempool *m);
 
 
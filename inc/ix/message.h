@@ -0,0 +1,113 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * message.h - multi-packet request and response messages over UDP
+ *
+ * When 'msg_layer' is enabled, every request and response payload starts
+ * with a struct msg_hdr. A message longer than one datagram is split into
+ * MSG_SEG_LEN-byte segments that share a message id. The networker
+ * reassembles requests into a message buffer before they reach the
+ * dispatcher, and workers send responses as one scatter-gather packet per
+ * segment, pointing into the message buffer.
+ */
+
+#pragma once
+
+#include <ix/byteorder.h>
+#include <ix/cpu.h>
+#include <ix/errno.h>
+#include <ix/mbuf.h>
+#include <ix/mempool.h>
+
+#include <net/udp.h>
+
+struct msg_hdr {
+        uint32_t msg_id;        /* chosen by the client, echoed in replies */
+        uint32_t msg_len;       /* the length of the whole message */
+        uint16_t seg;           /* the index of this segment */
+        uint16_t nr_segs;       /* the number of segments of the message */
+} __packed;
+
+#define MSG_SEG_LEN     (UDP_MAX_LEN - sizeof(struct msg_hdr))
+#define MSG_MAX_LEN     (64 * 1024)
+#define MSG_MAX_SEGS    ((MSG_MAX_LEN + MSG_SEG_LEN - 1) / MSG_SEG_LEN)
+
+/*
+ * A message buffer: the header keeps the data cache-line aligned. The
+ * reference count is only touched by the core that sends the response.
+ */
+struct msg_buf {
+        unsigned int refs;
+        char pad[60];
+        char data[MSG_MAX_LEN];
+};
+
+DECLARE_PERCPU(struct mempool, msg_pool);
+
+extern struct mbuf * msg_input(struct mbuf * pkt);
+
+/**
+ * msg_parse - locates the message carried by a request mbuf
+ * @pkt: the request, as delivered by the networker
+ * @payload: the UDP payload of @pkt
+ * @data_ptr: set to the message data
+ * @len_ptr: holds the UDP payload length, set to the message length
+ * @msg_id_ptr: set to the message id
+ *
+ * Returns 0 if successful, otherwise -EINVAL.
+ */
+static inline int msg_parse(struct mbuf * pkt, void * payload,
+                            void ** data_ptr, uint32_t * len_ptr,
+                            uint32_t * msg_id_ptr)
+{
+        struct msg_hdr * hdr = payload;
+
+        if (unlikely(*len_ptr < sizeof(struct msg_hdr)))
+                return -EINVAL;
+
+        (*msg_id_ptr) = ntoh32(hdr->msg_id);
+        if (pkt->done_data) {
+                /* reassembled by the networker */
+                (*data_ptr) = ((struct msg_buf *) pkt->done_data)->data;
+                (*len_ptr) = ntoh32(hdr->msg_len);
+        } else {
+                (*data_ptr) = hdr + 1;
+                (*len_ptr) -= sizeof(struct msg_hdr);
+        }
+        return 0;
+}
+
+/**
+ * msg_release - frees the reassembly buffer of a request, if any
+ * @pkt: the request mbuf
+ *
+ * Must be called from a core with a msg_pool, with preemption disabled.
+ */
+static inline void msg_release(struct mbuf * pkt)
+{
+        if (pkt->done_data) {
+                mempool_free(&percpu_get(msg_pool), (void *) pkt->done_data);
+                pkt->done_data = 0;
+        }
+}
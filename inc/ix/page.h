@@ -127,6 +127,8 @@ static inline void page_put(void *addr)
 
 extern void *
 page_alloc_contig_on_node(unsigned int nr, int numa_node);
+extern void *
+page_alloc_contig_1gb_on_node(unsigned int nr, int numa_node);
 extern void page_free(void *addr);
 extern void page_free_contig(void *addr, unsigned int nr);
 
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * preempt.h - cooperative yield and non-preemptible sections for handlers
+ *
+ * A handler may bracket a critical section (e.g. one holding a spinlock that
+ * other workers contend on) with preempt_disable()/preempt_enable(). A
+ * preemption IPI that lands inside the section is recorded and delivered
+ * when the outermost preempt_enable() runs.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <ix/compiler.h>
+
+extern __thread volatile unsigned int preempt_cnt;
+extern __thread volatile uint8_t preempt_pending;
+
+extern void shinjuku_yield(void);
+
+/**
+ * preempt_disable - prevents the running handler from being preempted
+ *
+ * Calls may nest; preemption is re-enabled by the matching outermost
+ * preempt_enable().
+ */
+static inline void preempt_disable(void)
+{
+        preempt_cnt++;
+        asm volatile ("" ::: "memory");
+}
+
+/**
+ * preempt_enable - ends a non-preemptible section
+ *
+ * If a preemption was requested while the section was running, the handler
+ * yields back to the dispatcher here.
+ */
+static inline void preempt_enable(void)
+{
+        asm volatile ("" ::: "memory");
+        if (--preempt_cnt == 0 && unlikely(preempt_pending))
+                shinjuku_yield();
+}
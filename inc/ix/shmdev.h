@@ -0,0 +1,76 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * shmdev.h - a software ethernet device backed by shared memory
+ *
+ * A device configured as "shm:<path>" maps the file at <path> (typically
+ * under /dev/shm) and exchanges whole ethernet frames through the rings in
+ * it, instead of driving a NIC. Another process on the same host, such as
+ * a load generator, maps the same file and plays the part of the network:
+ * it writes request frames to the rx ring and reads the frames sent by
+ * every core of the dataplane from the tx rings. It has to answer ARP
+ * requests and address its frames to the MAC address found in the header,
+ * like any other host.
+ *
+ * Each ring has a single producer and a single consumer, which only write
+ * head and tail respectively. The header is only valid once magic is set.
+ *
+ * This file has no dependencies, so that it can be included by programs
+ * outside of the dataplane.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define SHMDEV_MAGIC		0x534a4b31	/* "SJK1" */
+/* slots, a power of 2, above ETH_TX_RECLAIM_LOW so that lazy reclaiming
+ * is not forced on every transmit */
+#define SHMDEV_RING_SIZE	1024
+#define SHMDEV_SLOT_LEN		2048
+#define SHMDEV_FRAME_MAX	(SHMDEV_SLOT_LEN - sizeof(uint32_t))
+#define SHMDEV_MAX_TX_RINGS	32
+
+struct shmdev_slot {
+	uint32_t len;				/* of the frame */
+	uint8_t data[SHMDEV_FRAME_MAX];		/* starting with the MAC header */
+};
+
+struct shmdev_ring {
+	volatile uint32_t head;			/* written by the producer */
+	char pad0[60];
+	volatile uint32_t tail;			/* written by the consumer */
+	char pad1[60];
+	struct shmdev_slot slots[SHMDEV_RING_SIZE];
+} __attribute__((aligned(64)));
+
+struct shmdev_region {
+	volatile uint32_t magic;
+	uint32_t nr_tx_rings;			/* in use, one per core */
+	uint8_t mac[6];				/* of the dataplane */
+	char pad[50];
+	struct shmdev_ring rx;			/* frames to the dataplane */
+	struct shmdev_ring tx[SHMDEV_MAX_TX_RINGS]; /* frames from it */
+} __attribute__((aligned(64)));
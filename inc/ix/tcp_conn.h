@@ -0,0 +1,106 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * tcp_conn.h - requests and responses over TCP connections
+ *
+ * When 'tcp' is enabled, the networker runs the TCP stack for connections
+ * to the request ports. Each request on a connection is a struct msg_hdr
+ * (segment fields unused) followed by msg_len bytes. The networker frames
+ * the stream into requests, each one copied into its own mbuf that goes
+ * through the dispatcher like a datagram, so it is scheduled and preempted
+ * the same way. Workers hand responses, and the request mbuf once the
+ * handler is done, back to the networker through the tcp_rings.
+ *
+ * Up to 'tcp_window' requests of a connection are dispatched at a time, so
+ * a long request does not hold back the short ones behind it. Requests are
+ * numbered per connection, responses carry the number of their request and
+ * the networker writes them out in request order. (Datagram requests are
+ * not reordered: with the message layer, responses carry the message id of
+ * their request instead.)
+ */
+
+#pragma once
+
+#include <ix/mbuf.h>
+#include <ix/syscall.h>
+
+struct eth_fg;
+struct mbuf_ring;
+struct msg_buf;
+
+#define TCP_FRAME_REQ   0x01
+#define TCP_FRAME_RESP  0x02
+
+/*
+ * The start of the data of a framed request or response mbuf. Responses
+ * built with shinjuku_resp_init() carry their payload from UDP_PKT_SIZE on,
+ * so they do not have the 4-tuple, which is only used by requests.
+ */
+struct tcp_frame {
+        uint32_t conn;          /* the connection slot */
+        uint32_t gen;           /* the generation of the slot */
+        uint32_t msg_id;
+        uint32_t len;           /* the length of the payload */
+        uint32_t seq;           /* the number of the request on the conn */
+        uint8_t kind;           /* TCP_FRAME_REQ or TCP_FRAME_RESP */
+        uint8_t type;           /* the request type */
+        void * data;            /* the payload */
+        struct ip_tuple id;     /* requests only, in host byte order */
+};
+
+/**
+ * tcp_frame - the frame descriptor of a TCP request or response mbuf
+ * @pkt: the mbuf
+ */
+static inline struct tcp_frame * tcp_frame(struct mbuf * pkt)
+{
+        return mbuf_mtod(pkt, struct tcp_frame *);
+}
+
+/**
+ * tcp_frame_is_req - determines if a request mbuf was framed from TCP
+ * @pkt: the request mbuf, as delivered by the networker
+ */
+static inline bool tcp_frame_is_req(struct mbuf * pkt)
+{
+        return pkt->dev_idx == MBUF_TCP_FRAME;
+}
+
+/* networker */
+extern struct eth_fg * tcp_conn_fg;
+
+extern int tcp_conn_poll(int num_workers);
+extern int tcp_conn_ready(int num_recv);
+extern int tcp_conn_start(void);
+
+/* workers and dispatcher */
+extern int tcp_conn_send(struct mbuf_ring * r, struct mbuf * req,
+                         struct mbuf * resp, void * data, size_t len,
+                         struct msg_buf * buf);
+extern int tcp_conn_reply(struct mbuf_ring * r, struct mbuf * req,
+                          const void * data, size_t len);
+extern void tcp_conn_done(struct mbuf_ring * r, struct mbuf * req);
+
+extern int tcp_conn_init(void);
+extern int tcp_conn_init_cpu(void);
@@ -30,6 +30,7 @@
 #include <ix/log.h>
 #include <ix/mbuf.h>
 #include <ix/ethdev.h>
+#include <ix/hash.h>
 
 #include <asm/chksum.h>
 
@@ -62,8 +63,95 @@ static inline void ip_setup_header(struct ip_hdr *iphdr, uint8_t proto,
         iphdr->dst_addr.addr = hton32(daddr);
 }
 
+/*
+ * Per-flow prebuilt Ethernet/IP/UDP headers. Responses to a flow that has
+ * been seen before only need a 42-byte copy and a length patch; the IP and
+ * UDP checksums are left to the NIC. A template is only valid for the ARP
+ * epoch it was built in.
+ */
+#define UDP_TMPL_NR             256
+#define UDP_FLOW_HASH_SEED      0x9e3779b9
+
+struct udp_tmpl {
+        uint32_t dst_ip;
+        uint16_t src_port;
+        uint16_t dst_port;
+        uint32_t arp_epoch;
+        uint32_t pseudo_sum;
+        char hdr[UDP_PKT_SIZE];
+} __attribute__((aligned(64)));
+
+DECLARE_PERCPU(struct udp_tmpl, udp_tmpls[UDP_TMPL_NR]);
+
+/**
+ * udp_flow_hash - hashes the remote end and the ports of a flow
+ * @id: the 4-tuple
+ */
+static inline uint32_t udp_flow_hash(struct ip_tuple * id)
+{
+        uint64_t key = ((uint64_t) id->dst_ip << 32) |
+                       ((uint32_t) id->src_port << 16) | id->dst_port;
+
+        return hash_crc32c_one(UDP_FLOW_HASH_SEED, key);
+}
+
+static inline struct udp_tmpl * udp_tmpl_slot(struct ip_tuple * id)
+{
+        return &percpu_get(udp_tmpls[udp_flow_hash(id) & (UDP_TMPL_NR - 1)]);
+}
+
+/**
+ * udp_select_txq - picks the TX queue of this core for a UDP packet
+ * @pkt: the mbuf to send
+ * @id: the 4-tuple used for the transmission
+ *
+ * With several (bonded) devices, a packet built in a receive buffer leaves
+ * through the device it arrived on; other packets are spread over the
+ * devices by flow, which keeps each flow on one device and in order.
+ */
+static inline struct eth_tx_queue * udp_select_txq(struct mbuf * pkt,
+                                                   struct ip_tuple * id)
+{
+        int nr = percpu_get(eth_num_queues);
+
+        if (likely(nr == 1))
+                return percpu_get(eth_txqs)[0];
+        if (pkt->dev_idx < nr)
+                return percpu_get(eth_txqs)[pkt->dev_idx];
+        return percpu_get(eth_txqs)[udp_flow_hash(id) % nr];
+}
+
+/**
+ * udp_pseudo_sum - computes the unfolded UDP pseudo-header sum
+ * @saddr: the source address (host order)
+ * @daddr: the destination address (host order)
+ *
+ * The UDP length is not included, since it changes per packet.
+ */
+static inline uint32_t udp_pseudo_sum(uint32_t saddr, uint32_t daddr)
+{
+        uint32_t s = hton32(saddr), d = hton32(daddr);
+
+        return (s & 0xffff) + (s >> 16) + (d & 0xffff) + (d >> 16) +
+               hton16(IPPROTO_UDP);
+}
+
+/**
+ * chksum_fold - folds a 32-bit one's complement sum into 16 bits
+ * @sum: the sum
+ *
+ * The result is not inverted, which is what the NIC expects as the seed of
+ * an offloaded L4 checksum.
+ */
+static inline uint16_t chksum_fold(uint32_t sum)
+{
+        sum = (sum & 0xffff) + (sum >> 16);
+        sum = (sum & 0xffff) + (sum >> 16);
+        return (uint16_t) sum;
+}
+
 DECLARE_PERCPU(struct mempool, response_pool);
-struct mempool_datastore response_datastore;
+struct mempool_numa_datastore response_datastore;
 
 /**
  * udp_mbuf_done frees mbuf after the transmission of a UDP packet
@@ -79,6 +167,94 @@ static inline void udp_mbuf_done(struct mbuf * pkt)
         mbuf_free(pkt);
 }
 
+/**
+ * udp_setup_headers - fills in the Ethernet, IP and UDP headers of a packet
+ * @pkt: the mbuf, with headers starting at the beginning of its data
+ * @len: the length of the UDP payload
+ * @id: the 4-tuple used for the transmission
+ *
+ * The IP and UDP checksums are offloaded to the NIC: the IP checksum is left
+ * zero and the UDP checksum is seeded with the pseudo-header sum. Headers
+ * are served from the per-flow template cache when possible.
+ *
+ * Returns 0 if successful, -RET_AGAIN if the destination is not in the ARP
+ * table yet; all headers but the destination MAC are then filled in.
+ */
+static inline int udp_setup_headers(struct mbuf * pkt, size_t len,
+                                    struct ip_tuple * id)
+{
+        struct eth_hdr *ethhdr = mbuf_mtod(pkt, struct eth_hdr *);
+        struct ip_hdr *iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
+        struct udp_hdr *udphdr = mbuf_nextd(iphdr, struct udp_hdr *);
+        uint16_t full_len = len + sizeof(struct udp_hdr);
+        struct udp_tmpl *t = udp_tmpl_slot(id);
+        struct ip_addr dst_addr;
+        int ret;
+
+        pkt->ol_flags = PKT_TX_IP_CKSUM | PKT_TX_UDP_CKSUM;
+
+        if (likely(t->arp_epoch == arp_epoch && t->dst_ip == id->dst_ip &&
+                   t->src_port == id->src_port &&
+                   t->dst_port == id->dst_port)) {
+                memcpy(ethhdr, t->hdr, UDP_PKT_SIZE);
+                iphdr->len = hton16(sizeof(struct ip_hdr) + full_len);
+                udphdr->len = hton16(full_len);
+                udphdr->chksum = chksum_fold(t->pseudo_sum + hton16(full_len));
+                return 0;
+        }
+
+        t->arp_epoch = arp_epoch;
+        dst_addr.addr = id->dst_ip;
+        ret = arp_lookup_mac(&dst_addr, &ethhdr->dhost);
+
+        ethhdr->shost = CFG.mac;
+        ethhdr->type = hton16(ETHTYPE_IP);
+
+        ip_setup_header(iphdr, IPPROTO_UDP,
+                        CFG.host_addr.addr, id->dst_ip, full_len);
+
+        udphdr->src_port = hton16(id->src_port);
+        udphdr->dst_port = hton16(id->dst_port);
+        udphdr->len = hton16(full_len);
+
+        t->dst_ip = id->dst_ip;
+        t->src_port = id->src_port;
+        t->dst_port = id->dst_port;
+        t->pseudo_sum = udp_pseudo_sum(CFG.host_addr.addr, id->dst_ip);
+        udphdr->chksum = chksum_fold(t->pseudo_sum + hton16(full_len));
+
+        if (unlikely(ret)) {
+                t->arp_epoch = 0;
+                return -RET_AGAIN;
+        }
+
+        memcpy(t->hdr, ethhdr, UDP_PKT_SIZE);
+        return 0;
+}
+
+/**
+ * udp_xmit - queues a UDP packet for transmission
+ * @pkt: the mbuf, with its length set
+ * @id: the 4-tuple used for the transmission
+ * @ret: the result of udp_setup_headers() for @pkt
+ *
+ * A packet whose destination is still being resolved is parked and sent
+ * once the ARP reply arrives, instead of being dropped.
+ *
+ * On success the mbuf is owned by the TX path, otherwise it is left to the
+ * caller.
+ */
+static inline int udp_xmit(struct mbuf * pkt, struct ip_tuple * id, int ret)
+{
+        struct eth_tx_queue *txq = udp_select_txq(pkt, id);
+
+        if (likely(!ret))
+                return eth_send(txq, pkt);
+        if (ret == -RET_AGAIN && !arp_park_pkt(pkt, txq))
+                return 0;
+        return ret;
+}
+
 /**
  * udp_send sends a UDP packet
  * @data: the data to send
@@ -122,39 +298,9 @@ static inline int udp_send(void * data, size_t len, struct ip_tuple * id,
 
         pkt->done = &udp_mbuf_done;
         pkt->done_data = cookie;
-
-        struct eth_hdr *ethhdr = mbuf_mtod(pkt, struct eth_hdr *);
-        struct ip_hdr *iphdr = mbuf_nextd(ethhdr, struct ip_hdr *);
-        struct udp_hdr *udphdr = mbuf_nextd(iphdr, struct udp_hdr *);
-        size_t full_len = len + sizeof(struct udp_hdr);
-        struct ip_addr dst_addr;
-
-        dst_addr.addr = id->dst_ip;
-        if (arp_lookup_mac(&dst_addr, &ethhdr->dhost)) {
-                ret = -RET_AGAIN;
-                goto out;
-        }
-
-        ethhdr->shost = CFG.mac;
-        ethhdr->type = hton16(ETHTYPE_IP);
-
-        ip_setup_header(iphdr, IPPROTO_UDP,
-                        CFG.host_addr.addr, id->dst_ip, full_len);
-        iphdr->chksum = chksum_internet((void *) iphdr, sizeof(struct ip_hdr));
-
-        udphdr->src_port = hton16(id->src_port);
-        udphdr->dst_port = hton16(id->dst_port);
-        udphdr->len = hton16(full_len);
-        udphdr->chksum = 0;
-
-        pkt->ol_flags = 0;
         pkt->len = UDP_PKT_SIZE;
 
-        if (eth_dev_count > 1)
-                panic("udp_send not implemented for bonded interfaces\n");
-        else
-            ret = eth_send(percpu_get(eth_txqs)[0], pkt);
-
+        ret = udp_xmit(pkt, id, udp_setup_headers(pkt, len, id));
         if (ret)
                 goto out;
 
@@ -164,3 +310,24 @@ out:
         mbuf_free(pkt);
         return ret;
 }
+
+/**
+ * udp_send_pkt - sends a UDP packet whose payload is stored in the mbuf
+ * @pkt: the mbuf, with the payload placed right after UDP_PKT_SIZE
+ * @len: the length of the payload
+ * @id: the 4-tuple used for the transmission
+ *
+ * On success the mbuf is owned by the TX path, otherwise it is left to the
+ * caller.
+ */
+static inline int udp_send_pkt(struct mbuf * pkt, size_t len,
+                               struct ip_tuple * id)
+{
+        if (unlikely(len > UDP_MAX_LEN))
+                return -RET_INVAL;
+
+        pkt->nr_iov = 0;
+        pkt->len = UDP_PKT_SIZE + len;
+
+        return udp_xmit(pkt, id, udp_setup_headers(pkt, len, id));
+}
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <ix/cpu.h>
+
 #include <net/ethernet.h>
 #include <net/ip.h>
 
@@ -67,4 +69,23 @@ enum {
 	ARP_OP_REVREPLY = 4,	/* response protocol addr given hw addr */
 };
 
+extern volatile uint32_t arp_epoch;
+
+struct mbuf;
+struct eth_tx_queue;
+
+DECLARE_PERCPU(int, arp_nr_parked);
+
 extern int arp_lookup_mac(struct ip_addr *addr, struct eth_addr *mac);
+extern int arp_park_pkt(struct mbuf *pkt, struct eth_tx_queue *txq);
+extern void __arp_process_parked(void);
+extern void arp_process_requests(void);
+
+/**
+ * arp_process_parked - retries the packets of this core waiting for ARP
+ */
+static inline void arp_process_parked(void)
+{
+	if (unlikely(percpu_get(arp_nr_parked)))
+		__arp_process_parked();
+}
@@ -0,0 +1,52 @@
+#!/usr/bin/python3
+
+# Compares latency dumps of the clients, the harness and the simulator, for
+# example measured against simulated latencies of the same request type:
+#   ./compare.py /tmp/lats.bin /tmp/des0.bin
+# Prints the percentiles of each dump and the Kolmogorov-Smirnov distance of
+# each one to the first.
+
+import array
+import bisect
+import os
+import sys
+
+PCTS = [50, 90, 99, 99.9]
+
+
+def load(latsFile):
+    lats = array.array('Q')
+    with open(latsFile, 'rb') as f:
+        lats.frombytes(f.read())
+    return sorted(l / 1e3 for l in lats)
+
+
+def percentile(lats, p):
+    if not lats:
+        return 0
+    return lats[min(len(lats) - 1, int(p / 100 * len(lats)))]
+
+
+def ks(a, b):
+    if not a or not b:
+        return 1
+    return max(abs(bisect.bisect_right(a, x) / len(a) -
+                   bisect.bisect_right(b, x) / len(b)) for x in a + b)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        print('Usage: %s REFERENCE.bin OTHER.bin [...]' % sys.argv[0])
+        sys.exit(-1)
+
+    ref = None
+    print('%-24s %10s ' % ('file', 'samples') +
+          ' '.join('%10s' % ('p%g' % p) for p in PCTS) + ' %8s' % 'ks')
+    for latsFile in sys.argv[1:]:
+        assert os.path.exists(latsFile)
+        lats = load(latsFile)
+        if ref is None:
+            ref = lats
+        print('%-24s %10d ' % (os.path.basename(latsFile), len(lats)) +
+              ' '.join('%10.1f' % percentile(lats, p) for p in PCTS) +
+              ' %8.4f' % ks(ref, lats))
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * des.c - discrete-event simulator of the dispatcher and its workers
+ *
+ * Requests queue in the task queues of the dispatcher and are picked by
+ * smart_tskq_dequeue(), as in dispatcher.c. Time is in ns. Every busy
+ * worker has one pending event, the end of its request or of its quantum,
+ * kept in a binary heap; the next arrival is the only other event.
+ *
+ * The dispatcher is modelled as in the dataplane: a worker that is done
+ * gets the next task at once, a new request needs a context from a pool of
+ * fixed size or is dropped, and a request that runs for a quantum is
+ * preempted whether or not others wait, and goes to the tail of its queue
+ * with its original timestamp. The worker then loses the preemption cost.
+ * A non-zero dispatch cost serializes dispatches on the dispatcher.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ix/taskqueue.h>
+
+#include "sim.h"
+
+#define PACKET      0x01
+#define CONTEXT     0x02
+
+struct cfg_parameters CFG;
+
+struct des_req {
+        uint64_t arrival;
+        uint64_t left;
+        uint8_t type;
+};
+
+struct des_worker {
+        struct des_req *req;
+        uint64_t timestamp;     /* of the task, for requeueing */
+        uint64_t idle_since;
+};
+
+struct des_event {
+        uint64_t time;
+        int worker;
+};
+
+static struct des_worker *workers;
+static struct des_event *heap;
+static int heap_len;
+static int *idle;
+static int nr_idle;
+static uint64_t queued;
+
+static void heap_push(uint64_t time, int worker)
+{
+        int i = heap_len++, parent;
+
+        while (i) {
+                parent = (i - 1) / 2;
+                if (heap[parent].time <= time)
+                        break;
+                heap[i] = heap[parent];
+                i = parent;
+        }
+        heap[i].time = time;
+        heap[i].worker = worker;
+}
+
+static struct des_event heap_pop(void)
+{
+        struct des_event top = heap[0], last = heap[--heap_len];
+        int i = 0, child;
+
+        while ((child = 2 * i + 1) < heap_len) {
+                if (child + 1 < heap_len &&
+                    heap[child + 1].time < heap[child].time)
+                        child++;
+                if (last.time <= heap[child].time)
+                        break;
+                heap[i] = heap[child];
+                i = child;
+        }
+        heap[i] = last;
+        return top;
+}
+
+static int enqueue(struct des_req *req, uint8_t category, uint64_t timestamp)
+{
+        struct task_queue *tq = &tskq[req->type];
+
+        if (tskq_enqueue_tail(tq, category == CONTEXT ? req : NULL, req,
+                              req->type, category, timestamp))
+                return -ENOMEM;
+        queued++;
+        return 0;
+}
+
+static void dispatch(const struct des_params *p, struct sim_results *r,
+                     uint64_t now, uint64_t *dispatcher_free, long *contexts)
+{
+        struct des_worker *w;
+        struct des_req *req;
+        void *rnbl, *mbuf;
+        uint8_t type, category;
+        uint64_t timestamp, start, slice;
+        int i;
+
+        while (nr_idle && queued) {
+                /* the policy only picks tasks that have waited a bit */
+                if (smart_tskq_dequeue(tskq, &rnbl, &mbuf, &type, &category,
+                                       &timestamp, now + 1))
+                        break;
+                queued--;
+                req = mbuf;
+                if (category == PACKET) {
+                        if (!*contexts) {
+                                r->dropped++;
+                                free(req);
+                                continue;
+                        }
+                        (*contexts)--;
+                }
+
+                i = idle[--nr_idle];
+                w = &workers[i];
+                w->req = req;
+                w->timestamp = timestamp;
+                start = now;
+                if (p->dispatch_ns) {
+                        if (*dispatcher_free > start)
+                                start = *dispatcher_free;
+                        start += p->dispatch_ns;
+                        *dispatcher_free = start;
+                }
+                /* a parked worker takes a while to notice its request */
+                if (p->wake_ns && start - w->idle_since > p->idle_ns)
+                        start += p->wake_ns;
+                if (p->quantum_ns && req->left > p->quantum_ns) {
+                        slice = p->quantum_ns;
+                        req->left -= slice;
+                        heap_push(start + slice + p->preempt_ns, i);
+                } else {
+                        slice = req->left;
+                        req->left = 0;
+                        heap_push(start + slice, i);
+                }
+        }
+}
+
+/**
+ * des_run - simulates the dispatcher on a stream of requests
+ * @p: the parameters of the run
+ * @r: filled with the results
+ *
+ * Runs until all requests are finished or dropped.
+ *
+ * Returns 0 if successful, otherwise failure.
+ */
+int des_run(const struct des_params *p, struct sim_results *r)
+{
+        struct sim_req next;
+        struct des_event ev;
+        struct des_worker *w;
+        struct des_req *req;
+        uint64_t now, dispatcher_free = 0;
+        long contexts = p->contexts;
+        int i, t, ret = 0;
+
+        if (p->num_workers < 1 || p->num_types < 1 ||
+            p->num_types > CFG_MAX_PORTS || p->num_types > SIM_MAX_TYPES)
+                return -EINVAL;
+
+        memset(r, 0, sizeof(*r));
+        r->ticks_per_ns = 1;
+        CFG.num_ports = p->num_types;
+        for (t = 0; t < p->num_types; t++)
+                CFG.slos[t] = p->slo_ns[t];
+        task_mempool.elem_len = sizeof(struct task);
+
+        workers = calloc(p->num_workers, sizeof(*workers));
+        heap = calloc(p->num_workers, sizeof(*heap));
+        idle = calloc(p->num_workers, sizeof(*idle));
+        if (!workers || !heap || !idle) {
+                ret = -ENOMEM;
+                goto out;
+        }
+        heap_len = nr_idle = queued = 0;
+        for (i = 0; i < p->num_workers; i++)
+                idle[nr_idle++] = p->num_workers - 1 - i;
+
+        if (p->num_reqs)
+                p->next(p->arg, &next);
+        while (r->sent < p->num_reqs || heap_len) {
+                if (r->sent < p->num_reqs &&
+                    (!heap_len || next.arrival_ns <= heap[0].time)) {
+                        now = next.arrival_ns;
+                        req = malloc(sizeof(*req));
+                        if (!req) {
+                                ret = -ENOMEM;
+                                goto out;
+                        }
+                        req->arrival = now;
+                        req->left = next.work_ns;
+                        req->type = next.type;
+                        r->sent++;
+                        if (enqueue(req, PACKET, now)) {
+                                free(req);
+                                ret = -ENOMEM;
+                                goto out;
+                        }
+                        if (r->sent < p->num_reqs)
+                                p->next(p->arg, &next);
+                } else {
+                        ev = heap_pop();
+                        now = ev.time;
+                        w = &workers[ev.worker];
+                        req = w->req;
+                        if (req->left) {
+                                r->preemptions++;
+                                if (enqueue(req, CONTEXT, w->timestamp)) {
+                                        ret = -ENOMEM;
+                                        goto out;
+                                }
+                        } else {
+                                ret = sim_lats_add(&r->lats[req->type],
+                                                   now - req->arrival);
+                                if (ret)
+                                        goto out;
+                                free(req);
+                                contexts++;
+                        }
+                        w->req = NULL;
+                        w->idle_since = now;
+                        idle[nr_idle++] = ev.worker;
+                }
+                dispatch(p, r, now, &dispatcher_free, &contexts);
+        }
+
+out:
+        free(workers);
+        free(heap);
+        free(idle);
+        return ret;
+}
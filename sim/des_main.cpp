@@ -0,0 +1,147 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * des_main.cpp - runs the discrete-event simulator on a synthetic workload
+ *
+ * Usage: des [-w WORKERS] [-r QPS] [-n REQUESTS] [-q QUANTUM_NS]
+ *            [-p PREEMPT_NS] [-d DISPATCH_NS] [-i IDLE_NS -k WAKE_NS]
+ *            [-c CONTEXTS] [-S SEED] [-o PREFIX] -t TYPE [-t TYPE ...]
+ *
+ * See workload.h for the format of TYPE. Prints the latency CDF of each
+ * type, one "TYPE FRACTION LATENCY_US" line per point, and a summary. With
+ * -o, the latencies of type N are also dumped to PREFIX<N>.bin. With -k,
+ * a worker that was idle for more than IDLE_NS starts its next request
+ * WAKE_NS late, as a core parked by 'idle_us' would.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+#include <stdexcept>
+
+#include "lats.h"
+#include "sim.h"
+#include "workload.h"
+
+static void next_req(void *arg, struct sim_req *req)
+{
+	((Workload *) arg)->next(req);
+}
+
+static void usage(const char *prog)
+{
+	std::cerr << "Usage: " << prog << " [-w WORKERS] [-r QPS] [-n REQUESTS]"
+		  << " [-q QUANTUM_NS] [-p PREEMPT_NS] [-d DISPATCH_NS]"
+		  << " [-i IDLE_NS -k WAKE_NS]"
+		  << " [-c CONTEXTS] [-S SEED] [-o PREFIX]"
+		  << " -t TYPE [-t TYPE ...]" << std::endl;
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct des_params p;
+	struct sim_results r;
+	struct timespec start, end;
+	uint64_t seed = 0, done = 0;
+	double qps = 1000000, secs;
+	std::vector<std::string> types;
+	std::string prefix;
+	int opt, ret;
+
+	memset(&p, 0, sizeof(p));
+	p.num_workers = 16;
+	p.num_reqs = 1000000;
+	p.quantum_ns = 5000;
+	p.contexts = 65536;
+	while ((opt = getopt(argc, argv, "w:r:n:q:p:d:i:k:c:S:o:t:")) != -1) {
+		switch (opt) {
+		case 'w': p.num_workers = atoi(optarg); break;
+		case 'r': qps = atof(optarg); break;
+		case 'n': p.num_reqs = strtoull(optarg, NULL, 0); break;
+		case 'q': p.quantum_ns = strtoull(optarg, NULL, 0); break;
+		case 'p': p.preempt_ns = strtoull(optarg, NULL, 0); break;
+		case 'd': p.dispatch_ns = strtoull(optarg, NULL, 0); break;
+		case 'i': p.idle_ns = strtoull(optarg, NULL, 0); break;
+		case 'k': p.wake_ns = strtoull(optarg, NULL, 0); break;
+		case 'c': p.contexts = atol(optarg); break;
+		case 'S': seed = strtoull(optarg, NULL, 0); break;
+		case 'o': prefix = optarg; break;
+		case 't': types.push_back(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (types.empty() || types.size() > SIM_MAX_TYPES)
+		usage(argv[0]);
+
+	Workload w(seed);
+	for (auto &t : types) {
+		try {
+			w.addType(t);
+		} catch (std::exception &e) {
+			std::cerr << "Invalid type: " << t << std::endl;
+			usage(argv[0]);
+		}
+	}
+	w.start(qps);
+
+	p.num_types = w.numTypes();
+	for (int t = 0; t < p.num_types; t++)
+		p.slo_ns[t] = w.slos[t];
+	p.next = next_req;
+	p.arg = &w;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = des_run(&p, &r);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (ret) {
+		std::cerr << "des_run() failed: " << strerror(-ret) << std::endl;
+		return -1;
+	}
+	secs = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("# type fraction latency_us\n");
+	for (int t = 0; t < p.num_types; t++) {
+		sortLats(&r.lats[t]);
+		printCdf(t, &r.lats[t]);
+	}
+	for (int t = 0; t < p.num_types; t++) {
+		struct sim_lats *l = &r.lats[t];
+
+		done += l->nr;
+		printf("# ");
+		printSummary(t, l);
+		if (!prefix.empty() && !dumpLats(prefix, t, l))
+			std::cerr << "Cannot dump type " << t << std::endl;
+	}
+	printf("# sent %lu finished %lu dropped %lu preemptions %lu"
+	       " (simulated in %.2f s)\n", r.sent, done, r.dropped,
+	       r.preemptions, secs);
+	return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * harness.c - the worker and networker sides of the simulation harness
+ *
+ * The dispatcher runs do_dispatching() of dispatcher.c on its own thread.
+ * Each worker thread waits for requests the way worker.c does, spins for
+ * the remaining service time of the request and answers with
+ * worker_respond(). Posted IPIs become SIGUSR1, whose handler makes the
+ * worker give the request back as preempted. The calling thread plays the
+ * networker: it hands due requests to the dispatcher through
+ * networker_pointers and frees the ones returned through the mbuf rings.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ix/dispatch.h>
+
+#include "sim.h"
+
+#define CALIBRATION_NS  100000000
+#define GRACE_NS        1000000000
+
+struct cfg_parameters CFG;
+long sim_free_contexts;
+
+extern void do_dispatching(int num_cpus);
+
+struct worker_stats {
+        struct sim_lats lats[SIM_MAX_TYPES];
+        uint64_t preemptions;
+        volatile uint64_t finished;
+} __attribute__((aligned(64)));
+
+static struct worker_stats stats[MAX_WORKERS];
+static pthread_t workers[MAX_WORKERS];
+static volatile bool sim_stop;
+double sim_ticks_per_ns;
+static __thread volatile sig_atomic_t preempt_pending;
+
+void logk(int level, const char *fmt, ...)
+{
+        va_list ap;
+
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+}
+
+int numa_node_of_cpu(int cpu)
+{
+        return 0;
+}
+
+void mbuf_free(struct mbuf *m)
+{
+        free(m);
+}
+
+void dune_apic_send_posted_ipi(uint8_t vector, uint32_t dest_core)
+{
+        pthread_kill(workers[dest_core - 2], SIGUSR1);
+}
+
+static void preempt_handler(int sig)
+{
+        preempt_pending = 1;
+}
+
+static void sim_pin(int cpu)
+{
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double calibrate(void)
+{
+        uint64_t ns, tsc;
+
+        ns = now_ns();
+        tsc = rdtsc();
+        while (now_ns() - ns < CALIBRATION_NS)
+                ;
+        return (double) (rdtsc() - tsc) / (now_ns() - ns);
+}
+
+static int lats_merge(struct sim_lats *dst, struct sim_lats *src)
+{
+        size_t i;
+        int ret;
+
+        for (i = 0; i < src->nr; i++) {
+                ret = sim_lats_add(dst, src->ns[i]);
+                if (ret)
+                        return ret;
+        }
+        free(src->ns);
+        memset(src, 0, sizeof(*src));
+        return 0;
+}
+
+static void *worker_main(void *arg)
+{
+        int i = (long) arg;
+        struct worker_stats *s = &stats[i];
+        struct mbuf *req;
+        void *rnbl;
+        uint64_t start, now;
+
+        sim_pin(CFG.cpu[i + 2]);
+        while (true) {
+                while (dispatcher_requests[i].flag == WAITING) {
+                        if (sim_stop)
+                                return NULL;
+                        cpu_relax();
+                }
+                dispatcher_requests[i].flag = WAITING;
+                req = (struct mbuf *) dispatcher_requests[i].mbuf;
+                rnbl = dispatcher_requests[i].rnbl;
+
+                /* a signal that came in while waiting was for the request
+                 * before, which finished before it could be preempted */
+                preempt_pending = 0;
+                start = now = rdtsc();
+                while (now - start < req->left && !preempt_pending) {
+                        cpu_relax();
+                        now = rdtsc();
+                }
+
+                if (now - start >= req->left) {
+                        sim_lats_add(&s->lats[req->type],
+                                 (now - req->timestamp) / sim_ticks_per_ns);
+                        s->finished++;
+                        mbuf_ring_put(&mbuf_rings[i], req);
+                        worker_respond(i, rnbl, NULL, CONTEXT, FINISHED);
+                } else {
+                        preempt_pending = 0;
+                        req->left -= now - start;
+                        s->preemptions++;
+                        worker_respond(i, rnbl, req, CONTEXT, PREEMPTED);
+                }
+        }
+}
+
+static void *dispatcher_main(void *arg)
+{
+        sim_pin(CFG.cpu[0]);
+        do_dispatching(CFG.num_cpus);
+        return NULL;
+}
+
+static void drain_rings(int num_workers, struct sim_results *r)
+{
+        int i;
+
+        for (i = 0; i < num_workers; i++)
+                mbuf_ring_drain(&mbuf_rings[i]);
+        /* requests the dispatcher had no context for */
+        r->dropped += mbuf_ring_drain(DISPATCHER_MBUF_RING);
+}
+
+static uint64_t finished(int num_workers)
+{
+        uint64_t sum = 0;
+        int i;
+
+        for (i = 0; i < num_workers; i++)
+                sum += stats[i].finished;
+        return sum;
+}
+
+static void feed(const struct sim_params *p, struct sim_results *r)
+{
+        struct sim_req next;
+        struct mbuf *req;
+        uint64_t start, now, end;
+        int nr;
+
+        sim_pin(CFG.cpu[1]);
+        p->next(p->arg, &next);
+        start = rdtsc();
+        end = start + p->duration_ns * sim_ticks_per_ns;
+        while ((now = rdtsc()) < end) {
+                drain_rings(p->num_workers, r);
+                if (networker_pointers.cnt) {
+                        cpu_relax();
+                        continue;
+                }
+                for (nr = 0; nr < ETH_RX_MAX_BATCH; nr++) {
+                        uint64_t arrival = start +
+                                           next.arrival_ns * sim_ticks_per_ns;
+
+                        if (arrival > now)
+                                break;
+                        req = malloc(sizeof(*req));
+                        if (!req)
+                                break;
+                        req->next = NULL;
+                        req->timestamp = arrival;
+                        req->left = next.work_ns * sim_ticks_per_ns;
+                        req->type = next.type;
+                        networker_pointers.pkts[nr] = req;
+                        networker_pointers.types[nr] = next.type;
+                        r->sent++;
+                        p->next(p->arg, &next);
+                }
+                if (nr)
+                        networker_pointers.cnt = nr;
+                else
+                        cpu_relax();
+        }
+
+        /* let the backlog drain, as long as it does so in time */
+        end = rdtsc() + GRACE_NS * sim_ticks_per_ns;
+        while (finished(p->num_workers) + r->dropped < r->sent &&
+               rdtsc() < end) {
+                drain_rings(p->num_workers, r);
+                cpu_relax();
+        }
+}
+
+/**
+ * sim_run - runs the dispatcher and the workers on a stream of requests
+ * @p: the parameters of the run
+ * @r: filled with the results
+ *
+ * Must be called at most once per process: the dispatcher keeps running.
+ *
+ * Returns 0 if successful, otherwise failure.
+ */
+int sim_run(const struct sim_params *p, struct sim_results *r)
+{
+        struct sigaction sa;
+        pthread_t dispatcher;
+        int i, t, ret;
+
+        if (p->num_workers < 1 || p->num_workers > MAX_WORKERS ||
+            p->num_types < 1 || p->num_types > CFG_MAX_PORTS ||
+            p->num_types > SIM_MAX_TYPES)
+                return -EINVAL;
+
+        memset(r, 0, sizeof(*r));
+        /* threads sharing CPUs would measure the scheduler instead */
+        if (sysconf(_SC_NPROCESSORS_ONLN) < p->num_workers + 2) {
+                log_err("sim: %d workers need %d CPUs\n", p->num_workers,
+                        p->num_workers + 2);
+                return -EINVAL;
+        }
+        sim_ticks_per_ns = calibrate();
+        r->ticks_per_ns = sim_ticks_per_ns;
+
+        CFG.num_cpus = p->num_workers + 2;
+        for (i = 0; i < CFG.num_cpus; i++)
+                CFG.cpu[i] = i;
+        CFG.num_ports = p->num_types;
+        for (t = 0; t < p->num_types; t++)
+                CFG.slos[t] = p->slo_ns[t] * sim_ticks_per_ns;
+        task_mempool.elem_len = sizeof(struct task);
+        sim_free_contexts = p->contexts;
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = preempt_handler;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGUSR1, &sa, NULL))
+                return -errno;
+
+        for (i = 0; i < p->num_workers; i++) {
+                /* as init_worker() does */
+                worker_responses[i].flag = PROCESSED;
+                ret = pthread_create(&workers[i], NULL, worker_main,
+                                     (void *) (long) i);
+                if (ret)
+                        return -ret;
+        }
+        ret = pthread_create(&dispatcher, NULL, dispatcher_main, NULL);
+        if (ret)
+                return -ret;
+
+        feed(p, r);
+
+        sim_stop = true;
+        for (i = 0; i < p->num_workers; i++) {
+                pthread_join(workers[i], NULL);
+                r->preemptions += stats[i].preemptions;
+                for (t = 0; t < p->num_types; t++) {
+                        ret = lats_merge(&r->lats[t], &stats[i].lats[t]);
+                        if (ret)
+                                return ret;
+                }
+        }
+        return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * harness_main.cpp - runs the simulation harness on a synthetic workload
+ *
+ * Usage: harness [-w WORKERS] [-r QPS] [-s SECONDS] [-c CONTEXTS]
+ *                [-S SEED] [-o PREFIX] -t TYPE [-t TYPE ...]
+ *
+ * See workload.h for the format of TYPE. Prints the throughput and the
+ * latency percentiles of each type, in microseconds. With -o, the latencies
+ * of type N are also dumped to PREFIX<N>.bin.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <stdexcept>
+
+#include "lats.h"
+#include "sim.h"
+#include "workload.h"
+
+static void next_req(void *arg, struct sim_req *req)
+{
+	((Workload *) arg)->next(req);
+}
+
+static void usage(const char *prog)
+{
+	std::cerr << "Usage: " << prog << " [-w WORKERS] [-r QPS] [-s SECONDS]"
+		  << " [-c CONTEXTS] [-S SEED] [-o PREFIX] -t TYPE [-t TYPE ...]"
+		  << std::endl;
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sim_params p;
+	struct sim_results r;
+	uint64_t seed = 0, done = 0;
+	double qps = 100000, seconds = 1;
+	std::vector<std::string> types;
+	std::string prefix;
+	int opt, ret;
+
+	memset(&p, 0, sizeof(p));
+	p.num_workers = 4;
+	p.contexts = 65536;
+	while ((opt = getopt(argc, argv, "w:r:s:c:S:o:t:")) != -1) {
+		switch (opt) {
+		case 'w': p.num_workers = atoi(optarg); break;
+		case 'r': qps = atof(optarg); break;
+		case 's': seconds = atof(optarg); break;
+		case 'c': p.contexts = atol(optarg); break;
+		case 'S': seed = strtoull(optarg, NULL, 0); break;
+		case 'o': prefix = optarg; break;
+		case 't': types.push_back(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (types.empty() || types.size() > SIM_MAX_TYPES)
+		usage(argv[0]);
+
+	Workload w(seed);
+	for (auto &t : types) {
+		try {
+			w.addType(t);
+		} catch (std::exception &e) {
+			std::cerr << "Invalid type: " << t << std::endl;
+			usage(argv[0]);
+		}
+	}
+	w.start(qps);
+
+	p.num_types = w.numTypes();
+	for (int t = 0; t < p.num_types; t++)
+		p.slo_ns[t] = w.slos[t];
+	p.duration_ns = seconds * 1e9;
+	p.next = next_req;
+	p.arg = &w;
+
+	ret = sim_run(&p, &r);
+	if (ret) {
+		std::cerr << "sim_run() failed: " << strerror(-ret) << std::endl;
+		return -1;
+	}
+
+	printf("ticks/ns: %.3f\n", r.ticks_per_ns);
+	for (int t = 0; t < p.num_types; t++) {
+		struct sim_lats *l = &r.lats[t];
+
+		sortLats(l);
+		done += l->nr;
+		printSummary(t, l);
+		if (!prefix.empty() && !dumpLats(prefix, t, l))
+			std::cerr << "Cannot dump type " << t << std::endl;
+	}
+	printf("sent %lu finished %lu (%.0f rps) dropped %lu preemptions %lu\n",
+	       r.sent, done, done / seconds, r.dropped, r.preemptions);
+	fflush(stdout);
+	/* the dispatcher thread never returns */
+	_exit(0);
+}
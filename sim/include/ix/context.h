@@ -0,0 +1,57 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * context.h - contexts of the simulation harness
+ *
+ * Workers keep the progress of a request in the request itself, so a
+ * context only stands for a slot of a pool of fixed size, as in the
+ * dataplane. Only the dispatcher allocates and frees them.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include <ix/stddef.h>
+
+extern long sim_free_contexts;
+
+static inline int context_alloc(ucontext_t **cont, int node)
+{
+        if (unlikely(!sim_free_contexts))
+                return -1;
+        *cont = malloc(sizeof(ucontext_t));
+        if (unlikely(!*cont))
+                return -1;
+        sim_free_contexts--;
+        return 0;
+}
+
+static inline void context_free(ucontext_t *c)
+{
+        free(c);
+        sim_free_contexts++;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * mbuf.h - requests of the simulation harness
+ *
+ * Shadows the dataplane header. The dispatcher only passes mbufs around, so
+ * a request of the harness stands in for the packet that carried it.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct mbuf {
+        struct mbuf *next;
+        unsigned long timestamp; /* scheduled arrival (in CPU clock ticks) */
+        uint64_t left;          /* remaining service time (in ticks) */
+        uint8_t type;
+};
+
+#define mbuf_mtod(mbuf, type) ((type) (mbuf))
+#define mbuf_nextd_off(ptr, type, off) \
+        ((type) ((uintptr_t) (ptr) + (off)))
+#define mbuf_nextd(ptr, type) \
+        mbuf_nextd_off(ptr, type, sizeof(typeof(*ptr)))
+
+/* calibrated by the harness, for PREEMPT_TICKS_PER_NS */
+extern double sim_ticks_per_ns;
+
+extern void mbuf_free(struct mbuf *m);
+
+static inline void mbuf_free_bulk(struct mbuf **bufs, int n)
+{
+        int i;
+
+        for (i = 0; i < n; i++)
+                mbuf_free(bufs[i]);
+}
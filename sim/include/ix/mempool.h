@@ -0,0 +1,71 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * mempool.h - a single-threaded free list in place of the dataplane mempool
+ *
+ * Only the dispatcher allocates tasks, so a plain free list on top of
+ * malloc() is enough.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+
+#include <ix/stddef.h>
+#include <ix/log.h>
+
+struct mempool_datastore {
+        int unused;
+};
+
+struct mempool_hdr {
+        struct mempool_hdr *next;
+};
+
+struct mempool {
+        struct mempool_hdr *head;
+        size_t elem_len;
+};
+
+static inline void *mempool_alloc(struct mempool *m)
+{
+        struct mempool_hdr *h = m->head;
+
+        if (likely(h)) {
+                m->head = h->next;
+                return h;
+        }
+        return malloc(m->elem_len);
+}
+
+static inline void mempool_free(struct mempool *m, void *ptr)
+{
+        struct mempool_hdr *h = ptr;
+
+        h->next = m->head;
+        m->head = h;
+}
+
+extern int numa_node_of_cpu(int cpu);
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * lats.c - latency samples of the harness and the simulator
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "sim.h"
+
+/**
+ * sim_lats_add - records a latency
+ * @l: the samples
+ * @ns: the latency
+ *
+ * Returns 0 if successful, otherwise -ENOMEM.
+ */
+int sim_lats_add(struct sim_lats *l, uint64_t ns)
+{
+        uint64_t *tmp;
+        size_t cap;
+
+        if (l->nr == l->cap) {
+                cap = l->cap ? 2 * l->cap : 4096;
+                tmp = realloc(l->ns, cap * sizeof(*l->ns));
+                if (!tmp)
+                        return -ENOMEM;
+                l->ns = tmp;
+                l->cap = cap;
+        }
+        l->ns[l->nr++] = ns;
+        return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * lats.h - reports latency samples of the harness and the simulator
+ *
+ * Samples are dumped in the format of the clients, one uint64_t in ns per
+ * request, so client/parselats.py and compare.py read all of them.
+ */
+
+#ifndef __LATS_H
+#define __LATS_H
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+#include "sim.h"
+
+static const double cdf_points[] = {
+	0.01, 0.05, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 0.95, 0.99,
+	0.995, 0.999, 0.9999, 1.0,
+};
+
+static inline void sortLats(struct sim_lats *l)
+{
+	std::sort(l->ns, l->ns + l->nr);
+}
+
+/* of sorted samples, in us */
+static inline double latPct(const struct sim_lats *l, double p)
+{
+	if (!l->nr)
+		return 0;
+	return l->ns[std::min(l->nr - 1, (size_t) (p * l->nr))] / 1000.0;
+}
+
+static inline void printSummary(int type, const struct sim_lats *l)
+{
+	printf("type %d: finished %zu p50 %.1f p99 %.1f p99.9 %.1f us\n",
+	       type, l->nr, latPct(l, 0.5), latPct(l, 0.99),
+	       latPct(l, 0.999));
+}
+
+static inline void printCdf(int type, const struct sim_lats *l)
+{
+	for (double p : cdf_points)
+		printf("%d %.4f %.3f\n", type, p, latPct(l, p));
+}
+
+static inline bool dumpLats(const std::string &prefix, int type,
+			    const struct sim_lats *l)
+{
+	std::ofstream out(prefix + std::to_string(type) + ".bin",
+			  std::ios::out | std::ios::binary);
+
+	out.write(reinterpret_cast<const char *>(l->ns),
+		  l->nr * sizeof(*l->ns));
+	return out.good();
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * sim.h - runs the dispatcher on synthetic workloads outside the dataplane
+ *
+ * The harness (harness.c) builds the dispatcher of the dataplane unmodified
+ * and runs it on a thread, with worker threads that follow the protocol of worker.c and
+ * are preempted by signals. Requests come from a generator, in place of the
+ * network, and spin for their service time.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_MAX_TYPES   16
+
+struct sim_req {
+        uint64_t arrival_ns;    /* since the start of the run */
+        uint64_t work_ns;
+        uint8_t type;
+};
+
+/* fills in the next request; arrivals must not go back in time */
+typedef void (*sim_next_fn)(void *arg, struct sim_req *req);
+
+struct sim_params {
+        int num_workers;
+        int num_types;
+        uint64_t slo_ns[SIM_MAX_TYPES];
+        uint64_t duration_ns;
+        long contexts;          /* the size of the context pool */
+        sim_next_fn next;
+        void *arg;
+};
+
+struct sim_lats {
+        uint64_t *ns;
+        size_t nr;
+        size_t cap;
+};
+
+struct sim_results {
+        struct sim_lats lats[SIM_MAX_TYPES];    /* of finished requests */
+        uint64_t sent;
+        uint64_t dropped;       /* for want of a context */
+        uint64_t preemptions;
+        double ticks_per_ns;
+};
+
+/*
+ * The discrete-event simulator models the same dispatcher, using its
+ * policy, with workers that cost nothing but the service time, a fixed
+ * quantum and a fixed cost per preemption. Time is simulated, so it scales
+ * to many workers and heavy overload.
+ */
+struct des_params {
+        int num_workers;
+        int num_types;
+        uint64_t slo_ns[SIM_MAX_TYPES];
+        uint64_t num_reqs;
+        uint64_t quantum_ns;    /* 0 to never preempt */
+        uint64_t preempt_ns;    /* worker time lost per preemption */
+        uint64_t dispatch_ns;   /* dispatcher time per dispatch */
+        uint64_t idle_ns;       /* idle time after which a worker parks */
+        uint64_t wake_ns;       /* 0, or the time a parked worker takes to
+                                   start a request */
+        long contexts;
+        sim_next_fn next;
+        void *arg;
+};
+
+extern int sim_lats_add(struct sim_lats *l, uint64_t ns);
+extern int sim_run(const struct sim_params *p, struct sim_results *r);
+extern int des_run(const struct des_params *p, struct sim_results *r);
+
+#ifdef __cplusplus
+}
+#endif
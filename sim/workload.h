@@ -0,0 +1,148 @@
+/*
+ * Copyright 2018-19 Board of Trustees of Stanford University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+/*
+ * workload.h - open-loop request streams built from the client distributions
+ *
+ * A request type is given as DIST,SHARE,SLO_NS where DIST is one of
+ *   exp:MEAN_NS
+ *   bimodal:W1_NS:W2_NS:RATIO
+ *   trimodal:W1_NS:W2_NS:W3_NS:RATIO1:RATIO2
+ *   lognormal:MEAN_NS:STD_NS
+ * SHARE is the fraction of the arrivals of that type, relative to the sum
+ * of the shares, and SLO_NS weighs the type in the dispatcher's policy.
+ * Arrivals are Poisson, as in the clients. They are drawn in ps, so that
+ * rates beyond one request per ns do not round to gaps of zero.
+ */
+
+#ifndef __WORKLOAD_H
+#define __WORKLOAD_H
+
+#include <functional>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../client/dist.h"
+#include "sim.h"
+
+class Workload {
+    private:
+	std::unique_ptr<ExpDist> arrivals;
+	std::default_random_engine g;
+	std::uniform_real_distribution<double> pick;
+	std::vector<double> shares;
+	std::vector<std::function<uint64_t()>> work;
+	double total_share;
+	std::mt19937_64 seeds;
+
+	/*
+	 * The engine of dist.h is a multiplicative LCG, whose streams from
+	 * nearby seeds are correlated, so seeds are drawn at random.
+	 */
+	uint64_t nextSeed() {
+		return seeds() % 2147483646 + 1;
+	}
+
+	static std::vector<std::string> split(const std::string &s, char sep) {
+		std::vector<std::string> parts;
+		std::stringstream ss(s);
+		std::string part;
+
+		while (std::getline(ss, part, sep))
+			parts.push_back(part);
+		return parts;
+	}
+
+	static std::function<uint64_t()> parseDist(const std::string &s,
+						    uint64_t seed) {
+		std::vector<std::string> a = split(s, ':');
+		std::vector<double> v;
+
+		for (size_t i = 1; i < a.size(); i++)
+			v.push_back(std::stod(a[i]));
+		if (a[0] == "exp" && v.size() == 1) {
+			auto d = std::make_shared<ExpDist>(1.0 / v[0], seed, 0);
+			return [d] { return d->workNs(); };
+		} else if (a[0] == "bimodal" && v.size() == 3) {
+			auto d = std::make_shared<BimodalDist>(seed, v[0], v[1],
+							       v[2]);
+			return [d] { return d->workNs(); };
+		} else if (a[0] == "trimodal" && v.size() == 5) {
+			auto d = std::make_shared<TrimodalDist>(seed, v[0], v[1],
+								v[2], v[3], v[4]);
+			return [d] { return d->workNs(); };
+		} else if (a[0] == "lognormal" && v.size() == 2) {
+			auto d = std::make_shared<LognormalDist>(seed, v[0],
+								 v[1]);
+			return [d] { return d->workNs(); };
+		}
+		throw std::invalid_argument(s);
+	}
+
+    public:
+	std::vector<uint64_t> slos;
+
+	/* every stream draws from its own engine, seeded from seed */
+	Workload(uint64_t seed)
+	    : pick(0.0, 1.0), total_share(0), seeds(seed) {
+		g.seed(nextSeed());
+	}
+
+	/* throws std::invalid_argument on a malformed spec */
+	void addType(const std::string &spec) {
+		std::vector<std::string> a = split(spec, ',');
+
+		if (a.size() != 3 || std::stod(a[1]) <= 0 ||
+		    std::stoull(a[2]) == 0)
+			throw std::invalid_argument(spec);
+		work.push_back(parseDist(a[0], nextSeed()));
+		total_share += std::stod(a[1]);
+		shares.push_back(total_share);
+		slos.push_back(std::stoull(a[2]));
+	}
+
+	size_t numTypes() const {
+		return work.size();
+	}
+
+	void start(double qps) {
+		arrivals.reset(new ExpDist(qps * 1e-12, nextSeed(), 0));
+	}
+
+	void next(struct sim_req *req) {
+		double p = pick(g) * total_share;
+		size_t t = 0;
+
+		while (t < shares.size() - 1 && p >= shares[t])
+			t++;
+		req->arrival_ns = arrivals->nextArrivalNs() / 1000;
+		req->work_ns = work[t]();
+		req->type = t;
+	}
+};
+
+#endif